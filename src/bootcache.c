@@ -0,0 +1,449 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *
+ *  Copyright (c) 2008-2011 Yuri Bushmelev <jay4mail@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "config.h"
+
+#ifdef USE_BOOTCACHE
+
+#include "util.h"
+#include "bootcache.h"
+
+
+/* FNV-1a hash of cache payload */
+static unsigned int bootcache_checksum(const char *data, unsigned int size)
+{
+	unsigned int i, h = 2166136261U;
+
+	for (i = 0; i < size; i++) {
+		h ^= (unsigned char)data[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+
+/* Free entry */
+static void bootcache_free_entry(kx_bootcache_entry *entry)
+{
+	dispose(entry->data);
+	free(entry);
+}
+
+
+/* Add entry to cache list */
+static int bootcache_add(kx_bootcache *bc, kx_bootcache_entry *entry)
+{
+	/* Resize list when needed before adding item */
+	if (bc->count >= bc->size) {
+		kx_bootcache_entry **new_list;
+		unsigned int new_size;
+
+		new_size = bc->size * 2;
+		new_list = realloc(bc->list, new_size * sizeof(*(bc->list)));
+		if (NULL == new_list) {
+			DPRINTF("Can't resize boot cache list");
+			return -1;
+		}
+
+		bc->size = new_size;
+		bc->list = new_list;
+	}
+
+	bc->list[bc->count] = entry;
+	++bc->count;
+	return 0;
+}
+
+
+/* Read one entry from payload */
+static kx_bootcache_entry *bootcache_read_entry(kx_buffer *buf)
+{
+	kx_bootcache_entry *entry;
+	char *fstype;
+	int size;
+
+	entry = malloc(sizeof(*entry));
+	if (NULL == entry) {
+		DPRINTF("Can't allocate boot cache entry");
+		return NULL;
+	}
+	entry->data = NULL;
+
+	if ( (-1 == buffer_get_int(buf, &entry->major)) ||
+			(-1 == buffer_get_int(buf, &entry->minor)) ||
+			(-1 == buffer_get(buf, &entry->blocks, sizeof(entry->blocks))) ||
+			(-1 == buffer_get_str(buf, &fstype)) )
+		goto free_entry;
+
+	/* Unknown FS type means entry from another kexecboot build */
+	entry->fstype = fstype_lookup(fstype);
+	dispose(fstype);
+	if (NULL == entry->fstype) goto free_entry;
+
+	if ( (-1 == buffer_get_int(buf, &entry->with_icons)) ||
+			(-1 == buffer_get(buf, &entry->fp, sizeof(entry->fp))) ||
+			(-1 == buffer_get_int(buf, &size)) ||
+			(size < 0) || (buf->pos + size > buf->fill) )
+		goto free_entry;
+
+	entry->size = size;
+	if (size > 0) {
+		entry->data = malloc(size);
+		if (NULL == entry->data) goto free_entry;
+		if (-1 == buffer_get(buf, entry->data, size)) goto free_entry;
+	}
+
+	return entry;
+
+free_entry:
+	bootcache_free_entry(entry);
+	return NULL;
+}
+
+
+/* Read and check cache file. Return count of entries loaded */
+static int bootcache_load(kx_bootcache *bc)
+{
+	kx_buffer buf;
+	kx_bootcache_entry *entry;
+	int fd, n, magic, version, len, sum, count, i;
+
+	fd = open(bc->path, O_RDONLY);
+	if (fd < 0) {
+		log_msg(lg, "Can't open boot cache %s: %s", bc->path, ERRMSG);
+		return 0;
+	}
+
+	if (-1 == buffer_init(&buf, 4096)) {
+		close(fd);
+		return 0;
+	}
+
+	/* Header first */
+	while (buf.fill < 4 * sizeof(int)) {
+		n = buffer_read_fd(&buf, fd);
+		if (n <= 0) break;
+	}
+
+	if ( (-1 == buffer_get_int(&buf, &magic)) ||
+			(-1 == buffer_get_int(&buf, &version)) ||
+			(-1 == buffer_get_int(&buf, &len)) ||
+			(-1 == buffer_get_int(&buf, &sum)) ||
+			(BOOTCACHE_MAGIC != magic) || (BOOTCACHE_VERSION != version) ||
+			(len < 0) || (len > BOOTCACHE_MAX_SIZE) ) {
+		log_msg(lg, "Boot cache %s is empty or has wrong format", bc->path);
+		goto out;
+	}
+
+	/* Payload. Raw partition may hold garbage after it */
+	while (buf.fill < buf.pos + len) {
+		n = buffer_read_fd(&buf, fd);
+		if (n <= 0) break;
+	}
+
+	if ( (buf.fill < buf.pos + len) ||
+			(bootcache_checksum(buf.data + buf.pos, len) != (unsigned int)sum) ) {
+		log_msg(lg, "Boot cache %s is broken", bc->path);
+		goto out;
+	}
+	buf.fill = buf.pos + len;
+
+	if (-1 == buffer_get_int(&buf, &count)) goto out;
+	for (i = 0; i < count; i++) {
+		entry = bootcache_read_entry(&buf);
+		if (NULL == entry) break;
+		if (-1 == bootcache_add(bc, entry)) {
+			bootcache_free_entry(entry);
+			break;
+		}
+	}
+
+out:
+	buffer_clean(&buf);
+	close(fd);
+	return bc->count;
+}
+
+
+kx_bootcache *bootcache_open(const char *path)
+{
+	kx_bootcache *bc;
+
+	bc = malloc(sizeof(*bc));
+	if (NULL == bc) {
+		DPRINTF("Can't allocate boot cache");
+		return NULL;
+	}
+
+	bc->size = 4;
+	bc->count = 0;
+	bc->dirty = 0;
+	bc->path = strdup(path);
+	bc->list = malloc(bc->size * sizeof(*(bc->list)));
+	if ( (NULL == bc->path) || (NULL == bc->list) ) {
+		DPRINTF("Can't allocate boot cache list");
+		dispose(bc->path);
+		dispose(bc->list);
+		free(bc);
+		return NULL;
+	}
+
+	log_msg(lg, "Boot cache %s: %d entries loaded", path, bootcache_load(bc));
+	return bc;
+}
+
+
+/* Entry belongs to the same device */
+static int bootcache_same_device(kx_bootcache_entry *entry, struct device_t *dev)
+{
+	return ( (entry->major == dev->major) && (entry->minor == dev->minor) );
+}
+
+
+kx_bootcache_entry *bootcache_find(kx_bootcache *bc, struct device_t *dev,
+		int with_icons)
+{
+	int i;
+	kx_bootcache_entry *entry;
+
+	if (!dev->fp.valid) return NULL;
+
+	for (i = 0; i < bc->count; i++) {
+		entry = bc->list[i];
+		if (!bootcache_same_device(entry, dev)) continue;
+
+		if ( (entry->blocks == dev->blocks) &&
+				(entry->fstype == dev->fstype) &&
+				(entry->with_icons == with_icons) &&
+				(entry->fp.wtime == dev->fp.wtime) &&
+				!memcmp(entry->fp.uuid, dev->fp.uuid, sizeof(entry->fp.uuid)) )
+			return entry;
+
+		/* There is only one entry per device */
+		return NULL;
+	}
+
+	return NULL;
+}
+
+
+int bootcache_get(kx_bootcache_entry *entry, struct cfgdata_t *cfgdata)
+{
+	kx_buffer buf;
+
+	if (0 == entry->size) {
+		init_cfgdata(cfgdata);
+		return -1;
+	}
+
+	/* Wrap entry data without copying */
+	buf.data = entry->data;
+	buf.size = entry->size;
+	buf.fill = entry->size;
+	buf.pos = 0;
+
+	if (-1 == cfgdata_unpack(cfgdata, &buf)) {
+		destroy_cfgdata(cfgdata);
+		return -1;
+	}
+
+	if (0 == cfgdata->count) {
+		destroy_cfgdata(cfgdata);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int bootcache_update(kx_bootcache *bc, struct device_t *dev, int with_icons,
+		const char *data, unsigned int size)
+{
+	int i;
+	kx_bootcache_entry *entry;
+
+	if (!dev->fp.valid) return -1;
+
+	entry = malloc(sizeof(*entry));
+	if (NULL == entry) {
+		DPRINTF("Can't allocate boot cache entry");
+		return -1;
+	}
+
+	entry->major = dev->major;
+	entry->minor = dev->minor;
+	entry->blocks = dev->blocks;
+	entry->fstype = dev->fstype;
+	entry->with_icons = with_icons;
+	entry->fp = dev->fp;
+	entry->size = size;
+	entry->data = NULL;
+	if (size > 0) {
+		entry->data = malloc(size);
+		if (NULL == entry->data) {
+			DPRINTF("Can't allocate boot cache entry data");
+			free(entry);
+			return -1;
+		}
+		memcpy(entry->data, data, size);
+	}
+
+	bc->dirty = 1;
+
+	/* Replace old entry of device */
+	for (i = 0; i < bc->count; i++) {
+		if (bootcache_same_device(bc->list[i], dev)) {
+			bootcache_free_entry(bc->list[i]);
+			bc->list[i] = entry;
+			return 0;
+		}
+	}
+
+	if (-1 == bootcache_add(bc, entry)) {
+		bootcache_free_entry(entry);
+		return -1;
+	}
+	return 0;
+}
+
+
+/* Write data to file. Regular files are replaced atomically */
+static int bootcache_write(const char *path, kx_buffer *buf)
+{
+	char tmppath[PATH_MAX];
+	struct stat sinfo;
+	int fd, is_file;
+
+	is_file = ( (-1 == stat(path, &sinfo)) || S_ISREG(sinfo.st_mode) );
+
+	if (is_file) {
+		snprintf(tmppath, sizeof(tmppath), "%s.new", path);
+		fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	} else {
+		/* Raw partition */
+		fd = open(path, O_WRONLY);
+	}
+
+	if (fd < 0) {
+		log_msg(lg, "Can't open boot cache %s: %s", path, ERRMSG);
+		return -1;
+	}
+
+	if ( (-1 == buffer_write_fd(buf, fd)) || (-1 == fsync(fd)) ) {
+		log_msg(lg, "Can't write boot cache %s: %s", path, ERRMSG);
+		close(fd);
+		if (is_file) unlink(tmppath);
+		return -1;
+	}
+	close(fd);
+
+	if ( is_file && (-1 == rename(tmppath, path)) ) {
+		log_msg(lg, "Can't rename boot cache %s: %s", tmppath, ERRMSG);
+		unlink(tmppath);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int bootcache_save(kx_bootcache *bc)
+{
+	kx_buffer buf;
+	kx_bootcache_entry *entry;
+	int i, rc;
+	unsigned int len;
+
+	if (!bc->dirty) return 0;
+
+	if (-1 == buffer_init(&buf, 4096)) return -1;
+
+	/* Header will be filled when payload is ready */
+	for (i = 0; i < 4; i++) buffer_put_int(&buf, 0);
+
+	buffer_put_int(&buf, bc->count);
+	for (i = 0; i < bc->count; i++) {
+		entry = bc->list[i];
+		buffer_put_int(&buf, entry->major);
+		buffer_put_int(&buf, entry->minor);
+		buffer_put(&buf, &entry->blocks, sizeof(entry->blocks));
+		buffer_put_str(&buf, entry->fstype);
+		buffer_put_int(&buf, entry->with_icons);
+		buffer_put(&buf, &entry->fp, sizeof(entry->fp));
+		buffer_put_int(&buf, entry->size);
+		if (entry->size > 0) buffer_put(&buf, entry->data, entry->size);
+	}
+
+	len = buf.fill - 4 * sizeof(int);
+	if (len > BOOTCACHE_MAX_SIZE) {
+		log_msg(lg, "Boot cache is too big (%u bytes)", len);
+		buffer_clean(&buf);
+		return -1;
+	}
+
+	/* Fill header */
+	((int *)buf.data)[0] = BOOTCACHE_MAGIC;
+	((int *)buf.data)[1] = BOOTCACHE_VERSION;
+	((int *)buf.data)[2] = len;
+	((int *)buf.data)[3] = bootcache_checksum(buf.data + 4 * sizeof(int), len);
+
+	rc = bootcache_write(bc->path, &buf);
+	if (0 == rc) {
+		bc->dirty = 0;
+		log_msg(lg, "Boot cache %s: %d entries saved", bc->path, bc->count);
+	}
+
+	buffer_clean(&buf);
+	return rc;
+}
+
+
+void bootcache_clear(kx_bootcache *bc)
+{
+	int i;
+
+	if (!bc) return;
+
+	for (i = 0; i < bc->count; i++)
+		bootcache_free_entry(bc->list[i]);
+	if (bc->count) bc->dirty = 1;
+	bc->count = 0;
+}
+
+void bootcache_close(kx_bootcache *bc)
+{
+	int i;
+
+	if (!bc) return;
+
+	for (i = 0; i < bc->count; i++)
+		bootcache_free_entry(bc->list[i]);
+	free(bc->list);
+	free(bc->path);
+	free(bc);
+}
+
+#endif	// USE_BOOTCACHE
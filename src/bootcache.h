@@ -0,0 +1,81 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *
+ *  Copyright (c) 2008-2011 Yuri Bushmelev <jay4mail@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+#ifndef _HAVE_BOOTCACHE_H_
+#define _HAVE_BOOTCACHE_H_
+
+#include "config.h"
+#include "util.h"
+#include "cfgparser.h"
+#include "devicescan.h"
+#include "fstype/fstype.h"
+
+/* Cache file limits */
+#define BOOTCACHE_MAGIC		0x4b584243	/* 'KXBC' */
+#define BOOTCACHE_VERSION	4
+#define BOOTCACHE_MAX_SIZE	(4 * 1024 * 1024)
+
+/*
+ * Parsed boot config of one device. Entry is valid while device numbers,
+ * size, FS type and superblock fingerprint are the same.
+ */
+typedef struct {
+	int major, minor;			/* Device numbers */
+	unsigned long long blocks;	/* Device size in 1K blocks */
+	const char *fstype;			/* Filesystem (static name from fstype.c) */
+	int with_icons;				/* Icons are included in data */
+	struct fs_fingerprint fp;	/* Superblock fingerprint */
+	unsigned int size;			/* Packed cfgdata size (0 - nothing to boot) */
+	char *data;					/* Packed cfgdata */
+} kx_bootcache_entry;
+
+/*
+ * Boot items cache stored in file or on raw partition at 'path'.
+ * Layout: magic, version, payload length, payload checksum, payload.
+ */
+typedef struct {
+	char *path;					/* Cache file or device */
+	int dirty;					/* Cache should be saved */
+	unsigned int size;			/* Allocated entries count */
+	unsigned int count;			/* Filled entries count */
+	kx_bootcache_entry **list;	/* Entries array */
+} kx_bootcache;
+
+
+/* Load cache from 'path'. Empty cache is returned when it is absent or broken */
+kx_bootcache *bootcache_open(const char *path);
+
+/* Find entry matching to device (dev->fstype and dev->fp are filled) */
+kx_bootcache_entry *bootcache_find(kx_bootcache *bc, struct device_t *dev,
+		int with_icons);
+
+/* Unpack entry data into cfgdata. Return 0 if there is something to boot */
+int bootcache_get(kx_bootcache_entry *entry, struct cfgdata_t *cfgdata);
+
+/* Replace device entry with packed cfgdata (size 0 - nothing to boot) */
+int bootcache_update(kx_bootcache *bc, struct device_t *dev, int with_icons,
+		const char *data, unsigned int size);
+
+/* Write cache back when it was changed */
+int bootcache_save(kx_bootcache *bc);
+
+/* Drop all entries. Devices are probed again and cache is rewritten */
+void bootcache_clear(kx_bootcache *bc);
+
+/* Free cache structure */
+void bootcache_close(kx_bootcache *bc);
+
+#endif //_HAVE_BOOTCACHE_H_
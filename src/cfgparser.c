@@ -28,6 +28,10 @@
 #include "util.h"
 #include "cfgparser.h"
 
+#ifdef USE_ICONS
+#include "xpm.h"
+#endif
+
 kx_cfg_section *cfg_section_new(struct cfgdata_t *cfgdata)
 {
 	kx_cfg_section *sc;
@@ -62,6 +66,10 @@ kx_cfg_section *cfg_section_new(struct cfgdata_t *cfgdata)
 	sc->cmdline_append = NULL;
 	sc->cmdline = NULL;
 	sc->initrd = NULL;
+	sc->checksum = NULL;
+	sc->initrd_checksum = NULL;
+	sc->kernel_info = NULL;
+	sc->fitconf = NULL;
 	sc->iconpath = NULL;
 	sc->icondata = NULL;
 	sc->priority = 0;
@@ -94,6 +102,14 @@ void init_cfgdata(struct cfgdata_t *cfgdata)
 	cfgdata->mtdparts = NULL;
 	cfgdata->fbcon = NULL;
 	cfgdata->ttydev = NULL;
+	cfgdata->waittime = -1;
+	cfgdata->waitdev = NULL;
+#ifdef USE_BOOTCACHE
+	cfgdata->cachepath = NULL;
+#endif
+#ifdef USE_TRACE
+	cfgdata->tracepath = NULL;
+#endif
 }
 
 void destroy_cfgdata(struct cfgdata_t *cfgdata)
@@ -132,6 +148,45 @@ static int set_path(char **path, char *value)
 	return 0;
 }
 
+/* Store white-space separated list of paths prefixed with mountpoint */
+static int set_path_list(char **path, char *value)
+{
+	char *p, *word;
+	size_t len = 0;
+	int n = 0;
+
+	dispose(*path);
+
+	for (p = value; *p; p++) {
+		if ( (!isspace(*p)) && ((p == value) || isspace(p[-1])) ) ++n;
+	}
+	if (n < 2) return set_path(path, value);
+
+	*path = malloc(strlen(value) + n * strlen(MOUNTPOINT) + 1);
+	if (NULL == *path) {
+		DPRINTF("Can't allocate memory to store paths '%s'", value);
+		return -1;
+	}
+
+	p = value;
+	for (;;) {
+		while (isspace(*p)) ++p;
+		if ('\0' == *p) break;
+
+		word = p;
+		while ( (*p) && !isspace(*p) ) ++p;
+
+		if (len) (*path)[len++] = ' ';
+		strcpy(*path + len, MOUNTPOINT);
+		len += strlen(MOUNTPOINT);
+		memcpy(*path + len, word, p - word);
+		len += p - word;
+	}
+	(*path)[len] = '\0';
+
+	return 0;
+}
+
 static int set_label(struct cfgdata_t *cfgdata, char *value)
 {
 	kx_cfg_section *sc;
@@ -206,7 +261,43 @@ static int set_initrd(struct cfgdata_t *cfgdata, char *value)
 	sc = cfgdata->current;
 	if (!sc) return -1;
 
-	return set_path(&sc->initrd, value);
+	return set_path_list(&sc->initrd, value);
+}
+
+/* Store SHA-256 hex digest */
+static int set_checksum(char **checksum, char *value)
+{
+	const char *p;
+
+	for (p = value; isxdigit(*p); p++);
+	if ( ('\0' != *p) || (64 != p - value) ) {
+		log_msg(lg, "Bad SHA-256 checksum '%s'", value);
+		return -1;
+	}
+
+	dispose(*checksum);
+	*checksum = strdup(value);
+	return 0;
+}
+
+static int set_kernel_checksum(struct cfgdata_t *cfgdata, char *value)
+{
+	kx_cfg_section *sc;
+
+	sc = cfgdata->current;
+	if (!sc) return -1;
+
+	return set_checksum(&sc->checksum, value);
+}
+
+static int set_initrd_checksum(struct cfgdata_t *cfgdata, char *value)
+{
+	kx_cfg_section *sc;
+
+	sc = cfgdata->current;
+	if (!sc) return -1;
+
+	return set_checksum(&sc->initrd_checksum, value);
 }
 
 static int set_priority(struct cfgdata_t *cfgdata, char *value)
@@ -366,6 +457,48 @@ static int set_ttydev(struct cfgdata_t *cfgdata, char *value)
 	return 0;
 }
 
+static int set_waittime(struct cfgdata_t *cfgdata, char *value)
+{
+	cfgdata->waittime = get_nni(value, NULL);
+	if (cfgdata->waittime < 0) {
+		log_msg(lg, "Can't convert '%s' to integer", value);
+		cfgdata->waittime = -1;
+		return -1;
+	}
+	return 0;
+}
+
+static int set_waitdev(struct cfgdata_t *cfgdata, char *value)
+{
+	const char str_dev[] = "/dev/";
+
+	/* Store kernel name of device (as in /proc/partitions) */
+	if (!strncmp(value, str_dev, sizeof(str_dev) - 1))
+		value += sizeof(str_dev) - 1;
+
+	dispose(cfgdata->waitdev);
+	cfgdata->waitdev = strdup(value);
+	return 0;
+}
+
+#ifdef USE_BOOTCACHE
+static int set_cachepath(struct cfgdata_t *cfgdata, char *value)
+{
+	dispose(cfgdata->cachepath);
+	cfgdata->cachepath = strdup(value);
+	return 0;
+}
+#endif
+
+#ifdef USE_TRACE
+static int set_tracepath(struct cfgdata_t *cfgdata, char *value)
+{
+	dispose(cfgdata->tracepath);
+	cfgdata->tracepath = strdup(value);
+	return 0;
+}
+#endif
+
 enum cfg_type_t { CFG_NONE, CFG_FILE, CFG_CMDLINE };
 
 /* Config file (keywords -> parsing functions) tuples array */
@@ -390,10 +523,20 @@ static struct cfg_keyfunc_t cfg_keyfunc[] = {
 	{ CFG_FILE, 1, "APPEND", set_cmdline_append },
 	{ CFG_FILE, 1, "CMDLINE", set_cmdline },
 	{ CFG_FILE, 1, "INITRD", set_initrd },
+	{ CFG_FILE, 1, "CHECKSUM", set_kernel_checksum },
+	{ CFG_FILE, 1, "INITRD_CHECKSUM", set_initrd_checksum },
 	{ CFG_FILE, 1, "PRIORITY", set_priority },
 	{ CFG_CMDLINE, 1, "FBCON", set_fbcon },
 	{ CFG_CMDLINE, 1, "MTDPARTS", set_mtdparts },
 	{ CFG_CMDLINE, 1, "CONSOLE", set_ttydev },
+	{ CFG_CMDLINE, 1, "KEXECBOOT.WAIT", set_waittime },
+	{ CFG_CMDLINE, 1, "KEXECBOOT.WAITDEV", set_waitdev },
+#ifdef USE_BOOTCACHE
+	{ CFG_CMDLINE, 1, "KEXECBOOT.CACHE", set_cachepath },
+#endif
+#ifdef USE_TRACE
+	{ CFG_CMDLINE, 1, "KEXECBOOT.TRACE", set_tracepath },
+#endif
 
 	{ CFG_NONE, 0, NULL, NULL }
 };
@@ -528,6 +671,36 @@ int parse_cmdline(struct cfgdata_t *cfgdata)
 	return 0;
 }
 
+/* Remove section 'no' and free its data */
+void cfgdata_del_section(struct cfgdata_t *cfgdata, unsigned int no)
+{
+	kx_cfg_section *sc;
+
+	if (no >= cfgdata->count) return;
+	sc = cfgdata->list[no];
+
+	dispose(sc->label);
+	dispose(sc->dtbpath);
+	dispose(sc->kernelpath);
+	dispose(sc->cmdline_append);
+	dispose(sc->cmdline);
+	dispose(sc->initrd);
+	dispose(sc->checksum);
+	dispose(sc->initrd_checksum);
+	dispose(sc->kernel_info);
+	dispose(sc->fitconf);
+	dispose(sc->iconpath);
+#ifdef USE_ICONS
+	fb_destroy_picture(sc->icondata);
+#endif
+	free(sc);
+
+	--cfgdata->count;
+	memmove(cfgdata->list + no, cfgdata->list + no + 1,
+			(cfgdata->count - no) * sizeof(*(cfgdata->list)));
+	if (cfgdata->current == sc) cfgdata->current = NULL;
+}
+
 /* Set kernelpath only (may be used when no config file found) */
 int cfgdata_add_kernel(struct cfgdata_t *cfgdata, char *kernelpath)
 {
@@ -540,3 +713,126 @@ int cfgdata_add_kernel(struct cfgdata_t *cfgdata, char *kernelpath)
 	sc->kernelpath = strdup(kernelpath);
 	return 0;
 }
+
+#ifdef USE_ICONS
+/* Serialize parsed icon into buffer */
+static int pack_icon(kx_picture *pic, kx_buffer *buf)
+{
+	if (NULL == pic) return buffer_put_int(buf, -1);
+
+	if ( (-1 == buffer_put_int(buf, pic->width)) ||
+			(-1 == buffer_put_int(buf, pic->height)) )
+		return -1;
+
+	return buffer_put(buf, pic->pixels,
+			pic->width * pic->height * sizeof(*(pic->pixels)));
+}
+
+/* Deserialize parsed icon from buffer */
+static int unpack_icon(kx_picture **pic, kx_buffer *buf)
+{
+	int width, height;
+	kx_picture *p;
+
+	*pic = NULL;
+	if (-1 == buffer_get_int(buf, &width)) return -1;
+	if (-1 == width) return 0;	/* No icon */
+	if (-1 == buffer_get_int(buf, &height)) return -1;
+
+	p = malloc(sizeof(*p));
+	if (NULL == p) {
+		DPRINTF("Can't allocate memory for icon");
+		return -1;
+	}
+	p->width = width;
+	p->height = height;
+	p->native = NULL;
+	p->runs = NULL;
+	p->nruns = 0;
+	p->pixels = malloc(width * height * sizeof(*(p->pixels)));
+	if ( (NULL == p->pixels) || (-1 == buffer_get(buf, p->pixels,
+			width * height * sizeof(*(p->pixels)))) ) {
+		fb_destroy_picture(p);
+		return -1;
+	}
+
+	*pic = p;
+	return 0;
+}
+#endif
+
+/* Serialize config file data into buffer */
+int cfgdata_pack(struct cfgdata_t *cfgdata, kx_buffer *buf)
+{
+	int i, rc;
+	kx_cfg_section *sc;
+
+	rc = buffer_put_int(buf, cfgdata->timeout);
+	rc |= buffer_put_int(buf, cfgdata->ui);
+	rc |= buffer_put_int(buf, cfgdata->debug);
+	rc |= buffer_put_int(buf, cfgdata->count);
+
+	for (i = 0; i < cfgdata->count; i++) {
+		sc = cfgdata->list[i];
+		rc |= buffer_put_str(buf, sc->label);
+		rc |= buffer_put_str(buf, sc->dtbpath);
+		rc |= buffer_put_str(buf, sc->kernelpath);
+		rc |= buffer_put_str(buf, sc->cmdline_append);
+		rc |= buffer_put_str(buf, sc->cmdline);
+		rc |= buffer_put_str(buf, sc->initrd);
+		rc |= buffer_put_str(buf, sc->checksum);
+		rc |= buffer_put_str(buf, sc->initrd_checksum);
+		rc |= buffer_put_str(buf, sc->kernel_info);
+		rc |= buffer_put_str(buf, sc->fitconf);
+		rc |= buffer_put_str(buf, sc->iconpath);
+		rc |= buffer_put_int(buf, sc->is_default);
+		rc |= buffer_put_int(buf, sc->priority);
+#ifdef USE_ICONS
+		rc |= pack_icon(sc->icondata, buf);
+#endif
+	}
+
+	return (rc ? -1 : 0);
+}
+
+/* Deserialize config file data from buffer */
+int cfgdata_unpack(struct cfgdata_t *cfgdata, kx_buffer *buf)
+{
+	int i, count, ui, rc;
+	kx_cfg_section *sc;
+
+	init_cfgdata(cfgdata);
+
+	rc = buffer_get_int(buf, &cfgdata->timeout);
+	rc |= buffer_get_int(buf, &ui);
+	rc |= buffer_get_int(buf, &cfgdata->debug);
+	rc |= buffer_get_int(buf, &count);
+	if (rc) return -1;
+
+	cfgdata->ui = (TEXTUI == ui ? TEXTUI : GUI);
+
+	for (i = 0; i < count; i++) {
+		sc = cfg_section_new(cfgdata);
+		if (!sc) return -1;
+
+		rc |= buffer_get_str(buf, &sc->label);
+		rc |= buffer_get_str(buf, &sc->dtbpath);
+		rc |= buffer_get_str(buf, &sc->kernelpath);
+		rc |= buffer_get_str(buf, &sc->cmdline_append);
+		rc |= buffer_get_str(buf, &sc->cmdline);
+		rc |= buffer_get_str(buf, &sc->initrd);
+		rc |= buffer_get_str(buf, &sc->checksum);
+		rc |= buffer_get_str(buf, &sc->initrd_checksum);
+		rc |= buffer_get_str(buf, &sc->kernel_info);
+		rc |= buffer_get_str(buf, &sc->fitconf);
+		rc |= buffer_get_str(buf, &sc->iconpath);
+		rc |= buffer_get_int(buf, &sc->is_default);
+		rc |= buffer_get_int(buf, &sc->priority);
+#ifdef USE_ICONS
+		rc |= unpack_icon((kx_picture **)&sc->icondata, buf);
+#endif
+		if (rc) return -1;
+	}
+
+	return 0;
+}
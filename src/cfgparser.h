@@ -23,7 +23,11 @@
 #include "util.h"
 
 #define MOUNTPOINT	"/mnt"
-#define BOOTCFG_PATH MOUNTPOINT "/boot/boot.cfg"
+#define BOOTCFG_FILE	"/boot/boot.cfg"
+#define BOOTCFG_PATH MOUNTPOINT BOOTCFG_FILE
+
+/* tmpfs holding private mountpoints of devices being probed */
+#define PROBE_MOUNTROOT	"/tmp/kexecboot"
 
 enum ui_type_t { GUI, TEXTUI };
 
@@ -34,6 +38,10 @@ typedef struct {
 	char *cmdline_append;	/* Appended kernel cmdline (logo.nologo debug) */
 	char *cmdline;		/* Kernel cmdline */
 	char *initrd;		/* Initial ramdisk file */
+	char *checksum;		/* SHA-256 of kernel (hex) */
+	char *initrd_checksum;	/* SHA-256 of initrd (hex) */
+	char *kernel_info;	/* Kernel image description (from header) */
+	char *fitconf;		/* FIT configuration to boot (NULL - not FIT) */
 	char *iconpath;		/* Custom partition icon path */
 	void *icondata;		/* Icon data */
 	int is_default;		/* Use section as default? */
@@ -56,6 +64,14 @@ struct cfgdata_t {
 	char *fbcon;		/* fbcon tag */
 	char *mtdparts;		/* MTD partitioning */
 	char *ttydev;		/* Console tty device name */
+	int waittime;		/* Seconds to watch for late devices (-1 - default) */
+	char *waitdev;		/* Expected device name (mmcblk0p1) */
+#ifdef USE_BOOTCACHE
+	char *cachepath;	/* Boot cache file or device */
+#endif
+#ifdef USE_TRACE
+	char *tracepath;	/* Boot trace file */
+#endif
 };
 
 /* Clean config file structure */
@@ -64,6 +80,9 @@ void init_cfgdata(struct cfgdata_t *cfgdata);
 /* Free config file sections */
 void destroy_cfgdata(struct cfgdata_t *cfgdata);
 
+/* Remove section 'no' and free its data */
+void cfgdata_del_section(struct cfgdata_t *cfgdata, unsigned int no);
+
 /* Set kernelpath only (may be used when no config file found) */
 int cfgdata_add_kernel(struct cfgdata_t *cfgdata, char *kernelpath);
 
@@ -73,4 +92,10 @@ int parse_cfgfile(char *cfgpath, struct cfgdata_t *cfgdata);
 
 int parse_cmdline(struct cfgdata_t *cfgdata);
 
+/* Serialize config file data (sections and globals) into buffer */
+int cfgdata_pack(struct cfgdata_t *cfgdata, kx_buffer *buf);
+
+/* Deserialize config file data from buffer. Will init cfgdata itself */
+int cfgdata_unpack(struct cfgdata_t *cfgdata, kx_buffer *buf);
+
 #endif /* _HAVE_CONFIGPARSER_H */
@@ -23,14 +23,25 @@
 #include <sys/sysmacros.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <unistd.h>
 #include <errno.h>
+#include <ctype.h>
+#include <sys/mount.h>
 
 #include "fstype/fstype.h"
 #include "util.h"
 #include "devicescan.h"
+#include "trace.h"
+#include "kernimg.h"
+#include "fit.h"
+#include "dtbindex.h"
 #include "config.h"
 
+#ifdef USE_ICONS
+#include "xpm.h"
+#endif
+
 
 /* Create charlist of known filesystems */
 struct charlist *scan_filesystems()
@@ -138,8 +149,13 @@ int addto_bootcfg(struct bootconf_t *bc, struct device_t *dev,
 		bi->cmdline_append = sc->cmdline_append;
 		bi->cmdline = sc->cmdline;
 		bi->initrd = sc->initrd;
+		bi->checksum = sc->checksum;
+		bi->initrd_checksum = sc->initrd_checksum;
+		bi->kernel_info = sc->kernel_info;
+		bi->fitconf = sc->fitconf;
 		bi->icondata = sc->icondata;
 		bi->priority = sc->priority;
+		bi->order = dev->order;
 		if (sc->is_default) bc->default_item = bi;
 
 		bc->list[bc->fill] = bi;
@@ -179,6 +195,10 @@ void free_bootcfg(struct bootconf_t *bc)
 		free(bc->list[i]->kernelpath);
 		dispose(bc->list[i]->cmdline);
 		dispose(bc->list[i]->initrd);
+		dispose(bc->list[i]->checksum);
+		dispose(bc->list[i]->initrd_checksum);
+		dispose(bc->list[i]->kernel_info);
+		dispose(bc->list[i]->fitconf);
 		dispose(bc->list[i]->label);
 		free(bc->list[i]);
 	}
@@ -205,6 +225,10 @@ void print_bootcfg(struct bootconf_t *bc)
 		log_msg(lg, " [%d] kernelpath: '%s'", i, bc->list[i]->kernelpath);
 		log_msg(lg, " [%d] cmdline: '%s'", i, bc->list[i]->cmdline);
 		log_msg(lg, " [%d] initrd: '%s'", i, bc->list[i]->initrd);
+		log_msg(lg, " [%d] checksum: '%s'", i, bc->list[i]->checksum);
+		log_msg(lg, " [%d] initrd_checksum: '%s'", i, bc->list[i]->initrd_checksum);
+		log_msg(lg, " [%d] kernel_info: '%s'", i, bc->list[i]->kernel_info);
+		log_msg(lg, " [%d] fitconf: '%s'", i, bc->list[i]->fitconf);
 		log_msg(lg, " [%d] icondata: '%p'", i, bc->list[i]->icondata);
 		log_msg(lg, " [%d] priority: '%d'", i, bc->list[i]->priority);
 	}
@@ -212,26 +236,52 @@ void print_bootcfg(struct bootconf_t *bc)
 #endif
 
 
-/* Detect FS type on device and returt pointer to static structure from fstype.c */
-const char *detect_fstype(char *device, struct charlist *fl)
+/* Read superblock of device and fill probe result */
+int probe_fstype(char *device, struct fs_probe_result *res)
 {
-	int fd;
-	const char *fstype;
+	int fd, rc, tr;
+#ifdef DEBUG
+	struct fs_probe_stats stats;
+#endif
 
 	fd = open(device, O_RDONLY);
 	if (fd < 0) {
 		log_msg(lg, "+ can't open device: %s", ERRMSG);
-		return NULL;
+		memset(res, 0, sizeof(*res));
+		return -1;
 	}
 
-	if ( 0 != identify_fs(fd, &fstype, NULL, 0) ) {
-		close(fd);
+	tr = trace_begin("identify_fs", device);
+	rc = identify_fs_result(fd, 0, res);
+	trace_end(tr);
+	close(fd);
+
+#ifdef DEBUG
+	/* Scan workers probe one device each so totals are per device */
+	fstype_get_stats(&stats);
+	log_msg(lg, "+ FS probe I/O: %u read(s), %llu bytes (block-by-block: %u read(s), %llu bytes)",
+			stats.reads, stats.bytes, stats.legacy_reads, stats.legacy_bytes);
+	log_msg(lg, "+ FS probe: %u magic lookup(s), %u probe(s)",
+			stats.lookups, stats.probes);
+#endif
+
+	return rc;
+}
+
+
+/* Check that detected FS is supported by kernel */
+const char *check_fstype(const struct fs_probe_result *res, struct charlist *fl)
+{
+	const char *fstype = res->fstype;
+
+	if (NULL == fstype) {
 		log_msg(lg, "+ can't identify FS type");
 		return NULL;
 	}
-	close(fd);
 
 	log_msg(lg, "+ FS type '%s' detected", fstype);
+	if (res->label[0])
+		log_msg(lg, "+ FS label '%s'", res->label);
 
 	/* Check that FS is known */
 	if (in_charlist(fl, fstype) < 0) {
@@ -249,35 +299,195 @@ const char *detect_fstype(char *device, struct charlist *fl)
 }
 
 
+/* Detect FS type on device and returt pointer to static structure from fstype.c */
+const char *detect_fstype(char *device, struct charlist *fl,
+		struct fs_fingerprint *fp)
+{
+	struct fs_probe_result res;
+
+	probe_fstype(device, &res);
+	if (fp)
+		*fp = res.fp;
+
+	return check_fstype(&res, fl);
+}
+
+
+/* Translate path prefixed by MOUNTPOINT into path on 'mountpoint' */
+char *probe_path(char *buf, size_t size, const char *mountpoint,
+		const char *path)
+{
+	if (!strncmp(path, MOUNTPOINT, sizeof(MOUNTPOINT) - 1))
+		path += sizeof(MOUNTPOINT) - 1;
+
+	snprintf(buf, size, "%s%s", mountpoint, path);
+	return buf;
+}
+
+
+/* Read kernel header. Return image description or NULL if it is broken */
+static char *inspect_kernel(const char *mountpoint, const char *kernelpath,
+		enum kernimg_type_t *type)
+{
+	struct kernimg_t ki;
+	char path[PATH_MAX];
+	char desc[128];
+	int tr;
+
+	probe_path(path, sizeof(path), mountpoint, kernelpath);
+	tr = trace_begin("inspect_kernel", kernelpath);
+	if (-1 == kernimg_inspect(path, &ki)) {
+		trace_end(tr);
+		return NULL;
+	}
+	trace_end(tr);
+
+	*type = ki.type;
+	kernimg_describe(&ki, desc, sizeof(desc));
+	log_msg(lg, "+ kernel %s: %s", kernelpath, desc);
+	return strdup(desc);
+}
+
+
+static char *dup_str(const char *s)
+{
+	return (s ? strdup(s) : NULL);
+}
+
+
+/*
+ * Replace section 'no' having FIT kernel with one section per FIT
+ * configuration. Only FIT structure is read, not sub-images data.
+ * Return count of added sections or -1 on error.
+ */
+static int expand_fit(struct cfgdata_t *cfgdata, unsigned int no,
+		const char *mountpoint)
+{
+	kx_cfg_section *sc, *nsc;
+	kx_fit fit;
+	kx_fit_conf *conf;
+	kx_fit_image *kernel, *ramdisk;
+	char path[PATH_MAX];
+	char buf[160];
+	const char *base;
+	unsigned int i;
+	int n = 0;
+
+	sc = cfgdata->list[no];
+	probe_path(path, sizeof(path), mountpoint, sc->kernelpath);
+	if (-1 == fit_open(path, &fit)) return -1;
+
+	base = (sc->label ? sc->label : (fit.description[0] ? fit.description : NULL));
+
+	for (i = 0; i < fit.conf_count; i++) {
+		conf = fit.confs + i;
+		kernel = fit_find_image(&fit, conf->kernel);
+		if ( (!kernel) || (0 == kernel->size) ) {
+			log_msg(lg, "+ FIT configuration %s has no kernel", conf->name);
+			continue;
+		}
+
+		/* Section is added to end of list. 'sc' stays valid */
+		if (-1 == cfgdata_add_kernel(cfgdata, sc->kernelpath)) break;
+		nsc = cfgdata->current;
+
+		if (base)
+			snprintf(buf, sizeof(buf), "%s: %s", base,
+					(conf->description[0] ? conf->description : conf->name));
+		else
+			snprintf(buf, sizeof(buf), "%s",
+					(conf->description[0] ? conf->description : conf->name));
+		nsc->label = strdup(buf);
+
+		nsc->dtbpath = dup_str(sc->dtbpath);
+		nsc->cmdline_append = dup_str(sc->cmdline_append);
+		nsc->cmdline = dup_str(sc->cmdline);
+		nsc->initrd = dup_str(sc->initrd);
+		nsc->checksum = dup_str(sc->checksum);
+		nsc->initrd_checksum = dup_str(sc->initrd_checksum);
+		nsc->iconpath = dup_str(sc->iconpath);
+		nsc->priority = sc->priority;
+		nsc->is_default = ( sc->is_default &&
+				!strcmp(conf->name, fit.default_conf) );
+		nsc->fitconf = strdup(conf->name);
+
+		ramdisk = (conf->ramdisk[0] ? fit_find_image(&fit, conf->ramdisk) : NULL);
+		snprintf(buf, sizeof(buf), "FIT %s %lluKb%s%s%s%s",
+				conf->kernel, kernel->size >> 10,
+				(kernel->compression[0] ? " " : ""), kernel->compression,
+				(conf->fdt[0] ? " +fdt" : ""),
+				(ramdisk ? " +ramdisk" : ""));
+		nsc->kernel_info = strdup(buf);
+
+		log_msg(lg, "+ FIT configuration %s: %s", conf->name, buf);
+		++n;
+	}
+
+	fit_close(&fit);
+	cfgdata_del_section(cfgdata, no);
+	return n;
+}
+
+
 /* Check and parse config file */
-int get_bootinfo(struct cfgdata_t *cfgdata)
+int get_bootinfo(struct cfgdata_t *cfgdata, const char *mountpoint)
 {
+	kx_cfg_section *sc;
 	struct stat sinfo;
+	char path[PATH_MAX];
+	enum kernimg_type_t type;
+	unsigned int i;
 
 	/* Clean cfgdata structure */
 	init_cfgdata(cfgdata);
 
 	/* Parse config file */
-	if (0 == parse_cfgfile(BOOTCFG_PATH, cfgdata)) {	/* Found and parsed */
+	probe_path(path, sizeof(path), mountpoint, BOOTCFG_PATH);
+	if (0 == parse_cfgfile(path, cfgdata)) {	/* Found and parsed */
 		log_msg(lg, "+ config file found");
-		/* Check kernel presence
-		 * FIXME: we should stat every kernel or shouldn't stat at all
-		if (0 == stat(cfgdata->kernelpath, &sinfo)) return 0;
 
-		log_msg(lg, "+ config file points to non-existent kernel");
+		/* Drop items which kernel is missing or broken.
+		 * FIT items are added to end of list and aren't visited */
+		for (i = cfgdata->count; i > 0; i--) {
+			sc = cfgdata->list[i - 1];
+			if (sc->kernelpath)
+				sc->kernel_info = inspect_kernel(mountpoint,
+						sc->kernelpath, &type);
+			if ( (sc->kernel_info) && (KIMG_FIT == type) ) {
+				if (expand_fit(cfgdata, i - 1, mountpoint) >= 0) continue;
+				dispose(sc->kernel_info);
+				sc->kernel_info = NULL;
+			}
+			if (sc->kernel_info) continue;
+
+			log_msg(lg, "+ skipping item with bad kernel '%s'",
+					(sc->kernelpath ? sc->kernelpath : ""));
+			cfgdata_del_section(cfgdata, i - 1);
+		}
+		if (cfgdata->count > 0) return 0;
+
+		log_msg(lg, "+ config file points to no usable kernel");
 		return -1;
-		*/
-		return 0;
 
 	} else {	/* No config file found. Check kernels. */
 
 		/* Check default kernels */
 		char **kp;
+		char *info;
 		for (kp = default_kernels; NULL != *kp; kp++) {
-			if (0 == stat(*kp, &sinfo)) {
-				cfgdata_add_kernel(cfgdata, *kp);
+			probe_path(path, sizeof(path), mountpoint, *kp);
+			if (0 != stat(path, &sinfo)) continue;
+
+			info = inspect_kernel(mountpoint, *kp, &type);
+			if (info) {
+				if (-1 == cfgdata_add_kernel(cfgdata, *kp)) {
+					free(info);
+					return -1;
+				}
+				cfgdata->current->kernel_info = info;
 				log_msg(lg, "+ found default kernel '%s'", *kp);
-				return 0;
+				if (KIMG_FIT == type) expand_fit(cfgdata, 0, mountpoint);
+				return (cfgdata->count > 0 ? 0 : -1);
 			}
 		}
 	}
@@ -320,45 +530,51 @@ free_fl:
 	return NULL;
 }
 
-int devscan_next(FILE *fp, struct charlist *fslist, struct device_t *dev)
+/* Parse /proc/partitions line. Return pointer to device name or NULL */
+static char *devscan_parse(char *line, int *major, int *minor,
+		unsigned long long *blocks, int *len)
 {
-	int major, minor, len;
-	unsigned long long blocks;
 	char *tmp, *p;
-	char *device;
-	char line[80];
 
-	if (NULL == fgets(line, sizeof(line), fp)) {
-		return 0;
-	}
-
-	/* Get major, minor, blocks and device name */
-	len = 0;
-	major = get_nni(line, &p);
-	minor = get_nni(p, &p);
-	blocks = get_nnll(p, &p, &len);	/* len is used as temp variable */
+	*len = 0;
+	*major = get_nni(line, &p);
+	*minor = get_nni(p, &p);
+	*blocks = get_nnll(p, &p, len);	/* len is used as temp variable */
 	tmp = get_word(p, &p);
 
-	if (major < 0 || minor < 0 || NULL == tmp) {
+	if (*major < 0 || *minor < 0 || NULL == tmp) {
 		log_msg(lg, "Can't parse partition string: '%s'", line);
-		return -1;
+		return NULL;
 	}
 
 	/* FIXME: 200k is hardcoded below */
-	if ((0 == len) && (blocks < 200)) {
-		log_msg(lg, "+ device (%d, %d) is too small (%dk < 200k), skipped", major, minor, blocks);
-		return -1;
+	if ((0 == *len) && (*blocks < 200)) {
+		log_msg(lg, "+ device (%d, %d) is too small (%dk < 200k), skipped", *major, *minor, *blocks);
+		return NULL;
 	}
 
+	*len = p - tmp;
+	return tmp;
+}
+
+
+/* Fill device structure from parsed partition line */
+static int devscan_fill(struct device_t *dev, int major, int minor,
+		unsigned long long blocks, char *name, int len)
+{
+	char *device;
+	int tr;
+
 	/* Format device name */
-	len = p - tmp;
 	device = malloc(len + 5 + 1); /* 5 = strlen("/dev/") */
 	if (NULL == device) {
-		DPRINTF("Can't allocate memory for device name '%s'", tmp);
+		DPRINTF("Can't allocate memory for device name '%s'", name);
 		return -1;
 	}
 	strcpy(device, "/dev/");
-	strncat(device, tmp, len);
+	strncat(device, name, len);
+
+	tr = trace_begin("devscan_next", device);
 
 	log_msg(lg, "Found device '%s' (%d, %d) of size %lluMb",
 			device, major, minor, blocks>>10);
@@ -377,16 +593,253 @@ int devscan_next(FILE *fp, struct charlist *fslist, struct device_t *dev)
 	}
 #endif
 
-	dev->fstype = detect_fstype(device, fslist);
-	if (NULL == dev->fstype) {
-		free(device);
-		return -1;
-	}
-
 	dev->device = device;
+	dev->fstype = NULL;
+	dev->fp.valid = 0;
 	dev->blocks = blocks;
+	dev->major = major;
+	dev->minor = minor;
+	dev->order = 0;
 
+	trace_end(tr);
 	return 1;
 }
 
 
+int devscan_next(FILE *fp, struct device_t *dev)
+{
+	int major, minor, len;
+	unsigned long long blocks;
+	char *name;
+	char line[80];
+
+	if (NULL == fgets(line, sizeof(line), fp)) {
+		return 0;
+	}
+
+	/* Get major, minor, blocks and device name */
+	name = devscan_parse(line, &major, &minor, &blocks, &len);
+	if (NULL == name) return -1;
+
+	return devscan_fill(dev, major, minor, blocks, name, len);
+}
+
+
+int devscan_get(FILE *fp, const char *devname, struct device_t *dev)
+{
+	int major, minor, len;
+	unsigned long long blocks;
+	char *name;
+	char line[80];
+
+	while (NULL != fgets(line, sizeof(line), fp)) {
+		name = devscan_parse(line, &major, &minor, &blocks, &len);
+		if (NULL == name) continue;
+
+		if ( (strlen(devname) == len) && !strncmp(name, devname, len) )
+			return devscan_fill(dev, major, minor, blocks, name, len);
+	}
+
+	return 0;
+}
+
+
+struct charlist *devscan_snapshot(void)
+{
+	FILE *f;
+	struct charlist *cl;
+	char line[80];
+
+	f = fopen("/proc/partitions", "r");
+	if (NULL == f) {
+		log_msg(lg, "Can't open /proc/partitions: %s", ERRMSG);
+		return NULL;
+	}
+
+	cl = create_charlist(16);
+	if (NULL == cl) {
+		fclose(f);
+		return NULL;
+	}
+
+	// First two lines are bogus.
+	fgets(line, sizeof(line), f);
+	fgets(line, sizeof(line), f);
+
+	while (NULL != fgets(line, sizeof(line), f))
+		addto_charlist(cl, line);
+
+	fclose(f);
+	return cl;
+}
+
+
+int devscan_split(const char *line, int *major, int *minor,
+		char *name, size_t size)
+{
+	char buf[80];
+	char *p, *tmp;
+	int len;
+
+	strncpy(buf, line, sizeof(buf) - 1);
+	buf[sizeof(buf) - 1] = '\0';
+
+	*major = get_nni(buf, &p);
+	*minor = get_nni(p, &p);
+	get_nnll(p, &p, &len);
+	tmp = get_word(p, &p);
+
+	if (*major < 0 || *minor < 0 || NULL == tmp) return -1;
+
+	len = p - tmp;
+	if (len >= size) return -1;
+
+	strncpy(name, tmp, len);
+	name[len] = '\0';
+	return 0;
+}
+
+
+#ifdef USE_ICONS
+/* Load custom icons of config sections */
+static void load_icons(struct cfgdata_t *cfgdata, const char *mountpoint)
+{
+	kx_cfg_section *sc;
+	int i;
+	int rows;
+	char **xpm_data;
+	char path[PATH_MAX];
+
+	/* Iterate over sections found */
+	for (i = 0; i < cfgdata->count; i++) {
+		sc = cfgdata->list[i];
+		if (!sc) continue;
+
+		/* Load custom icon */
+		if (sc->iconpath) {
+			probe_path(path, sizeof(path), mountpoint, sc->iconpath);
+			rows = xpm_load_image(&xpm_data, path);
+			if (-1 == rows) {
+				log_msg(lg, "+ can't load xpm icon %s", sc->iconpath);
+				continue;
+			}
+
+			sc->icondata = xpm_parse_image(xpm_data, rows);
+			if (!sc->icondata) {
+				log_msg(lg, "+ can't parse xpm icon %s", sc->iconpath);
+				continue;
+			}
+			xpm_destroy_image(xpm_data, rows);
+		}
+	}
+}
+#endif
+
+
+/* Set DTB matching running board for sections without DTB */
+static void select_dtb(struct device_t *dev, struct cfgdata_t *cfgdata,
+		const char *mountpoint)
+{
+	kx_dtbindex *idx;
+	const char *dtb = NULL;
+	unsigned int i;
+	int tr;
+
+	/* No device tree - nothing to match */
+	if (!dtbindex_board_known()) return;
+
+	for (i = 0; i < cfgdata->count; i++) {
+		if ( (!cfgdata->list[i]->dtbpath) && (!cfgdata->list[i]->fitconf) )
+			break;
+	}
+	if (i == cfgdata->count) return;
+
+	tr = trace_begin("dtbindex", dev->device);
+	idx = dtbindex_update(makedev(dev->major, dev->minor), mountpoint);
+	if (idx) dtb = dtbindex_match(idx);
+	trace_end(tr);
+
+	if (!dtb) return;
+	log_msg(lg, "+ found DTB %s matching board", dtb);
+
+	for (; i < cfgdata->count; i++) {
+		if ( (!cfgdata->list[i]->dtbpath) && (!cfgdata->list[i]->fitconf) )
+			cfgdata->list[i]->dtbpath = strdup(dtb);
+	}
+}
+
+
+/* Mount device, read boot config and umount device */
+int devscan_probe(struct device_t *dev, const char *mountpoint,
+		struct cfgdata_t *cfgdata, int with_icons, int keep_mounted)
+{
+	int rc, n, tr;
+	char mount_dev[64];
+	char mount_fstype[16];
+	char str_mtd_id[3];
+
+	/* initialize with defaults */
+	strcpy(mount_dev, dev->device);
+	strcpy(mount_fstype, dev->fstype);
+
+	/* We found an ubi erase counter */
+	if (!strncmp(dev->fstype, "ubi",3)) {
+
+		/* attach ubi boot device - mtd id [0-15] */
+		snprintf(str_mtd_id, sizeof(str_mtd_id), "%d", ubi_mtd_num(dev->device));
+		n = ubi_attach(str_mtd_id);
+
+		/* we have attached ubiX and we mount /dev/ubiX_0 or named volume */
+		ubi_volume_dev(mount_dev, sizeof(mount_dev), n);
+
+		/* HARDCODED: we assume it's ubifs */
+		strcpy(mount_fstype, "ubifs");
+	}
+
+	/* Prepare private mountpoint */
+	if ( (-1 == mkdir(mountpoint, 0700)) && (EEXIST != errno) ) {
+		log_msg(lg, "+ can't create %s: %s", mountpoint, ERRMSG);
+		return -1;
+	}
+
+	/* Mount device */
+	tr = trace_begin("mount", mount_dev);
+	if (-1 == mount(mount_dev, mountpoint, mount_fstype, MS_RDONLY, NULL)) {
+		log_msg(lg, "+ can't mount device %s: %s", mount_dev, ERRMSG);
+		trace_end(tr);
+		rmdir(mountpoint);
+		return -1;
+	}
+	trace_end(tr);
+
+	/* NOTE: Don't go out before umount'ing */
+
+	/* Search boot method and return boot info */
+	tr = trace_begin("parse_cfgfile", mount_dev);
+	rc = get_bootinfo(cfgdata, mountpoint);
+	trace_end(tr);
+	if (-1 == rc) rc = 1;	/* Device is fine but has nothing to boot */
+
+	if (0 == rc) select_dtb(dev, cfgdata, mountpoint);
+
+#ifdef USE_ICONS
+	if ( (0 == rc) && with_icons) load_icons(cfgdata, mountpoint);
+#endif
+
+	/* Caller will boot from this mount */
+	if ( (0 == rc) && keep_mounted ) return 0;
+
+	/* Umount device */
+	tr = trace_begin("umount", mount_dev);
+	if (-1 == umount(mountpoint)) {
+		log_msg(lg, "+ can't umount device: %s", ERRMSG);
+		rc = -1;
+	}
+	trace_end(tr);
+	rmdir(mountpoint);
+
+	if (0 != rc) destroy_cfgdata(cfgdata);
+	return rc;
+}
+
+
@@ -21,12 +21,16 @@
 #include "config.h"
 #include "util.h"
 #include "cfgparser.h"
+#include "fstype/fstype.h"
 
 /* Device structure */
 struct device_t {
 	char *device;		/* Device path (/dev/mmcblk0p1) */
 	const char *fstype;	/* Filesystem (ext2) */
 	unsigned long long blocks;	/* Device size in 1K blocks */
+	int major, minor;	/* Device numbers */
+	struct fs_fingerprint fp;	/* Superblock fingerprint */
+	int order;			/* Device order for menu sorting */
 };
 
 enum dtype_t {
@@ -47,8 +51,13 @@ struct boot_item_t {
 	char *cmdline_append;	/* Appended kernel cmdline (logo.nologo debug) */
 	char *cmdline;		/* Kernel cmdline */
 	char *initrd;		/* Initial ramdisk file */
+	char *checksum;		/* SHA-256 of kernel (NULL - don't check) */
+	char *initrd_checksum;	/* SHA-256 of initrd (NULL - don't check) */
+	char *kernel_info;	/* Kernel image description (NULL - unknown) */
+	char *fitconf;		/* FIT configuration (NULL - kernelpath is not FIT) */
 	void *icondata;		/* Icon data */
 	int priority;		/* Priority of item in menu */
+	int order;			/* Device order in partitions list */
 	enum dtype_t dtype;	/* Device type */
 };
 
@@ -70,8 +79,54 @@ extern char *default_kernels[];
 /* Prepare devicescan loop */
 FILE *devscan_open(struct charlist **fslist);
 
-/* Get next device (fp & fslist in, dev out) */
-int devscan_next(FILE *fp, struct charlist *fslist, struct device_t *dev);
+/* Get next device (fp in, dev out). FS type is not detected here */
+int devscan_next(FILE *fp, struct device_t *dev);
+
+/* Read /proc/partitions lines (without header) to detect changes */
+struct charlist *devscan_snapshot(void);
+
+/* Get device numbers and kernel name from /proc/partitions line */
+int devscan_split(const char *line, int *major, int *minor,
+		char *name, size_t size);
+
+/* Find device by kernel name (fp in, dev out). Return 1 if found, 0 if not */
+int devscan_get(FILE *fp, const char *devname, struct device_t *dev);
+
+/*
+ * Function: probe_fstype()
+ * Read superblock of device and fill probe result.
+ * Return value:
+ * - 0 when FS type is detected
+ * - 1 when FS type is unknown
+ * - -1 on I/O error (result should not be cached)
+ */
+int probe_fstype(char *device, struct fs_probe_result *res);
+
+/* Return FS name from probe result if it is supported by kernel or NULL */
+const char *check_fstype(const struct fs_probe_result *res, struct charlist *fl);
+
+/* Detect FS type on device and return pointer to static name from fstype.c.
+ * Superblock fingerprint is stored into 'fp' (may be NULL) */
+const char *detect_fstype(char *device, struct charlist *fl,
+		struct fs_fingerprint *fp);
+
+/*
+ * Function: devscan_probe()
+ * Mount device on private mountpoint, read boot config (and icons
+ * if 'with_icons' is set) and umount device.
+ * Args:
+ * - device to probe (dev->fstype is detected by detect_fstype())
+ * - mountpoint to use
+ * - config data structure to fill
+ * - load custom icons flag
+ * - keep device mounted if boot config is found
+ * Return value:
+ * - 0 on success (cfgdata should be destroyed with destroy_cfgdata())
+ * - 1 if device was mounted but has nothing to boot
+ * - -1 on error
+ */
+int devscan_probe(struct device_t *dev, const char *mountpoint,
+		struct cfgdata_t *cfgdata, int with_icons, int keep_mounted);
 
 /* Allocate bootconf structure */
 struct bootconf_t *create_bootcfg(unsigned int size);
@@ -83,8 +138,12 @@ void free_bootcfg(struct bootconf_t *bc);
 int addto_bootcfg(struct bootconf_t *bc, struct device_t *dev,
 		struct cfgdata_t *cfgdata);
 
-/* Check and parse config file */
-int get_bootinfo(struct cfgdata_t *cfgdata);
+/* Translate path prefixed by MOUNTPOINT into path on 'mountpoint' */
+char *probe_path(char *buf, size_t size, const char *mountpoint,
+		const char *path);
+
+/* Check and parse config file of device mounted on 'mountpoint' */
+int get_bootinfo(struct cfgdata_t *cfgdata, const char *mountpoint);
 
 #ifdef DEBUG
 /* Print bootconf structure */
@@ -0,0 +1,425 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *
+ *  Copyright (c) 2008-2011 Yuri Bushmelev <jay4mail@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "util.h"
+#include "devicescan.h"
+#include "dtbindex.h"
+
+/* Flattened device tree header (BE) */
+#define FDT_MAGIC			0xD00DFEED
+#define FDT_HDR_SIZE		40
+#define FDT_BEGIN_NODE		1
+#define FDT_PROP			3
+#define FDT_NOP				4
+
+/* Bytes of DTB read to find root compatible */
+#define DTB_HDR_READ		4096
+
+static kx_dtbindex **dtb_cache;
+static unsigned int dtb_cache_size, dtb_cache_count;
+
+/* Board compatible list (-1 - not read yet) */
+static char board_compat[DTB_COMPAT_MAX];
+static int board_compat_len = -1;
+
+
+static unsigned long get_be32(const unsigned char *p)
+{
+	return ((unsigned long)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+
+static void dtbindex_free(kx_dtbindex *idx)
+{
+	unsigned int i;
+
+	if (!idx) return;
+
+	for (i = 0; i < idx->count; i++)
+		free(idx->list[i].path);
+	dispose(idx->list);
+	free(idx);
+}
+
+
+static kx_dtbindex *dtbindex_new(dev_t dev)
+{
+	kx_dtbindex *idx;
+
+	idx = malloc(sizeof(*idx));
+	if (NULL == idx) {
+		DPRINTF("Can't allocate DTB index");
+		return NULL;
+	}
+
+	idx->dev = dev;
+	idx->size = 8;
+	idx->count = 0;
+	idx->list = malloc(idx->size * sizeof(*(idx->list)));
+	if (NULL == idx->list) {
+		DPRINTF("Can't allocate DTB index entries");
+		free(idx);
+		return NULL;
+	}
+
+	return idx;
+}
+
+
+static struct dtb_entry *dtbindex_add(kx_dtbindex *idx)
+{
+	struct dtb_entry *new_list;
+
+	if (idx->count >= idx->size) {
+		new_list = realloc(idx->list, idx->size * 2 * sizeof(*new_list));
+		if (NULL == new_list) {
+			DPRINTF("Can't resize DTB index");
+			return NULL;
+		}
+		idx->size *= 2;
+		idx->list = new_list;
+	}
+
+	return idx->list + idx->count++;
+}
+
+
+/* Store index in cache replacing old one of same device */
+static void dtbindex_store(kx_dtbindex *idx)
+{
+	kx_dtbindex **new_cache;
+	unsigned int i;
+
+	for (i = 0; i < dtb_cache_count; i++) {
+		if (dtb_cache[i]->dev == idx->dev) {
+			dtbindex_free(dtb_cache[i]);
+			dtb_cache[i] = idx;
+			return;
+		}
+	}
+
+	if (dtb_cache_count >= dtb_cache_size) {
+		unsigned int new_size = dtb_cache_size ? dtb_cache_size * 2 : 4;
+
+		new_cache = realloc(dtb_cache, new_size * sizeof(*dtb_cache));
+		if (!new_cache) {
+			dtbindex_free(idx);	/* It is just cache */
+			return;
+		}
+		dtb_cache = new_cache;
+		dtb_cache_size = new_size;
+	}
+	dtb_cache[dtb_cache_count++] = idx;
+}
+
+
+kx_dtbindex *dtbindex_get(dev_t dev)
+{
+	unsigned int i;
+
+	for (i = 0; i < dtb_cache_count; i++) {
+		if (dtb_cache[i]->dev == dev) return dtb_cache[i];
+	}
+	return NULL;
+}
+
+
+void dtbindex_invalidate(dev_t dev)
+{
+	unsigned int i;
+
+	for (i = 0; i < dtb_cache_count; i++) {
+		if (dtb_cache[i]->dev == dev) {
+			dtbindex_free(dtb_cache[i]);
+			dtb_cache[i] = dtb_cache[--dtb_cache_count];
+			return;
+		}
+	}
+}
+
+
+/*
+ * Read root compatible property of DTB. Root properties go first in
+ * structure block, strings are usually at the end of file.
+ * Return property length or -1 on error.
+ */
+static int read_compat(const char *path, char *compat)
+{
+	static const char name_compat[] = "compatible";
+	unsigned char buf[DTB_HDR_READ];
+	char name[sizeof(name_compat)];
+	unsigned long long strings, nameoff;
+	unsigned long tag;
+	size_t p, size, len;
+	ssize_t n;
+	int fd, rc = -1;
+
+	fd = open(path, O_RDONLY);
+	if (-1 == fd) return -1;
+
+	n = read(fd, buf, sizeof(buf));
+	if ( (n < FDT_HDR_SIZE) || (FDT_MAGIC != get_be32(buf)) )
+		goto close;
+	size = n;
+
+	/* Offsets are untrusted: compare with what is left, never add */
+	p = get_be32(buf + 8);
+	strings = get_be32(buf + 12);
+
+	/* Skip root node name */
+	if ( (p > size - 8) || (FDT_BEGIN_NODE != get_be32(buf + p)) )
+		goto close;
+	p += 4;
+	while ( (p < size) && buf[p] ) ++p;
+	p = (p + 4) & ~(size_t)3;
+
+	while ( (p < size) && (size - p >= 12) ) {
+		tag = get_be32(buf + p);
+		if (FDT_NOP == tag) {
+			p += 4;
+			continue;
+		}
+		if (FDT_PROP != tag) break;		/* Subnodes start */
+
+		len = get_be32(buf + p + 4);
+		nameoff = get_be32(buf + p + 8);
+		p += 12;
+
+		if ( (sizeof(name) == pread(fd, name, sizeof(name), strings + nameoff)) &&
+				!memcmp(name, name_compat, sizeof(name_compat)) )
+		{
+			if (len > DTB_COMPAT_MAX) len = DTB_COMPAT_MAX;
+			if (len > size - p) break;
+			memcpy(compat, buf + p, len);
+			rc = len;
+			break;
+		}
+		if (len > size - p) break;
+		p = (p + len + 3) & ~(size_t)3;
+	}
+
+close:
+	close(fd);
+	return rc;
+}
+
+
+/* Index one directory. Subdirectories are scanned if depth > 0 */
+static void dtbindex_scan_dir(kx_dtbindex *idx, kx_dtbindex *old,
+		const char *mountpoint, const char *dir, int depth)
+{
+	DIR *d;
+	struct dirent *de;
+	struct stat st;
+	struct dtb_entry *e;
+	char path[PATH_MAX], rpath[PATH_MAX];
+	size_t len;
+	unsigned int i;
+
+	probe_path(rpath, sizeof(rpath), mountpoint, dir);
+	d = opendir(rpath);
+	if (NULL == d) return;
+
+	while ( (de = readdir(d)) ) {
+		if ('.' == de->d_name[0]) continue;
+
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		probe_path(rpath, sizeof(rpath), mountpoint, path);
+		if (-1 == stat(rpath, &st)) continue;
+
+		if (S_ISDIR(st.st_mode)) {
+			if (depth > 0)
+				dtbindex_scan_dir(idx, old, mountpoint, path, depth - 1);
+			continue;
+		}
+
+		len = strlen(de->d_name);
+		if ( (len < 5) || strcmp(de->d_name + len - 4, ".dtb") ) continue;
+
+		e = dtbindex_add(idx);
+		if (!e) break;
+
+		/* Take unchanged DTB from previous index */
+		if (old) {
+			for (i = 0; i < old->count; i++) {
+				if ( !strcmp(old->list[i].path, path) &&
+						(old->list[i].mtime == st.st_mtime) &&
+						(old->list[i].size == st.st_size) )
+					break;
+			}
+			if (i < old->count) {
+				*e = old->list[i];
+				e->path = strdup(path);
+				continue;
+			}
+		}
+
+		e->path = strdup(path);
+		e->mtime = st.st_mtime;
+		e->size = st.st_size;
+		e->compat_len = read_compat(rpath, e->compat);
+		if (e->compat_len < 0) e->compat_len = 0;
+	}
+
+	closedir(d);
+}
+
+
+kx_dtbindex *dtbindex_update(dev_t dev, const char *mountpoint)
+{
+	kx_dtbindex *idx;
+
+	idx = dtbindex_new(dev);
+	if (!idx) return NULL;
+
+	dtbindex_scan_dir(idx, dtbindex_get(dev), mountpoint, DTB_DIR, 1);
+	dtbindex_store(idx);
+
+	return dtbindex_get(dev);
+}
+
+
+/* Read board compatible once */
+int dtbindex_board_known(void)
+{
+	int fd;
+
+	if (board_compat_len < 0) {
+		board_compat_len = 0;
+		fd = open(DTB_BOARD_COMPAT, O_RDONLY);
+		if (-1 != fd) {
+			board_compat_len = read(fd, board_compat, sizeof(board_compat));
+			if (board_compat_len < 0) board_compat_len = 0;
+			/* Drop cut off last string */
+			while ( (board_compat_len > 0) &&
+					board_compat[board_compat_len - 1] )
+				--board_compat_len;
+			close(fd);
+		}
+	}
+
+	return (board_compat_len > 0);
+}
+
+
+/*
+ * Return 1 if NUL separated list contains string. Entry cut by 'len'
+ * (e.g. by DTB_COMPAT_MAX) is not NUL terminated and never matches.
+ */
+static int compat_has(const char *list, int len, const char *str)
+{
+	int i = 0, n;
+
+	while (i < len) {
+		n = strnlen(list + i, len - i);
+		if (n == len - i) break;
+		if (!strcmp(list + i, str)) return 1;
+		i += n + 1;
+	}
+	return 0;
+}
+
+
+const char *dtbindex_match(kx_dtbindex *idx)
+{
+	const char *best = NULL;
+	int i, rank, best_rank = INT_MAX;
+	unsigned int j;
+
+	if ( (!idx) || !dtbindex_board_known() ) return NULL;
+
+	for (j = 0; j < idx->count; j++) {
+		/* Rank is position of string in board list */
+		for (i = 0, rank = 0; i < board_compat_len; rank++) {
+			if (compat_has(idx->list[j].compat, idx->list[j].compat_len,
+					board_compat + i))
+				break;
+			i += strnlen(board_compat + i, board_compat_len - i) + 1;
+		}
+		if (i >= board_compat_len) continue;
+
+		if ( (rank < best_rank) ||
+				((rank == best_rank) && (strcmp(idx->list[j].path, best) < 0)) )
+		{
+			best = idx->list[j].path;
+			best_rank = rank;
+		}
+	}
+
+	return best;
+}
+
+
+int dtbindex_pack(kx_dtbindex *idx, kx_buffer *buf)
+{
+	unsigned int i;
+	int rc;
+
+	rc = buffer_put_int(buf, idx->count);
+	for (i = 0; i < idx->count; i++) {
+		rc |= buffer_put_str(buf, idx->list[i].path);
+		rc |= buffer_put(buf, &idx->list[i].mtime, sizeof(idx->list[i].mtime));
+		rc |= buffer_put(buf, &idx->list[i].size, sizeof(idx->list[i].size));
+		rc |= buffer_put_int(buf, idx->list[i].compat_len);
+		rc |= buffer_put(buf, idx->list[i].compat, idx->list[i].compat_len);
+	}
+
+	return rc;
+}
+
+
+int dtbindex_unpack(dev_t dev, kx_buffer *buf)
+{
+	kx_dtbindex *idx;
+	struct dtb_entry *e;
+	int i, count;
+
+	if (-1 == buffer_get_int(buf, &count)) return -1;
+
+	idx = dtbindex_new(dev);
+	if (!idx) return -1;
+
+	for (i = 0; i < count; i++) {
+		e = dtbindex_add(idx);
+		if (!e) goto broken;
+		e->path = NULL;
+		if ( (-1 == buffer_get_str(buf, &e->path)) ||
+				(-1 == buffer_get(buf, &e->mtime, sizeof(e->mtime))) ||
+				(-1 == buffer_get(buf, &e->size, sizeof(e->size))) ||
+				(-1 == buffer_get_int(buf, &e->compat_len)) ||
+				(e->compat_len < 0) || (e->compat_len > DTB_COMPAT_MAX) ||
+				(-1 == buffer_get(buf, e->compat, e->compat_len)) )
+			goto broken;
+	}
+
+	dtbindex_store(idx);
+	return 0;
+
+broken:
+	dtbindex_free(idx);
+	return -1;
+}
@@ -0,0 +1,82 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *
+ *  Copyright (c) 2008-2011 Yuri Bushmelev <jay4mail@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+#ifndef _HAVE_DTBINDEX_H_
+#define _HAVE_DTBINDEX_H_
+
+#include <sys/types.h>
+
+#include "config.h"
+#include "util.h"
+#include "cfgparser.h"
+
+/* Directory with DTBs on boot device (subdirectories are scanned too) */
+#define DTB_DIR		MOUNTPOINT "/boot/dtbs"
+
+/* Compatible list of running board */
+#define DTB_BOARD_COMPAT	"/proc/device-tree/compatible"
+
+/* Max length of root compatible property we keep */
+#define DTB_COMPAT_MAX	256
+
+/* One DTB on device */
+struct dtb_entry {
+	char *path;				/* DTB path prefixed by MOUNTPOINT */
+	time_t mtime;			/* File time and size to notice changes */
+	off_t size;
+	int compat_len;			/* Length of compat */
+	char compat[DTB_COMPAT_MAX];	/* Root compatible (NUL separated list) */
+};
+
+/*
+ * Root compatible strings of all DTBs in DTB_DIR of one device.
+ * Only FDT header and root properties are read from each DTB. Indexes
+ * are kept in memory by device number; DTBs with unchanged time and
+ * size are not read again on rescan. Scan workers send updated index
+ * to parent with dtbindex_pack().
+ */
+typedef struct {
+	dev_t dev;				/* Device number */
+	unsigned int size;		/* Allocated entries count */
+	unsigned int count;		/* Filled entries count */
+	struct dtb_entry *list;	/* Entries array */
+} kx_dtbindex;
+
+/* Get cached index of device. Return NULL if none */
+kx_dtbindex *dtbindex_get(dev_t dev);
+
+/* Scan DTB_DIR of device mounted on mountpoint and update cached index */
+kx_dtbindex *dtbindex_update(dev_t dev, const char *mountpoint);
+
+/* Drop cached index of device */
+void dtbindex_invalidate(dev_t dev);
+
+/*
+ * Find DTB matching running board best (most specific board compatible
+ * string first). Return DTB path prefixed by MOUNTPOINT or NULL
+ */
+const char *dtbindex_match(kx_dtbindex *idx);
+
+/* Return 1 if running board is described by device tree */
+int dtbindex_board_known(void);
+
+/* Serialize index into buffer */
+int dtbindex_pack(kx_dtbindex *idx, kx_buffer *buf);
+
+/* Deserialize index of device from buffer into cache */
+int dtbindex_unpack(dev_t dev, kx_buffer *buf);
+
+#endif //_HAVE_DTBINDEX_H_
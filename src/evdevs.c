@@ -133,6 +133,9 @@ int inputs_init(kx_inputs *inputs, unsigned int size)
 	inputs->count = 0;
 	FD_ZERO(&(inputs->fdset));
 	inputs->maxfd = -1;
+	inputs->timeout = 0;
+	inputs->deadline = 0;
+	inputs->poll = 0;
 
 	inputs->fdtypes = malloc(size * sizeof(*(inputs->fdtypes)));
 	inputs->fds = malloc(size * sizeof(*(inputs->fds)));
@@ -185,6 +188,54 @@ int inputs_add_fd(kx_inputs *inputs, int fd, kx_input_type type)
 	return inputs->count - 1;
 }
 
+/* Remove input */
+void inputs_del_fd(kx_inputs *inputs, int fd)
+{
+	int i, j;
+
+	for (i = 0, j = 0; i < inputs->count; i++) {
+		if (inputs->fds[i] == fd) continue;
+		inputs->fds[j] = inputs->fds[i];
+		inputs->fdtypes[j] = inputs->fdtypes[i];
+		++j;
+	}
+	inputs->count = j;
+
+	FD_CLR(fd, &(inputs->fdset));
+
+	/* Recalculate max fd */
+	inputs->maxfd = -1;
+	for (i = 0; i < inputs->count; i++) {
+		if (inputs->fds[i] > inputs->maxfd) inputs->maxfd = inputs->fds[i];
+	}
+}
+
+/* Remove all inputs of specified type */
+void inputs_del_type(kx_inputs *inputs, kx_input_type type)
+{
+	int i;
+
+	for (i = inputs->count - 1; i >= 0; i--) {
+		if (inputs->fdtypes[i] == type) inputs_del_fd(inputs, inputs->fds[i]);
+	}
+}
+
+/* Start countdown */
+void inputs_set_timeout(kx_inputs *inputs, int timeout)
+{
+	inputs->timeout = timeout;
+	if (timeout > 0)
+		inputs->deadline = get_monotonic_us() + timeout * 1000000ULL;
+	else
+		inputs->deadline = 0;
+}
+
+/* Set polling period */
+void inputs_set_poll(kx_inputs *inputs, unsigned int poll)
+{
+	inputs->poll = poll;
+}
+
 /* Scan dir for evdev's and add them */
 int inputs_open_evdir(kx_inputs *inputs, char *path)
 {
@@ -266,7 +317,6 @@ void inputs_close(kx_inputs *inputs)
 /* Prepare inputs for processing */
 int inputs_preprocess(kx_inputs *inputs)
 {
-	++inputs->maxfd;
 	return 0;
 }
 
@@ -350,20 +400,33 @@ enum actions_t inputs_process(kx_inputs *inputs)
 	int i, fd, nready;
 	enum actions_t action = A_NONE;
 	struct timeval timeout;
+	unsigned long long now;
+
+	if (inputs->deadline > 0) {
+		/* Countdown is running */
+		now = get_monotonic_us();
+		if (now > inputs->deadline) now = inputs->deadline;
+		timeout.tv_sec = (inputs->deadline - now) / 1000000;
+		timeout.tv_usec = (inputs->deadline - now) % 1000000;
+	} else {
+		timeout.tv_sec = 60;	// exit after timeout to allow to do something above
+		timeout.tv_usec = 0;
+	}
 
-	timeout.tv_usec = 0;
-#ifdef USE_TIMEOUT
-	timeout.tv_sec = USE_TIMEOUT;
-#else
-	timeout.tv_sec = 60;	// exit after timeout to allow to do something above
-#endif
+	/* Wake up periodically when caller is polling something */
+	if ( (inputs->poll > 0) && ( ((unsigned long long)timeout.tv_sec * 1000000 +
+			timeout.tv_usec) > inputs->poll * 1000ULL ) )
+	{
+		timeout.tv_sec = inputs->poll / 1000;
+		timeout.tv_usec = (inputs->poll % 1000) * 1000;
+	}
 
 	if (0 == inputs->count) return A_ERROR;		/* A_EXIT ? */
 
 	fds = inputs->fdset;
 
 	/* Wait for some input */
-	nready = select(inputs->maxfd, &fds, NULL, NULL, &timeout);	/* Wait for input or timeout */
+	nready = select(inputs->maxfd + 1, &fds, NULL, NULL, &timeout);	/* Wait for input or timeout */
 
 	if (-1 == nready) {
 		if (errno == EINTR) return A_NONE;
@@ -373,11 +436,14 @@ enum actions_t inputs_process(kx_inputs *inputs)
 		}
 	} else if (0 == nready) {	// timeout reached
 #ifdef USE_TIMEOUT
-		log_msg(lg, "Timeout reached!");
-		return A_TIMEOUT;
-#else
-		return A_NONE;
+		if ( (inputs->deadline > 0) && (get_monotonic_us() >= inputs->deadline) ) {
+			log_msg(lg, "Timeout reached!");
+			inputs->deadline = 0;
+			return A_TIMEOUT;
+		}
 #endif
+		if (inputs->poll > 0) return A_POLL;
+		return A_NONE;
 	}
 
 	/* Check fds */
@@ -389,12 +455,20 @@ enum actions_t inputs_process(kx_inputs *inputs)
 				/* Process input from event device */
 				action = inputs_process_evdev(fd);
 				if (A_ERROR == action) continue; /* continue on short read */
+				/* Restart countdown on key press */
+				if ( (A_NONE != action) && (inputs->deadline > 0) )
+					inputs_set_timeout(inputs, inputs->timeout);
 				break;
 			case KX_IT_TTY:
 				/* Process input from tty */
 				break;
 			case KX_IT_SOCKET:
-				/* Process input from sockets */
+				/* Uevent socket have data. It is read by caller */
+				if (A_NONE == action) action = A_HOTPLUG;
+				break;
+			case KX_IT_SCAN:
+				/* Scan worker have data. It is read by scan pool */
+				if (A_NONE == action) action = A_SCAN;
 				break;
 			}
 		}
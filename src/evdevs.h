@@ -34,6 +34,9 @@ enum actions_t {
 	A_RESCAN,
 	A_DEBUG,
 	A_SELECT,
+	A_SCAN,
+	A_HOTPLUG,
+	A_POLL,
 #ifdef USE_TIMEOUT
 	A_TIMEOUT,
 #endif
@@ -55,7 +58,8 @@ enum actions_t {
 typedef enum {
 	KX_IT_EVDEV,
 	KX_IT_TTY,
-	KX_IT_SOCKET
+	KX_IT_SOCKET,
+	KX_IT_SCAN
 } kx_input_type;
 
 typedef struct {
@@ -65,6 +69,9 @@ typedef struct {
 	kx_input_type *fdtypes;
 	fd_set fdset;
 	int maxfd;
+	int timeout;		/* Timeout in seconds (0 - disabled) */
+	unsigned long long deadline;	/* Timeout deadline in microseconds */
+	unsigned int poll;	/* Wake up period in milliseconds (0 - disabled) */
 } kx_inputs;
 
 
@@ -77,6 +84,18 @@ void inputs_clean(kx_inputs *inputs);
 /* Add input */
 int inputs_add_fd(kx_inputs *inputs, int fd, kx_input_type type);
 
+/* Remove input */
+void inputs_del_fd(kx_inputs *inputs, int fd);
+
+/* Remove all inputs of specified type */
+void inputs_del_type(kx_inputs *inputs, kx_input_type type);
+
+/* Start countdown of 'timeout' seconds (0 - disable countdown) */
+void inputs_set_timeout(kx_inputs *inputs, int timeout);
+
+/* Return A_POLL every 'poll' milliseconds when idle (0 - disable) */
+void inputs_set_poll(kx_inputs *inputs, unsigned int poll);
+
 /* Scan for possible inputs and open them */
 int inputs_open(kx_inputs *inputs);
 
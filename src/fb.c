@@ -75,48 +75,29 @@ static unsigned int compose_color (kx_rgba rgba) {
 	return color;
 }
 
+/* Convert logical (drawing) coordinates to real (screen) ones */
 static inline void
-fb_respect_angle(int x, int y, int *dx, int *dy, int *nx)
+fb_respect_angle(int x, int y, int *dx, int *dy)
 {
-/*	// Not sure about this check. IMHO programmer should do this check in his head
-	if (x < 0 || x > fb.width - 1 || y < 0 || y > fb.height - 1) {
-		*dx = 0;
-		*dy = 0;
-		if (nx) *nx = 0;
-		return;
-	}
-*/
 	switch (fb.angle) {
 	case 270:
 		*dy = x;
 		*dx = fb.real_width - y - 1;
-		if (nx) *nx = fb.stride;
 		break;
 	case 180:
 		*dx = fb.real_width - x - 1;
 		*dy = fb.real_height - y - 1;
-		if (nx) *nx = -fb.byte_pp;
 		break;
 	case 90:
 		*dx = y;
 		*dy = fb.real_height - x - 1;
-		if (nx) *nx = -fb.stride;
 		break;
 	case 0:
 	default:
 		*dx = x;
 		*dy = y;
-		if (nx) *nx = fb.byte_pp;
 		break;
 	}
-/*	// Not sure about this check. IMHO programmer should do this check in his head
-	if (*dx < 0 || *dx > fb.real_width - 1 || *dy < 0 || *dy > fb.real_height - 1) {
-		*dx = 0;
-		*dy = 0;
-		if (nx) *nx = 0;
-		return;
-	}
-*/
 }
 
 /**************************************************************************
@@ -127,11 +108,9 @@ static void
 fb_plot_pixel_32bpp(int x, int y, kx_rgba color)
 {
 	static char *offset;
-	static int ox, oy;
 
-	fb_respect_angle(x, y, &ox, &oy, NULL);
-	offset = fb.backbuffer + oy * fb.stride + (ox << 2);
-	if (offset > (fb.backbuffer + fb.screensize - fb.byte_pp)) return;
+	offset = fb.canvas + y * fb.canvas_stride + (x << 2);
+	if (offset > (fb.canvas + fb.canvas_size - fb.byte_pp)) return;
 
 	*(volatile uint32_t *) offset = (uint32_t) color;
 }
@@ -142,11 +121,9 @@ static void
 fb_plot_pixel_24bpp(int x, int y, kx_rgba color)
 {
 	static char *offset;
-	static int ox, oy;
 
-	fb_respect_angle(x, y, &ox, &oy, NULL);
-	offset = fb.backbuffer + oy * fb.stride + (ox + (ox << 1));
-	if (offset > (fb.backbuffer + fb.screensize - fb.byte_pp)) return;
+	offset = fb.canvas + y * fb.canvas_stride + (x + (x << 1));
+	if (offset > (fb.canvas + fb.canvas_size - fb.byte_pp)) return;
 
 	*(volatile char *) (offset) = (color & 0x000000FF);
 	*(volatile char *) (offset + 1) = (color & 0x0000FF00) >> 8;
@@ -159,11 +136,9 @@ static void
 fb_plot_pixel_18bpp(int x, int y, kx_rgba color)
 {
 	static char *offset;
-	static int ox, oy;
 
-	fb_respect_angle(x, y, &ox, &oy, NULL);
-	offset = fb.backbuffer + oy * fb.stride + (ox + (ox << 1));
-	if (offset > (fb.backbuffer + fb.screensize - fb.byte_pp)) return;
+	offset = fb.canvas + y * fb.canvas_stride + (x + (x << 1));
+	if (offset > (fb.canvas + fb.canvas_size - fb.byte_pp)) return;
 
 	*(volatile char *) (offset) = (color & 0x000000FF);
 	*(volatile char *) (offset + 1) = (color & 0x0000FF00) >> 8;
@@ -176,11 +151,9 @@ static void
 fb_plot_pixel_16bpp(int x, int y, kx_rgba color)
 {
 	static char *offset;
-	static int ox, oy;
 
-	fb_respect_angle(x, y, &ox, &oy, NULL);
-	offset = fb.backbuffer + oy * fb.stride + (ox << 1);
-	if (offset > (fb.backbuffer + fb.screensize - fb.byte_pp)) return;
+	offset = fb.canvas + y * fb.canvas_stride + (x << 1);
+	if (offset > (fb.canvas + fb.canvas_size - fb.byte_pp)) return;
 
 	*(volatile uint16_t *) offset = (uint16_t) color;
 }
@@ -194,21 +167,15 @@ static void
 fb_draw_hline_32bpp(int x, int y, int length, kx_rgba color)
 {
 	static char *offset;
-	static int ox, oy, nx;
 
-	fb_respect_angle(x, y, &ox, &oy, &nx);
-	offset = fb.backbuffer + oy * fb.stride + (ox << 2);
-	if (offset > (fb.backbuffer + fb.screensize - fb.byte_pp)) return;
+	offset = fb.canvas + y * fb.canvas_stride + (x << 2);
+	if (offset > (fb.canvas + fb.canvas_size - fb.byte_pp)) return;
 
 	if (length > fb.width - x)
-		oy = fb.width - x;
-	else
-		oy = length;
+		length = fb.width - x;
+	if (length <= 0) return;
 
-	for(; oy > 0; oy--) {
-		*(volatile uint32_t *) offset = color;
-		offset += nx;
-	}
+	fb.span->fill(offset, color, length << 2);
 }
 #endif
 
@@ -217,23 +184,15 @@ static void
 fb_draw_hline_24bpp(int x, int y, int length, kx_rgba color)
 {
 	static char *offset;
-	static int ox, oy, nx;
 
-	fb_respect_angle(x, y, &ox, &oy, &nx);
-	offset = fb.backbuffer + oy * fb.stride + (ox + (ox << 1));
-	if (offset > (fb.backbuffer + fb.screensize - fb.byte_pp)) return;
+	offset = fb.canvas + y * fb.canvas_stride + (x + (x << 1));
+	if (offset > (fb.canvas + fb.canvas_size - fb.byte_pp)) return;
 
 	if (length > fb.width - x)
-		oy = fb.width - x;
-	else
-		oy = length;
+		length = fb.width - x;
+	if (length <= 0) return;
 
-	for(; oy > 0; oy--) {
-		*(volatile char *) (offset) = (color & 0x000000FF);
-		*(volatile char *) (offset + 1) = (color & 0x0000FF00) >> 8;
-		*(volatile char *) (offset + 2) = (color & 0x00FF0000) >> 16;
-		offset += nx;
-	}
+	fb.span->fill3(offset, color, length);
 }
 #endif
 
@@ -242,23 +201,15 @@ static void
 fb_draw_hline_18bpp(int x, int y, int length, kx_rgba color)
 {
 	static char *offset;
-	static int ox, oy, nx;
 
-	fb_respect_angle(x, y, &ox, &oy, &nx);
-	offset = fb.backbuffer + oy * fb.stride + (ox + (ox << 1));
-	if (offset > (fb.backbuffer + fb.screensize - fb.byte_pp)) return;
+	offset = fb.canvas + y * fb.canvas_stride + (x + (x << 1));
+	if (offset > (fb.canvas + fb.canvas_size - fb.byte_pp)) return;
 
 	if (length > fb.width - x)
-		oy = fb.width - x;
-	else
-		oy = length;
+		length = fb.width - x;
+	if (length <= 0) return;
 
-	for(; oy > 0; oy--) {
-		*(volatile char *) (offset) = (color & 0x000000FF);
-		*(volatile char *) (offset + 1) = (color & 0x0000FF00) >> 8;
-		*(volatile char *) (offset + 2) = (color & 0x00FF0000) >> 16;
-		offset += nx;
-	}
+	fb.span->fill3(offset, color, length);
 }
 #endif
 
@@ -267,21 +218,23 @@ static void
 fb_draw_hline_16bpp(int x, int y, int length, kx_rgba color)
 {
 	static char *offset;
-	static int ox, oy, nx;
 
-	fb_respect_angle(x, y, &ox, &oy, &nx);
-	offset = fb.backbuffer + oy * fb.stride + (ox << 1);
-	if (offset > (fb.backbuffer + fb.screensize - fb.byte_pp)) return;
+	offset = fb.canvas + y * fb.canvas_stride + (x << 1);
+	if (offset > (fb.canvas + fb.canvas_size - fb.byte_pp)) return;
 
 	if (length > fb.width - x)
-		oy = fb.width - x;
-	else
-		oy = length;
+		length = fb.width - x;
+	if (length <= 0) return;
 
-	for(; oy > 0; oy--) {
+	/* Fill by pixel pairs */
+	if ((unsigned long)offset & 2) {
 		*(volatile uint16_t *) offset = (uint16_t) color;
-		offset += nx;
+		offset += 2;
+		--length;
 	}
+	fb.span->fill(offset, (color & 0xFFFF) | (color << 16), (length & ~1) << 1);
+	if (length & 1)
+		*(volatile uint16_t *) (offset + ((length - 1) << 1)) = (uint16_t) color;
 }
 #endif
 
@@ -295,16 +248,8 @@ fb_draw_hline_16bpp(int x, int y, int length, kx_rgba color)
 void
 fb_memcpy(char *src, char *dst, int length)
 {
-	static USE_FB_TRANS_TYPE *s, *d;
-	static int n;
-
-	s = (USE_FB_TRANS_TYPE *)src;
-	d = (USE_FB_TRANS_TYPE *)dst;
-	n = USE_FB_TRANS_LENGTH(length);
-
-	while (n--) {
-		*(d++) = *(s++);
-	}
+	/* fbspan_detect() keeps plain copy for narrow transfers */
+	fb.span->copy(src, dst, length);
 }
 
 #ifdef USE_FBUI_UPDATE
@@ -334,7 +279,7 @@ static int fb_quirk_check_manual_update(void)
 	return 0;
 }
 
-/* Flush command mode LCD if needed */
+/* Flush changed part of command mode LCD if needed */
 static void fb_quirk_manual_update(void)
 {
 	struct omapfb_update_window uw;
@@ -342,10 +287,10 @@ static void fb_quirk_manual_update(void)
 	if (!fb.needs_manual_update)
 		return;
 
-	uw.x = 0;
-	uw.y = 0;
-	uw.width = fb.real_width;
-	uw.height = fb.real_height;
+	uw.x = fb.dirty_x1;
+	uw.y = fb.dirty_y1;
+	uw.width = fb.dirty_x2 - fb.dirty_x1;
+	uw.height = fb.dirty_y2 - fb.dirty_y1;
 
 	ioctl(fb.fd, OMAPFB_UPDATE_WINDOW, &uw);
 	ioctl(fb.fd, OMAPFB_SYNC_GFX);
@@ -361,11 +306,198 @@ static inline void fb_quirk_manual_update(void)
 }
 #endif
 
-/* Move backbuffer contents to videomemory */
+/* Mark area as changed to copy it on next fb_render() */
+void fb_damage(int x, int y, int width, int height)
+{
+	int x1, y1, x2, y2;
+
+	if ( (width <= 0) || (height <= 0) ) return;
+
+	/* Area is kept in logical coordinates till fb_render() */
+	x1 = (x < 0) ? 0 : x;
+	y1 = (y < 0) ? 0 : y;
+	x2 = (x + width > fb.width) ? fb.width : x + width;
+	y2 = (y + height > fb.height) ? fb.height : y + height;
+	if ( (x1 >= x2) || (y1 >= y2) ) return;
+
+	if (fb.dirty_x2 <= fb.dirty_x1) {
+		fb.dirty_x1 = x1;
+		fb.dirty_y1 = y1;
+		fb.dirty_x2 = x2;
+		fb.dirty_y2 = y2;
+		return;
+	}
+
+	if (x1 < fb.dirty_x1) fb.dirty_x1 = x1;
+	if (y1 < fb.dirty_y1) fb.dirty_y1 = y1;
+	if (x2 > fb.dirty_x2) fb.dirty_x2 = x2;
+	if (y2 > fb.dirty_y2) fb.dirty_y2 = y2;
+}
+
+/* Convert changed area to real coordinates */
+static void fb_dirty_to_real(void)
+{
+	int x1, y1, x2, y2, t;
+
+	fb_respect_angle(fb.dirty_x1, fb.dirty_y1, &x1, &y1);
+	fb_respect_angle(fb.dirty_x2 - 1, fb.dirty_y2 - 1, &x2, &y2);
+	if (x1 > x2) {
+		t = x1; x1 = x2; x2 = t;
+	}
+	if (y1 > y2) {
+		t = y1; y1 = y2; y2 = t;
+	}
+
+	fb.dirty_x1 = x1;
+	fb.dirty_y1 = y1;
+	fb.dirty_x2 = x2 + 1;
+	fb.dirty_y2 = y2 + 1;
+}
+
+/* Copy 'n' pixels stepping by 's_step' and 'd_step' bytes */
+static void fb_copy_pixels(const char *s, int s_step, char *d, int d_step, int n)
+{
+	switch (fb.byte_pp) {
+	case 4:
+		for (; n > 0; n--, s += s_step, d += d_step)
+			*(uint32_t *) d = *(const uint32_t *) s;
+		break;
+	case 2:
+		for (; n > 0; n--, s += s_step, d += d_step)
+			*(uint16_t *) d = *(const uint16_t *) s;
+		break;
+	default:
+		for (; n > 0; n--, s += s_step, d += d_step) {
+			d[0] = s[0];
+			d[1] = s[1];
+			d[2] = s[2];
+		}
+		break;
+	}
+}
+
+/* Pixels per side of square block transposed at once for 90/270 */
+#define FB_ROTATE_TILE	32
+
+/*
+ * Draw logical area x1,y1 - x2,y2 (exclusive) of canvas rotated into
+ * screen-sized buffer 'dst'. Logical pixel (x,y) goes to
+ * dst + origin + x * sx + y * sy.
+ */
+static void fb_rotate_area(int x1, int y1, int x2, int y2, char *dst)
+{
+	int x, y, tx, ty, ex, ey, sx, sy;
+	const int bpp = fb.byte_pp;
+	const int cs = fb.canvas_stride;
+
+	switch (fb.angle) {
+	case 270:
+		dst += (fb.real_width - 1) * bpp;
+		sx = fb.stride;
+		sy = -bpp;
+		break;
+	case 90:
+		dst += (fb.real_height - 1) * fb.stride;
+		sx = -fb.stride;
+		sy = bpp;
+		break;
+	case 180:
+	default:
+		/* Rows are reversed in memory */
+		dst += (fb.real_height - 1) * fb.stride + (fb.real_width - 1) * bpp;
+		for (y = y1; y < y2; y++) {
+			fb_copy_pixels(fb.canvas + y * cs + x1 * bpp, bpp,
+					dst - y * fb.stride - x1 * bpp, -bpp, x2 - x1);
+		}
+		return;
+	}
+
+	/*
+	 * Logical columns become screen rows. Walk canvas by blocks to keep
+	 * block's canvas rows in cache while screen rows are written.
+	 */
+	for (ty = y1; ty < y2; ty += FB_ROTATE_TILE) {
+		ey = (ty + FB_ROTATE_TILE < y2) ? ty + FB_ROTATE_TILE : y2;
+		for (tx = x1; tx < x2; tx += FB_ROTATE_TILE) {
+			ex = (tx + FB_ROTATE_TILE < x2) ? tx + FB_ROTATE_TILE : x2;
+			for (x = tx; x < ex; x++) {
+				fb_copy_pixels(fb.canvas + ty * cs + x * bpp, cs,
+						dst + x * sx + ty * sy, sy, ey - ty);
+			}
+		}
+	}
+}
+
+/* Copy changed area between screen-sized buffers */
+static void fb_copy_dirty(char *src, char *dst)
+{
+	int y, start, end;
+	const int align = sizeof(USE_FB_TRANS_TYPE);
+
+	if ( (0 == fb.dirty_x1) && (fb.real_width == fb.dirty_x2) ) {
+		/* Whole rows are changed - copy them at once */
+		start = fb.dirty_y1 * fb.stride;
+		fb_memcpy(src + start, dst + start,
+				(fb.dirty_y2 - fb.dirty_y1) * fb.stride);
+	} else {
+		/* Copy changed span of each row by whole transfers */
+		start = (fb.dirty_x1 * fb.byte_pp) & ~(align - 1);
+		end = (fb.dirty_x2 * fb.byte_pp + align - 1) & ~(align - 1);
+		if (end > fb.stride) end = fb.stride;
+
+		for (y = fb.dirty_y1; y < fb.dirty_y2; y++) {
+			fb_memcpy(src + y * fb.stride + start,
+					dst + y * fb.stride + start, end - start);
+		}
+	}
+}
+
+/* Screen info used to pan pages */
+static struct fb_var_screeninfo fb_flip_var;
+
+/* Show page 'page' of video memory and wait till it is on screen */
+static int fb_pan(int page)
+{
+	unsigned int crtc = 0;
+
+	fb_flip_var.yoffset = page * fb.real_height;
+	if (-1 == ioctl(fb.fd, FBIOPAN_DISPLAY, &fb_flip_var))
+		return -1;
+
+	/* Old page may be scanned out till vertical retrace */
+	ioctl(fb.fd, FBIO_WAITFORVSYNC, &crtc);
+	return 0;
+}
+
+/* Move changed part of backbuffer to videomemory */
 void fb_render()
 {
-	fb_memcpy(fb.backbuffer, fb.data, fb.screensize);
+	if (fb.dirty_x2 <= fb.dirty_x1) return;
+
+	if (fb.angle) {
+		/* Rotation pass replaces copy when there is no backbuffer */
+		fb_rotate_area(fb.dirty_x1, fb.dirty_y1, fb.dirty_x2, fb.dirty_y2,
+				fb.backbuffer ? fb.backbuffer : fb.data);
+	}
+	fb_dirty_to_real();
+
+	if (!fb.page_flip) {
+		if (fb.backbuffer) fb_copy_dirty(fb.backbuffer, fb.data);
+	} else if (0 == fb_pan(1 - fb.page)) {
+		fb.page = 1 - fb.page;
+		fb.backbuffer = fb.data + (1 - fb.page) * fb.screensize;
+		if (!fb.angle) fb.canvas = fb.backbuffer;
+
+		/* New off-screen page misses last changes. Bring them from screen */
+		fb_copy_dirty(fb.data + fb.page * fb.screensize, fb.backbuffer);
+	} else {
+		/* Can't flip. Copy to visible page as without flipping */
+		fb_copy_dirty(fb.backbuffer, fb.data + fb.page * fb.screensize);
+	}
+
 	fb_quirk_manual_update();
+
+	fb.dirty_x1 = fb.dirty_y1 = fb.dirty_x2 = fb.dirty_y2 = 0;
 }
 
 /* Save backbuffer contents to further usage */
@@ -373,10 +505,10 @@ char *fb_dump()
 {
 	char *dump;
 
-	dump = malloc(fb.screensize);
+	dump = malloc(fb.canvas_size);
 	if (NULL == dump) return NULL;
 
-	fb_memcpy(fb.backbuffer, dump, fb.screensize);
+	fb_memcpy(fb.canvas, dump, fb.canvas_size);
 	return dump;
 }
 
@@ -384,16 +516,27 @@ char *fb_dump()
 void fb_restore(char *dump)
 {
 	if (NULL == dump) return;
-	fb_memcpy(dump, fb.backbuffer, fb.screensize);
+	fb_memcpy(dump, fb.canvas, fb.canvas_size);
+	fb_damage(0, 0, fb.width, fb.height);
 }
 
 
 void fb_destroy()
 {
+	if (fb.canvas != fb.backbuffer)
+		free(fb.canvas);
+
+	if (fb.page_flip) {
+		/* Leave picture on first page like other fb users expect */
+		if (1 == fb.page) {
+			fb_memcpy(fb.data + fb.screensize, fb.data, fb.screensize);
+			fb_pan(0);
+		}
+	} else if(fb.backbuffer) {
+		free(fb.backbuffer);
+	}
 	if (fb.fd >= 0)
 		close(fb.fd);
-	if(fb.backbuffer)
-		free(fb.backbuffer);
 }
 
 /*
@@ -419,6 +562,43 @@ int clear_virtual(struct fb_var_screeninfo *fb_var)
 	return ioctl(fb.fd, FBIOPUT_VSCREENINFO, fb_var);
 }
 
+/*
+ * Try to double virtual height to draw into off-screen page and pan it
+ * in instead of copying backbuffer. Screen info is restored on failure.
+ * Return 1 if page flipping is possible, 0 otherwise.
+ */
+static int fb_setup_page_flip(struct fb_var_screeninfo *fb_var,
+		struct fb_fix_screeninfo *fb_fix)
+{
+	struct fb_var_screeninfo var = *fb_var;
+	struct fb_fix_screeninfo fix;
+
+	/* Drawing code writes to page directly. Transfer width can't be kept */
+	if (sizeof(USE_FB_TRANS_TYPE) < sizeof(uint32_t))
+		return 0;
+
+	/* Driver can't pan vertically */
+	if ( (0 == fb_fix->ypanstep) || (0 != fb_var->yres % fb_fix->ypanstep) )
+		return 0;
+
+	var.yres_virtual = fb_var->yres * 2;
+	var.yoffset = 0;
+	if ( (-1 == ioctl(fb.fd, FBIOPUT_VSCREENINFO, &var)) ||
+			(-1 == ioctl(fb.fd, FBIOGET_VSCREENINFO, &var)) ||
+			(var.yres_virtual < 2 * var.yres) ||
+			(-1 == ioctl(fb.fd, FBIOGET_FSCREENINFO, &fix)) ||
+			(fix.line_length != fb_fix->line_length) ||
+			(fix.smem_len < 2 * fix.line_length * var.yres) ||
+			(-1 == ioctl(fb.fd, FBIOPAN_DISPLAY, &var)) )
+	{
+		ioctl(fb.fd, FBIOPUT_VSCREENINFO, fb_var);
+		return 0;
+	}
+
+	fb_flip_var = var;
+	return 1;
+}
+
 int
 attempt_to_change_pixel_format(struct fb_var_screeninfo *fb_var)
 {
@@ -494,6 +674,86 @@ void print_fb()
 }
 #endif
 
+#ifdef DEBUG
+/* Screens drawn by benchmark per kernel set and bpp */
+#define FB_BENCH_FRAMES	8
+
+/* Log MB/s of full screen fills and flushes for plain and detected kernels.
+ * Flush includes rotation when screen is rotated */
+static void fb_benchmark(void)
+{
+	static const struct {
+		int bpp, byte_pp;
+		draw_hline_func hline;
+	} modes[] = {
+#ifdef USE_32BPP
+		{ 32, 4, fb_draw_hline_32bpp },
+#endif
+#ifdef USE_24BPP
+		{ 24, 3, fb_draw_hline_24bpp },
+#endif
+#ifdef USE_18BPP
+		{ 18, 3, fb_draw_hline_18bpp },
+#endif
+#ifdef USE_16BPP
+		{ 16, 2, fb_draw_hline_16bpp },
+#endif
+	};
+	const struct fbspan_ops *ops[2], *detected = fb.span;
+	unsigned long long size, start, fill_us, flush_us;
+	char *ram;
+	int i, m, f, y;
+
+	ram = malloc(fb.screensize);
+	if (!ram) return;
+	memset(ram, 0x55, fb.screensize);
+
+	ops[0] = &fbspan_scalar;
+	ops[1] = detected;
+
+	for (i = 0; i < 2; i++) {
+		if ( (1 == i) && (detected == &fbspan_scalar) ) break;
+		fb.span = ops[i];
+
+		for (m = 0; m < ROWS(modes); m++) {
+			/* Wider pixels won't fit into rows of current mode */
+			if (modes[m].byte_pp > fb.byte_pp) continue;
+
+			start = get_monotonic_us();
+			for (f = 0; f < FB_BENCH_FRAMES; f++) {
+				for (y = 0; y < fb.height; y++)
+					modes[m].hline(0, y, fb.width, 0x00102030 * f);
+			}
+			fill_us = get_monotonic_us() - start;
+
+			start = get_monotonic_us();
+			for (f = 0; f < FB_BENCH_FRAMES; f++) {
+				/* Flush like fb_render(): rotate to screen or to RAM */
+				if (fb.angle)
+					fb_rotate_area(0, 0, fb.width, fb.height,
+							fb.backbuffer ? ram : fb.data);
+				if ( !fb.angle || fb.backbuffer )
+					fb_memcpy(ram, fb.data, fb.screensize);
+			}
+			flush_us = get_monotonic_us() - start;
+
+			if (0 == fill_us) fill_us = 1;
+			if (0 == flush_us) flush_us = 1;
+			size = (unsigned long long)fb.width * fb.height *
+					modes[m].byte_pp * FB_BENCH_FRAMES;
+			log_msg(lg, "fb bench %s %dbpp: fill %llu.%02lluMB/s, flush %llu.%02lluMB/s",
+					fb.span->name, modes[m].bpp,
+					size / fill_us, (size * 100 / fill_us) % 100,
+					(unsigned long long)fb.screensize * FB_BENCH_FRAMES / flush_us,
+					((unsigned long long)fb.screensize * FB_BENCH_FRAMES * 100 / flush_us) % 100);
+		}
+	}
+
+	fb.span = detected;
+	free(ram);
+}
+#endif
+
 int fb_new(int angle)
 {
 	struct fb_var_screeninfo fb_var;
@@ -507,7 +767,13 @@ int fb_new(int angle)
 
 	memset(&fb, 0, sizeof(FB));
 
+	/* Unknown angles are drawn unrotated */
+	if ( (90 != angle) && (180 != angle) && (270 != angle) )
+		angle = 0;
+
 	fb.fd = -1;
+	fb.span = fbspan_detect();
+	log_msg(lg, "Using %s span kernels", fb.span->name);
 
 	if ((fb.fd = open(fbdev, O_RDWR)) < 0) {
 		log_msg(lg, "Error opening /dev/fb0: %s", ERRMSG);
@@ -558,7 +824,13 @@ int fb_new(int angle)
 	strncpy(fb.id, fb_fix.id, 16);
 
 	fb.screensize = fb.stride * fb.height;
-	fb.backbuffer = malloc(fb.screensize);
+	fb.page_flip = fb_setup_page_flip(&fb_var, &fb_fix);
+	if (fb.page_flip)
+		log_msg(lg, "Using page flipping");
+	else if ( (0 == angle) || (sizeof(USE_FB_TRANS_TYPE) < sizeof(uint32_t)) )
+		fb.backbuffer = malloc(fb.screensize);
+	/* else fb_render() rotates canvas straight to screen. Narrow
+	 * transfers need rotation to RAM and fb_memcpy() to screen */
 
 	fb.red_offset = fb_var.red.offset;
 	fb.red_length = fb_var.red.length;
@@ -583,7 +855,7 @@ int fb_new(int angle)
 
 	fb.base = (char *) mmap((caddr_t) NULL,
 				 /*fb_fix.smem_len */
-				 fb.stride * fb.height,
+				 fb.screensize * (fb.page_flip ? 2 : 1),
 				 PROT_READ | PROT_WRITE,
 				 MAP_SHARED, fb.fd, 0);
 
@@ -599,6 +871,10 @@ int fb_new(int angle)
 	fb.data = fb.base + off;
 	fb.angle = angle;
 
+	/* Draw into hidden page. First page is on screen */
+	if (fb.page_flip)
+		fb.backbuffer = fb.data + fb.screensize;
+
 	switch (fb.angle) {
 	case 270:
 	case 90:
@@ -611,6 +887,21 @@ int fb_new(int angle)
 		break;
 	}
 
+	if (0 == fb.angle) {
+		fb.canvas = fb.backbuffer;
+		fb.canvas_stride = fb.stride;
+		fb.canvas_size = fb.screensize;
+	} else {
+		/* Draw unrotated and rotate whole changed area in fb_render() */
+		fb.canvas_stride = (fb.width * fb.byte_pp + 3) & ~3;
+		fb.canvas_size = fb.canvas_stride * fb.height;
+		fb.canvas = malloc(fb.canvas_size);
+		if (NULL == fb.canvas) {
+			log_msg(lg, "Can't allocate %d bytes for rotated canvas", fb.canvas_size);
+			goto fail;
+		}
+	}
+
 #ifdef DEBUG
 	print_fb(fb);
 #endif
@@ -648,6 +939,10 @@ int fb_new(int angle)
 		break;
 	}
 
+#ifdef DEBUG
+	fb_benchmark();
+#endif
+
 	return 0;
 
 fail:
@@ -666,6 +961,7 @@ void fb_plot_pixel(int x, int y, kx_rgba rgba)
 	color = compose_color(rgba);
 
 	fb.plot_pixel(x, y, color);
+	fb_damage(x, y, 1, 1);
 }
 
 
@@ -676,6 +972,7 @@ void fb_draw_hline(int x, int y, int length, kx_rgba rgba)
 	color = compose_color(rgba);
 
 	fb.draw_hline(x, y, length, color);
+	fb_damage(x, y, length, 1);
 }
 
 
@@ -689,6 +986,8 @@ void fb_draw_rect(int x, int y, int width, int height,
 
 	for (dy = y; dy < y+height; dy++)
 		fb.draw_hline(x, dy, width, color);
+
+	fb_damage(x, y, width, height);
 }
 
 
@@ -713,6 +1012,8 @@ void fb_draw_rounded_rect(int x, int y, int width, int height,
 	/* Bottom rounded part */
 	fb.draw_hline(x+1, dy++, width-2, color);
 	fb.draw_hline(x+2, dy++, width-4, color);
+
+	fb_damage(x, y, width, height);
 }
 
 
@@ -774,7 +1075,7 @@ int fb_draw_constrained_text(int x, int y,
 		int max_x, int max_y, kx_rgba rgba,
 		const Font * font, const char *text)
 {
-	int h, w, cx, cy, dx, dy;
+	int h, w, n, cx, cy, dx, dy, mx;
 	char *c = (char *) text;
 	u_int32_t gl;
 	kx_rgba color;
@@ -783,6 +1084,7 @@ int fb_draw_constrained_text(int x, int y,
 
 	h = font->height;
 	dx = x; dy = y;
+	mx = x;
 
 	for(; *c;c++){
 		u_int32_t *glyph = NULL;
@@ -812,17 +1114,26 @@ int fb_draw_constrained_text(int x, int y,
 		for (cy = 0; cy < h; cy++) {
 			gl = *glyph++;
 
-			for (cx = 0; cx < w; cx++) {
-				if (gl & 0x80000000)
-					fb.plot_pixel(dx + cx,
-						      dy + cy, color);
-				gl <<= 1;
+			/* Draw runs of set bits as lines */
+			for (cx = 0; cx < w; cx += n) {
+				for (n = 0; (cx + n < w) && (gl & 0x80000000); n++)
+					gl <<= 1;
+
+				if (n > 0) {
+					fb.draw_hline(dx + cx, dy + cy, n, color);
+				} else {
+					n = 1;
+					gl <<= 1;
+				}
 			}
 		}
 
 		dx += w;
+		if (dx > mx) mx = dx;
 	}
 
+	fb_damage(x, y, mx - x, dy - y + h);
+
 	return dy - y + h;
 }
 
@@ -834,31 +1145,124 @@ void fb_draw_text(int x, int y, kx_rgba rgba,
 }
 
 
-/* Draw picture on framebuffer */
-void fb_draw_picture(int x, int y, kx_picture *pic)
+/* Convert picture pixels to framebuffer format once to draw it by spans */
+int fb_prepare_picture(kx_picture *pic)
 {
-	if (NULL == pic) return;
-
-	unsigned int i, j;
-	int dx = 0, dy = 0;
+	unsigned int i, j, start;
+	int n;
 	kx_rgba *pixel, color;
+	kx_picture_run *run;
+	char *row, *p;
+
+	if (NULL == pic) return -1;
+	if (NULL != pic->native) return 0;
+
+	pic->native_stride = (pic->width * fb.byte_pp + 3) & ~3;
+	pic->native = malloc(pic->native_stride * pic->height);
+	if (NULL == pic->native) {
+		DPRINTF("Can't allocate memory for native picture");
+		return -1;
+	}
+
+	/* Worst case is every other pixel opaque */
+	pic->runs = malloc(pic->height * ((pic->width + 1) / 2) *
+			sizeof(*(pic->runs)) + 1);
+	if (NULL == pic->runs) {
+		DPRINTF("Can't allocate memory for picture spans");
+		free(pic->native);
+		pic->native = NULL;
+		return -1;
+	}
 
+	n = 0;
 	pixel = pic->pixels;
-	dy = y;
 	for (i = 0; i < pic->height; i++) {
-		dx = x;
-		for (j = 0; j < pic->width; j++) {
-			color = *pixel;
-			color = compose_color (color);
-			/* TODO Add transparency processing */
-			/* Draw pixel if not fully transparent */
-			if ((color & 0xFF000000) == 0)
-				fb.plot_pixel(dx, dy, color);
-			++dx;
-			++pixel;
+		row = pic->native + i * pic->native_stride;
+		start = 0;
+		for (j = 0; j < pic->width; j++, pixel++) {
+			color = compose_color(*pixel);
+			p = row + j * fb.byte_pp;
+
+			switch (fb.byte_pp) {
+			case 4:
+				*(uint32_t *) p = color;
+				break;
+			case 2:
+				*(uint16_t *) p = (uint16_t) color;
+				break;
+			default:
+				p[0] = (color & 0x000000FF);
+				p[1] = (color & 0x0000FF00) >> 8;
+				p[2] = (color & 0x00FF0000) >> 16;
+				break;
+			}
+
+			/* Any transparency ends opaque span */
+			if (color & 0xFF000000) {
+				if (j > start) {
+					pic->runs[n].y = i;
+					pic->runs[n].x = start;
+					pic->runs[n].length = j - start;
+					++n;
+				}
+				start = j + 1;
+			}
 		}
-		++dy;
+		if (pic->width > start) {
+			pic->runs[n].y = i;
+			pic->runs[n].x = start;
+			pic->runs[n].length = pic->width - start;
+			++n;
+		}
+	}
+	pic->nruns = n;
+
+	/* Give back unused spans */
+	if (n > 0) {
+		run = realloc(pic->runs, n * sizeof(*(pic->runs)));
+		if (NULL != run) pic->runs = run;
 	}
+
+	return 0;
+}
+
+/* Draw picture on framebuffer */
+void fb_draw_picture(int x, int y, kx_picture *pic)
+{
+	if (NULL == pic) return;
+
+	int i, dx, dy, len, skip, bytes;
+	kx_picture_run *run;
+	const char *src;
+	char *dst;
+
+	if (-1 == fb_prepare_picture(pic)) return;
+
+	for (i = 0, run = pic->runs; i < pic->nruns; i++, run++) {
+		dy = y + run->y;
+		if ( (dy < 0) || (dy >= fb.height) ) continue;
+
+		/* Clip span by screen width */
+		dx = x + run->x;
+		len = run->length;
+		skip = (dx < 0) ? -dx : 0;
+		if (dx + len > fb.width) len = fb.width - dx;
+		len -= skip;
+		if (len <= 0) continue;
+
+		src = pic->native + run->y * pic->native_stride +
+				(run->x + skip) * fb.byte_pp;
+		dst = fb.canvas + dy * fb.canvas_stride + (dx + skip) * fb.byte_pp;
+		bytes = len * fb.byte_pp;
+
+		/* Whole words can go by span kernel */
+		if (0 == (((unsigned long)src | (unsigned long)dst | bytes) & 3))
+			fb.span->copy(src, dst, bytes);
+		else
+			fb_copy_pixels(src, fb.byte_pp, dst, fb.byte_pp, len);
+	}
+
+	fb_damage(x, y, pic->width, pic->height);
 }
 
 /* Free picture's data structure */
@@ -866,6 +1270,8 @@ void fb_destroy_picture(kx_picture* pic)
 {
 	if (NULL == pic) return;
 	dispose(pic->pixels);
+	dispose(pic->native);
+	dispose(pic->runs);
 	free(pic);
 }
 
@@ -38,6 +38,7 @@
 #include "util.h"
 #include "../res/fonts/font.h"
 #include "rgb.h"
+#include "fbspan.h"
 
 typedef void (*plot_pixel_func)(int x, int y,
 		kx_rgba color);
@@ -73,18 +74,47 @@ typedef struct FB {
 	char id[16];
 	int needs_manual_update;
 
+	/* Page flipping: backbuffer is off-screen page of video memory
+	 * which is panned in by fb_render() */
+	int page_flip;
+	int page;		/* Visible page number */
+
+	/* Drawing buffer in logical orientation. It is backbuffer itself
+	 * when screen is not rotated and is rotated into it otherwise */
+	char *canvas;
+	int canvas_stride;
+	int canvas_size;
+
+	/* Canvas area changed since last render (logical coordinates,
+	 * x2 and y2 are exclusive). Area is empty when x2 <= x1 */
+	int dirty_x1, dirty_y1, dirty_x2, dirty_y2;
+
 	plot_pixel_func plot_pixel;
 	draw_hline_func draw_hline;
+	const struct fbspan_ops *span;	/* Span fill/copy kernels */
 } FB;
 
 FB fb;
 
+/* Span of opaque picture pixels */
+typedef struct {
+	unsigned short y, x;	/* span start */
+	unsigned short length;	/* span length in pixels */
+} kx_picture_run;
+
 /* Picture structure */
 /* FIXME: store pixels as colors triplets per uint32_t value */
 typedef struct {
 	unsigned int width;		/* picture width */
 	unsigned int height;	/* picture height */
 	kx_rgba *pixels;		/* RGBA array */
+
+	/* Pixels converted to framebuffer format by fb_prepare_picture().
+	 * NULL until picture is prepared */
+	char *native;
+	int native_stride;
+	kx_picture_run *runs;	/* Opaque spans to copy from native */
+	int nruns;
 } kx_picture;
 
 
@@ -119,7 +149,10 @@ void
 fb_draw_text(int x, int y, kx_rgba rgba,
 		const Font * font, const char *text);
 
-/* Move backbuffer contents to videomemory */
+/* Mark area as changed to copy it on next fb_render() */
+void fb_damage(int x, int y, int width, int height);
+
+/* Move changed part of backbuffer to videomemory */
 void fb_render();
 
 /* Save backbuffer contents to further usage */
@@ -128,6 +161,13 @@ char *fb_dump();
 /* Restore saved backbuffer */
 void fb_restore(char *dump);
 
+/*
+ * Convert picture pixels to framebuffer format once to draw it by spans.
+ * fb_draw_picture() does this itself on first draw if needed.
+ * Return 0 on success, -1 on error.
+ */
+int fb_prepare_picture(kx_picture *pic);
+
 /* Draw picture on framebuffer */
 void fb_draw_picture(int x, int y, kx_picture *pic);
 
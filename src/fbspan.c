@@ -0,0 +1,305 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *
+ *  Copyright (c) 2008-2011 Yuri Bushmelev <jay4mail@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+#include "config.h"
+
+#ifdef USE_FBMENU
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "util.h"
+#include "fbspan.h"
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define FBSPAN_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) || \
+		(defined(__arm__) && (defined(__ARM_NEON) || defined(__ARM_NEON__)))
+#define FBSPAN_NEON
+#include <arm_neon.h>
+#endif
+
+/* Alignment mask of pointer */
+#define ALIGN_OFF(p, n)	((unsigned long)(p) & ((n) - 1))
+
+
+/**************************************************************************
+ * Plain C kernels
+ */
+static void fill_scalar(char *dst, uint32_t pattern, int bytes)
+{
+	volatile uint32_t *d = (uint32_t *)dst;
+	int n = bytes >> 2;
+
+	while (n--)
+		*(d++) = pattern;
+}
+
+/* Store one 3-byte pixel */
+static inline char *put_pixel3(char *dst, uint32_t color)
+{
+	dst[0] = (color & 0x000000FF);
+	dst[1] = (color & 0x0000FF00) >> 8;
+	dst[2] = (color & 0x00FF0000) >> 16;
+	return dst + 3;
+}
+
+/* Repeat 3-byte pixel over 'size' bytes (multiple of 12) of pattern */
+static void make_pattern3(unsigned char *pat, int size, uint32_t color)
+{
+	int i;
+
+	for (i = 0; i < size; i += 3)
+		put_pixel3((char *)pat + i, color);
+}
+
+/* 4 pixels take 12 bytes i.e. 3 words. Fill by such groups */
+static void fill3_scalar(char *dst, uint32_t color, int pixels)
+{
+	unsigned char pat[12];
+	uint32_t w[3];
+
+	for (; (pixels > 0) && ALIGN_OFF(dst, 4); pixels--)
+		dst = put_pixel3(dst, color);
+
+	make_pattern3(pat, sizeof(pat), color);
+	memcpy(w, pat, sizeof(w));
+
+	for (; pixels >= 4; pixels -= 4, dst += 12) {
+		((volatile uint32_t *)dst)[0] = w[0];
+		((volatile uint32_t *)dst)[1] = w[1];
+		((volatile uint32_t *)dst)[2] = w[2];
+	}
+
+	for (; pixels > 0; pixels--)
+		dst = put_pixel3(dst, color);
+}
+
+/* Same as fb_memcpy(): hardware may need narrow transfers */
+static void copy_scalar(const char *src, char *dst, int bytes)
+{
+	const USE_FB_TRANS_TYPE *s = (const USE_FB_TRANS_TYPE *)src;
+	USE_FB_TRANS_TYPE *d = (USE_FB_TRANS_TYPE *)dst;
+	int n = USE_FB_TRANS_LENGTH(bytes);
+
+	while (n--)
+		*(d++) = *(s++);
+}
+
+const struct fbspan_ops fbspan_scalar = { "C", fill_scalar, fill3_scalar, copy_scalar };
+
+
+#ifdef FBSPAN_X86
+/**************************************************************************
+ * SSE2 and AVX2 kernels. Stores are aligned, loads are not
+ */
+__attribute__((target("sse2")))
+static void fill_sse2(char *dst, uint32_t pattern, int bytes)
+{
+	__m128i v;
+
+	for (; (bytes > 0) && ALIGN_OFF(dst, 16); dst += 4, bytes -= 4)
+		*(uint32_t *)dst = pattern;
+
+	v = _mm_set1_epi32(pattern);
+	for (; bytes >= 16; dst += 16, bytes -= 16)
+		_mm_store_si128((__m128i *)dst, v);
+
+	for (; bytes > 0; dst += 4, bytes -= 4)
+		*(uint32_t *)dst = pattern;
+}
+
+/* 16 pixels take 48 bytes i.e. 3 vectors */
+__attribute__((target("sse2")))
+static void fill3_sse2(char *dst, uint32_t color, int pixels)
+{
+	unsigned char pat[48];
+	__m128i v0, v1, v2;
+
+	for (; (pixels > 0) && ALIGN_OFF(dst, 16); pixels--)
+		dst = put_pixel3(dst, color);
+
+	make_pattern3(pat, sizeof(pat), color);
+	v0 = _mm_loadu_si128((const __m128i *)pat);
+	v1 = _mm_loadu_si128((const __m128i *)(pat + 16));
+	v2 = _mm_loadu_si128((const __m128i *)(pat + 32));
+
+	for (; pixels >= 16; pixels -= 16, dst += 48) {
+		_mm_store_si128((__m128i *)dst, v0);
+		_mm_store_si128((__m128i *)(dst + 16), v1);
+		_mm_store_si128((__m128i *)(dst + 32), v2);
+	}
+
+	fill3_scalar(dst, color, pixels);
+}
+
+__attribute__((target("sse2")))
+static void copy_sse2(const char *src, char *dst, int bytes)
+{
+	for (; (bytes > 0) && ALIGN_OFF(dst, 16); src += 4, dst += 4, bytes -= 4)
+		*(uint32_t *)dst = *(const uint32_t *)src;
+
+	for (; bytes >= 16; src += 16, dst += 16, bytes -= 16)
+		_mm_store_si128((__m128i *)dst, _mm_loadu_si128((const __m128i *)src));
+
+	for (; bytes > 0; src += 4, dst += 4, bytes -= 4)
+		*(uint32_t *)dst = *(const uint32_t *)src;
+}
+
+__attribute__((target("avx2")))
+static void fill_avx2(char *dst, uint32_t pattern, int bytes)
+{
+	__m256i v;
+
+	for (; (bytes > 0) && ALIGN_OFF(dst, 32); dst += 4, bytes -= 4)
+		*(uint32_t *)dst = pattern;
+
+	v = _mm256_set1_epi32(pattern);
+	for (; bytes >= 32; dst += 32, bytes -= 32)
+		_mm256_store_si256((__m256i *)dst, v);
+
+	for (; bytes > 0; dst += 4, bytes -= 4)
+		*(uint32_t *)dst = pattern;
+}
+
+__attribute__((target("avx2")))
+static void copy_avx2(const char *src, char *dst, int bytes)
+{
+	for (; (bytes > 0) && ALIGN_OFF(dst, 32); src += 4, dst += 4, bytes -= 4)
+		*(uint32_t *)dst = *(const uint32_t *)src;
+
+	for (; bytes >= 32; src += 32, dst += 32, bytes -= 32)
+		_mm256_store_si256((__m256i *)dst,
+				_mm256_loadu_si256((const __m256i *)src));
+
+	for (; bytes > 0; src += 4, dst += 4, bytes -= 4)
+		*(uint32_t *)dst = *(const uint32_t *)src;
+}
+
+/* 3-byte pattern gains nothing from wider stores. SSE2 one is used by AVX2 */
+static const struct fbspan_ops fbspan_sse2 = { "SSE2", fill_sse2, fill3_sse2, copy_sse2 };
+static const struct fbspan_ops fbspan_avx2 = { "AVX2", fill_avx2, fill3_sse2, copy_avx2 };
+#endif	/* FBSPAN_X86 */
+
+
+#ifdef FBSPAN_NEON
+/**************************************************************************
+ * NEON kernels
+ */
+static void fill_neon(char *dst, uint32_t pattern, int bytes)
+{
+	uint32x4_t v;
+
+	v = vdupq_n_u32(pattern);
+	for (; bytes >= 16; dst += 16, bytes -= 16)
+		vst1q_u32((uint32_t *)dst, v);
+
+	for (; bytes > 0; dst += 4, bytes -= 4)
+		*(uint32_t *)dst = pattern;
+}
+
+/* 16 pixels take 48 bytes i.e. 3 vectors */
+static void fill3_neon(char *dst, uint32_t color, int pixels)
+{
+	unsigned char pat[48];
+	uint8x16_t v0, v1, v2;
+
+	make_pattern3(pat, sizeof(pat), color);
+	v0 = vld1q_u8(pat);
+	v1 = vld1q_u8(pat + 16);
+	v2 = vld1q_u8(pat + 32);
+
+	for (; pixels >= 16; pixels -= 16, dst += 48) {
+		vst1q_u8((uint8_t *)dst, v0);
+		vst1q_u8((uint8_t *)(dst + 16), v1);
+		vst1q_u8((uint8_t *)(dst + 32), v2);
+	}
+
+	fill3_scalar(dst, color, pixels);
+}
+
+static void copy_neon(const char *src, char *dst, int bytes)
+{
+	for (; bytes >= 16; src += 16, dst += 16, bytes -= 16)
+		vst1q_u8((uint8_t *)dst, vld1q_u8((const uint8_t *)src));
+
+	for (; bytes > 0; src += 4, dst += 4, bytes -= 4)
+		*(uint32_t *)dst = *(const uint32_t *)src;
+}
+
+static const struct fbspan_ops fbspan_neon = { "NEON", fill_neon, fill3_neon, copy_neon };
+
+#ifdef __arm__
+/* From asm/hwcap.h and linux/auxvec.h */
+#define FBSPAN_AT_HWCAP		16
+#define FBSPAN_HWCAP_NEON	(1 << 12)
+
+/* NEON is optional on ARMv7. Kernel tells about it in aux vector */
+static int has_neon(void)
+{
+	unsigned long auxv[2];
+	int fd, rc = 0;
+
+	fd = open("/proc/self/auxv", O_RDONLY);
+	if (-1 == fd) return 0;
+
+	while (sizeof(auxv) == read(fd, auxv, sizeof(auxv))) {
+		if (FBSPAN_AT_HWCAP == auxv[0]) {
+			rc = !!(auxv[1] & FBSPAN_HWCAP_NEON);
+			break;
+		}
+	}
+
+	close(fd);
+	return rc;
+}
+#else
+/* Advanced SIMD is mandatory on AArch64 */
+static inline int has_neon(void)
+{
+	return 1;
+}
+#endif
+#endif	/* FBSPAN_NEON */
+
+
+const struct fbspan_ops *fbspan_detect(void)
+{
+	/* tosa and friends are broken by wide transfers */
+	if (sizeof(USE_FB_TRANS_TYPE) < sizeof(uint32_t))
+		return &fbspan_scalar;
+
+#ifdef FBSPAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return &fbspan_avx2;
+	if (__builtin_cpu_supports("sse2"))
+		return &fbspan_sse2;
+#endif
+
+#ifdef FBSPAN_NEON
+	if (has_neon())
+		return &fbspan_neon;
+#endif
+
+	return &fbspan_scalar;
+}
+
+#endif	/* USE_FBMENU */
@@ -0,0 +1,56 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *
+ *  Copyright (c) 2008-2011 Yuri Bushmelev <jay4mail@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+#ifndef _HAVE_FBSPAN_H_
+#define _HAVE_FBSPAN_H_
+
+#include <stdint.h>
+
+#include "config.h"
+
+/*
+ * Fill 'bytes' bytes at 'dst' with 32-bit 'pattern'.
+ * 'dst' should be 4-byte aligned and 'bytes' multiple of 4.
+ */
+typedef void (*fill_span_func)(char *dst, uint32_t pattern, int bytes);
+
+/*
+ * Fill 'pixels' 3-byte pixels at 'dst' with 24-bit 'color' stored in
+ * 24/18bpp byte order (lowest byte first). 'dst' may be unaligned.
+ */
+typedef void (*fill3_span_func)(char *dst, uint32_t color, int pixels);
+
+/* Copy 'bytes' bytes. Same alignment rules as for fill */
+typedef void (*copy_span_func)(const char *src, char *dst, int bytes);
+
+/* Span kernels set */
+struct fbspan_ops {
+	const char *name;
+	fill_span_func fill;
+	fill3_span_func fill3;
+	copy_span_func copy;
+};
+
+/* Plain C kernels. Copy uses USE_FB_TRANS_TYPE transfers */
+extern const struct fbspan_ops fbspan_scalar;
+
+/*
+ * Return fastest kernels supported by CPU. Plain C kernels are returned
+ * when RAM-to-FB transfers should be narrower than 32 bits.
+ */
+const struct fbspan_ops *fbspan_detect(void);
+
+#endif //_HAVE_FBSPAN_H_
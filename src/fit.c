@@ -0,0 +1,499 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *
+ *  Copyright (c) 2008-2011 Yuri Bushmelev <jay4mail@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+
+#include "config.h"
+#include "util.h"
+#include "fit.h"
+
+/* Flattened device tree header (BE) */
+#define FDT_MAGIC			0xD00DFEED
+#define FDT_HDR_SIZE		40
+#define FDT_BEGIN_NODE		1
+#define FDT_END_NODE		2
+#define FDT_PROP			3
+#define FDT_NOP				4
+#define FDT_END				9
+
+/* Longest property value we read */
+#define FIT_PROP_MAX		256
+
+/* Where we are in tree */
+enum fit_section_t {
+	FIT_ROOT,
+	FIT_IMAGES,
+	FIT_CONFS,
+	FIT_OTHER
+};
+
+/* Buffered reader of FDT structure block */
+typedef struct {
+	int fd;
+	unsigned long long pos;		/* Current offset in file */
+	unsigned long long end;		/* End of structure block */
+	unsigned char win[4096];	/* Read window */
+	unsigned long long win_off;	/* File offset of window */
+	size_t win_len;				/* Bytes in window */
+} kx_fdt_reader;
+
+
+static unsigned long get_be32(const unsigned char *p)
+{
+	return ((unsigned long)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+
+/* Read len bytes at offset through window */
+static int fdt_read(kx_fdt_reader *r, unsigned long long off,
+		void *buf, size_t len)
+{
+	ssize_t n;
+
+	if ( (off < r->win_off) || (off + len > r->win_off + r->win_len) ) {
+		if (len > sizeof(r->win)) {
+			n = pread(r->fd, buf, len, off);
+			return (n == len ? 0 : -1);
+		}
+		n = pread(r->fd, r->win, sizeof(r->win), off);
+		if (n < 0) return -1;
+		r->win_off = off;
+		r->win_len = n;
+		if (len > r->win_len) return -1;
+	}
+
+	memcpy(buf, r->win + (off - r->win_off), len);
+	return 0;
+}
+
+
+static int fdt_read_u32(kx_fdt_reader *r, unsigned long *val)
+{
+	unsigned char b[4];
+
+	if ( (r->pos + 4 > r->end) || (-1 == fdt_read(r, r->pos, b, 4)) )
+		return -1;
+	r->pos += 4;
+	*val = get_be32(b);
+	return 0;
+}
+
+
+/* Read node name at current position */
+static int fdt_read_name(kx_fdt_reader *r, char *name, size_t size)
+{
+	size_t i = 0;
+	unsigned char c;
+
+	do {
+		if ( (r->pos >= r->end) || (-1 == fdt_read(r, r->pos, &c, 1)) )
+			return -1;
+		++r->pos;
+		if (i + 1 < size) name[i++] = c;
+	} while (c);
+	name[i] = '\0';
+
+	r->pos = (r->pos + 3) & ~3ULL;
+	return 0;
+}
+
+
+/* Copy string property value */
+static void fit_copy_str(char *dst, size_t size, const unsigned char *val,
+		unsigned long len)
+{
+	if (len >= size) len = size - 1;
+	memcpy(dst, val, len);
+	dst[len] = '\0';
+}
+
+
+static kx_fit_image *fit_new_image(kx_fit *fit, const char *name)
+{
+	kx_fit_image *new_list;
+
+	if (fit->image_count >= fit->image_size) {
+		new_list = realloc(fit->images, fit->image_size * 2 * sizeof(*new_list));
+		if (NULL == new_list) {
+			DPRINTF("Can't resize FIT images list");
+			return NULL;
+		}
+		fit->image_size *= 2;
+		fit->images = new_list;
+	}
+
+	memset(fit->images + fit->image_count, 0, sizeof(*new_list));
+	fit_copy_str(fit->images[fit->image_count].name, FIT_NAME_LEN,
+			(const unsigned char *)name, strlen(name));
+	return fit->images + fit->image_count++;
+}
+
+
+static kx_fit_conf *fit_new_conf(kx_fit *fit, const char *name)
+{
+	kx_fit_conf *new_list;
+
+	if (fit->conf_count >= fit->conf_size) {
+		new_list = realloc(fit->confs, fit->conf_size * 2 * sizeof(*new_list));
+		if (NULL == new_list) {
+			DPRINTF("Can't resize FIT configurations list");
+			return NULL;
+		}
+		fit->conf_size *= 2;
+		fit->confs = new_list;
+	}
+
+	memset(fit->confs + fit->conf_count, 0, sizeof(*new_list));
+	fit_copy_str(fit->confs[fit->conf_count].name, FIT_NAME_LEN,
+			(const unsigned char *)name, strlen(name));
+	return fit->confs + fit->conf_count++;
+}
+
+
+int fit_open(const char *path, kx_fit *fit)
+{
+	kx_fdt_reader *r;
+	unsigned char hdr[FDT_HDR_SIZE];
+	unsigned char val[FIT_PROP_MAX];
+	char *strings = NULL;
+	char name[FIT_NAME_LEN];
+	const char *pname;
+	unsigned long tag, len, nameoff, size_strings;
+	unsigned long long data_base, value_off;
+	enum fit_section_t section = FIT_ROOT;
+	kx_fit_image *img = NULL;
+	kx_fit_conf *conf = NULL;
+	int depth = 0, rc = -1;
+	int in_hash = 0, hash_sha256 = 0, hash_len = 0;
+	unsigned char hash[SHA256_DIGEST_SIZE];
+
+	memset(fit, 0, sizeof(*fit));
+	fit->image_size = 4;
+	fit->conf_size = 4;
+	fit->images = malloc(fit->image_size * sizeof(*(fit->images)));
+	fit->confs = malloc(fit->conf_size * sizeof(*(fit->confs)));
+
+	r = malloc(sizeof(*r));
+	if ( (NULL == r) || (NULL == fit->images) || (NULL == fit->confs) ) {
+		DPRINTF("Can't allocate FIT structures");
+		goto free;
+	}
+
+	r->fd = open(path, O_RDONLY);
+	if (-1 == r->fd) {
+		log_msg(lg, "+ can't open FIT %s: %s", path, ERRMSG);
+		goto free;
+	}
+	r->win_off = 0;
+	r->win_len = 0;
+
+	r->end = FDT_HDR_SIZE;
+	if ( (-1 == fdt_read(r, 0, hdr, FDT_HDR_SIZE)) ||
+			(FDT_MAGIC != get_be32(hdr)) )
+	{
+		log_msg(lg, "+ %s is not FIT", path);
+		goto close;
+	}
+
+	fit->fdt_size = get_be32(hdr + 4);
+
+	/* External data is placed after FDT aligned to 4 bytes */
+	data_base = (get_be32(hdr + 4) + 3) & ~3ULL;
+	r->pos = get_be32(hdr + 8);
+	r->end = r->pos + get_be32(hdr + 36);
+
+	/* Strings block is small. Read it at once */
+	size_strings = get_be32(hdr + 32);
+	strings = malloc(size_strings + 1);
+	if ( (NULL == strings) ||
+			(size_strings != pread(r->fd, strings, size_strings, get_be32(hdr + 12))) )
+	{
+		log_msg(lg, "+ can't read FIT strings");
+		goto close;
+	}
+	strings[size_strings] = '\0';
+
+	for (;;) {
+		if (-1 == fdt_read_u32(r, &tag)) goto broken;
+
+		switch (tag) {
+		case FDT_BEGIN_NODE:
+			if (-1 == fdt_read_name(r, name, sizeof(name))) goto broken;
+			++depth;
+			if (1 == depth) continue;	/* root */
+
+			if (2 == depth) {
+				if (!strcmp(name, "images")) section = FIT_IMAGES;
+				else if (!strcmp(name, "configurations")) section = FIT_CONFS;
+				else section = FIT_OTHER;
+			} else if (3 == depth) {
+				if (FIT_IMAGES == section) img = fit_new_image(fit, name);
+				else if (FIT_CONFS == section) conf = fit_new_conf(fit, name);
+			} else if ( img && (4 == depth) && !strncmp(name, "hash", 4) ) {
+				/* hash-1, hash-2, ... nodes of sub-image */
+				in_hash = 1;
+				hash_sha256 = 0;
+				hash_len = 0;
+			}
+			break;
+
+		case FDT_END_NODE:
+			if ( (4 == depth) && in_hash ) {
+				if ( hash_sha256 && (SHA256_DIGEST_SIZE == hash_len) ) {
+					memcpy(img->sha256, hash, SHA256_DIGEST_SIZE);
+					img->has_sha256 = 1;
+				}
+				in_hash = 0;
+			} else if (3 == depth) {
+				img = NULL;
+				conf = NULL;
+			} else if (2 == depth) {
+				section = FIT_ROOT;
+			}
+			if (--depth <= 0) goto done;
+			break;
+
+		case FDT_PROP:
+			if ( (-1 == fdt_read_u32(r, &len)) ||
+					(-1 == fdt_read_u32(r, &nameoff)) ||
+					(nameoff >= size_strings) )
+				goto broken;
+
+			value_off = r->pos;
+			r->pos = (r->pos + len + 3) & ~3ULL;
+			if (r->pos > r->end) goto broken;
+
+			pname = strings + nameoff;
+
+			/* Embedded data is skipped, we remember where it is */
+			if ( img && (3 == depth) && !strcmp(pname, "data") ) {
+				img->offset = value_off;
+				img->size = len;
+				break;
+			}
+
+			if (len > sizeof(val)) break;
+			if ( (len > 0) && (-1 == fdt_read(r, value_off, val, len)) )
+				goto broken;
+
+			if (1 == depth) {
+				if (!strcmp(pname, "description"))
+					fit_copy_str(fit->description, FIT_NAME_LEN, val, len);
+			} else if ( (2 == depth) && (FIT_CONFS == section) ) {
+				if (!strcmp(pname, "default"))
+					fit_copy_str(fit->default_conf, FIT_NAME_LEN, val, len);
+			} else if ( img && (3 == depth) ) {
+				if (!strcmp(pname, "type"))
+					fit_copy_str(img->type, sizeof(img->type), val, len);
+				else if (!strcmp(pname, "compression"))
+					fit_copy_str(img->compression, sizeof(img->compression), val, len);
+				else if ( !strcmp(pname, "data-offset") && (4 == len) )
+					img->offset = data_base + get_be32(val);
+				else if ( !strcmp(pname, "data-position") && (4 == len) )
+					img->offset = get_be32(val);
+				else if ( !strcmp(pname, "data-size") && (4 == len) )
+					img->size = get_be32(val);
+			} else if ( in_hash && (4 == depth) ) {
+				if (!strcmp(pname, "algo"))
+					hash_sha256 = ( (len >= 6) && !strncmp((char *)val, "sha256", len) );
+				else if ( !strcmp(pname, "value") && (SHA256_DIGEST_SIZE == len) ) {
+					memcpy(hash, val, len);
+					hash_len = len;
+				}
+			} else if ( conf && (3 == depth) ) {
+				/* First string of stringlist is taken (base fdt) */
+				if (!strcmp(pname, "description"))
+					fit_copy_str(conf->description, FIT_NAME_LEN, val, len);
+				else if (!strcmp(pname, "kernel"))
+					fit_copy_str(conf->kernel, FIT_NAME_LEN, val, len);
+				else if (!strcmp(pname, "fdt"))
+					fit_copy_str(conf->fdt, FIT_NAME_LEN, val, len);
+				else if (!strcmp(pname, "ramdisk"))
+					fit_copy_str(conf->ramdisk, FIT_NAME_LEN, val, len);
+			}
+			break;
+
+		case FDT_NOP:
+			break;
+
+		case FDT_END:
+			goto done;
+
+		default:
+			goto broken;
+		}
+	}
+
+done:
+	rc = 0;
+	goto close;
+
+broken:
+	log_msg(lg, "+ FIT %s structure is broken", path);
+
+close:
+	close(r->fd);
+free:
+	dispose(strings);
+	dispose(r);
+	if (-1 == rc) fit_close(fit);
+	return rc;
+}
+
+
+void fit_close(kx_fit *fit)
+{
+	dispose(fit->images);
+	dispose(fit->confs);
+	fit->image_count = 0;
+	fit->conf_count = 0;
+}
+
+
+kx_fit_conf *fit_find_conf(kx_fit *fit, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < fit->conf_count; i++) {
+		if (!strcmp(fit->confs[i].name, name)) return fit->confs + i;
+	}
+	return NULL;
+}
+
+
+kx_fit_image *fit_find_image(kx_fit *fit, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < fit->image_count; i++) {
+		if (!strcmp(fit->images[i].name, name)) return fit->images + i;
+	}
+	return NULL;
+}
+
+
+int fit_check_fdt(const char *path, kx_fit *fit, const char *hex)
+{
+	char buf[65536];
+	unsigned char digest[SHA256_DIGEST_SIZE];
+	unsigned long long off, left;
+	kx_sha256 ctx;
+	ssize_t n;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (-1 == fd) {
+		log_msg(lg, "Can't open FIT %s: %s", path, ERRMSG);
+		return -1;
+	}
+
+	sha256_init(&ctx);
+
+	off = 0;
+	left = fit->fdt_size;
+	while (left > 0) {
+		n = pread(fd, buf, (left < sizeof(buf) ? left : sizeof(buf)), off);
+		if ( (-1 == n) && (EINTR == errno) ) continue;
+		if (n <= 0) {
+			log_msg(lg, "Can't read FDT of %s", path);
+			close(fd);
+			return -1;
+		}
+		sha256_update(&ctx, buf, n);
+		off += n;
+		left -= n;
+	}
+	close(fd);
+
+	sha256_final(&ctx, digest);
+	if (0 != sha256_cmp_hex(digest, hex)) {
+		log_msg(lg, "Checksum mismatch for FDT of %s", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int fit_extract(const char *path, kx_fit_image *img, const char *dest)
+{
+	char buf[65536];
+	unsigned char digest[SHA256_DIGEST_SIZE];
+	int fd, dfd = -1, rc = -1;
+	unsigned long long off, left;
+	kx_sha256 ctx;
+	ssize_t n;
+
+	fd = open(path, O_RDONLY);
+	if (-1 == fd) {
+		log_msg(lg, "Can't open FIT %s: %s", path, ERRMSG);
+		return -1;
+	}
+
+	if (dest) {
+		dfd = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+		if (-1 == dfd) {
+			log_msg(lg, "Can't create %s: %s", dest, ERRMSG);
+			goto close;
+		}
+	}
+
+#ifdef POSIX_FADV_WILLNEED
+	posix_fadvise(fd, img->offset, img->size, POSIX_FADV_WILLNEED);
+#endif
+
+	sha256_init(&ctx);
+
+	/* Only byte range of sub-image is read */
+	off = img->offset;
+	left = img->size;
+	while (left > 0) {
+		n = pread(fd, buf, (left < sizeof(buf) ? left : sizeof(buf)), off);
+		if ( (-1 == n) && (EINTR == errno) ) continue;
+		if (n <= 0) {
+			log_msg(lg, "Can't read %s of %s", img->name, path);
+			goto close;
+		}
+		if ( (-1 != dfd) && (n != write(dfd, buf, n)) ) {
+			log_msg(lg, "Can't write %s: %s", dest, ERRMSG);
+			goto close;
+		}
+		if ( (-1 != dfd) && img->has_sha256 )
+			sha256_update(&ctx, buf, n);
+		off += n;
+		left -= n;
+	}
+
+	if ( (-1 != dfd) && img->has_sha256 ) {
+		sha256_final(&ctx, digest);
+		if (memcmp(digest, img->sha256, SHA256_DIGEST_SIZE)) {
+			log_msg(lg, "FIT sub-image %s hash mismatch", img->name);
+			goto close;
+		}
+	}
+	rc = 0;
+
+close:
+	if (-1 != dfd) close(dfd);
+	close(fd);
+	return rc;
+}
@@ -0,0 +1,98 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *
+ *  Copyright (c) 2008-2011 Yuri Bushmelev <jay4mail@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+#ifndef _HAVE_FIT_H_
+#define _HAVE_FIT_H_
+
+#include <sys/types.h>
+
+#include "sha256.h"
+
+/* Max length of FIT node names and strings we keep */
+#define FIT_NAME_LEN	64
+
+/* FIT sub-image (node under /images) */
+typedef struct {
+	char name[FIT_NAME_LEN];
+	char type[16];					/* kernel, flat_dt, ramdisk, ... */
+	char compression[16];			/* none, gzip, ... */
+	unsigned long long offset;		/* Data offset in file */
+	unsigned long long size;		/* Data size (0 - no data) */
+	int has_sha256;					/* sha256 hash node is present */
+	unsigned char sha256[SHA256_DIGEST_SIZE];
+} kx_fit_image;
+
+/* FIT configuration (node under /configurations) */
+typedef struct {
+	char name[FIT_NAME_LEN];
+	char description[FIT_NAME_LEN];
+	char kernel[FIT_NAME_LEN];		/* Sub-image names ("" - none) */
+	char fdt[FIT_NAME_LEN];
+	char ramdisk[FIT_NAME_LEN];
+} kx_fit_conf;
+
+/*
+ * Parsed FIT structure. Only FDT structure block is walked; data of
+ * sub-images (embedded or external) is never read by fit_open(), so
+ * opening multi-hundred-MB container costs a few small reads.
+ */
+typedef struct {
+	char description[FIT_NAME_LEN];
+	char default_conf[FIT_NAME_LEN];
+	unsigned long long fdt_size;	/* FDT blob size with all hash nodes */
+	unsigned int conf_size;		/* Allocated configurations count */
+	unsigned int conf_count;	/* Filled configurations count */
+	kx_fit_conf *confs;
+	unsigned int image_size;	/* Allocated sub-images count */
+	unsigned int image_count;	/* Filled sub-images count */
+	kx_fit_image *images;
+} kx_fit;
+
+/* Parse FIT at path. Return 0 on success, -1 on error */
+int fit_open(const char *path, kx_fit *fit);
+
+/* Free parsed FIT */
+void fit_close(kx_fit *fit);
+
+/* Find configuration or sub-image by name. Return NULL if not found */
+kx_fit_conf *fit_find_conf(kx_fit *fit, const char *name);
+kx_fit_image *fit_find_image(kx_fit *fit, const char *name);
+
+/*
+ * Function: fit_check_fdt()
+ * Compare SHA-256 of FDT blob of FIT at path (first fdt_size bytes of
+ * file) with hex string. Sub-image hash nodes may be trusted after it.
+ * Return value:
+ * - 0 if checksum matches
+ * - -1 on mismatch or error
+ */
+int fit_check_fdt(const char *path, kx_fit *fit, const char *hex);
+
+/*
+ * Function: fit_extract()
+ * Read data of sub-image from FIT file at path. Data written to file
+ * is checked against sha256 hash node of sub-image if there is one.
+ * Args:
+ * - FIT file path
+ * - sub-image
+ * - file to write data to (NULL - just read it to page cache)
+ * Return value:
+ * - 0 on success
+ * - -1 on error or hash mismatch
+ */
+int fit_extract(const char *path, kx_fit_image *img, const char *dest);
+
+#endif //_HAVE_FIT_H_
@@ -16,6 +16,8 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
 #include <endian.h>
 #include <netinet/in.h>
 #include <sys/utsname.h>
@@ -522,10 +524,23 @@ static int f2fs_image(const void *buf, unsigned long long *bytes)
 	return 0;
 }
 
+/* Magic value at fixed offset of block */
+struct fs_magic {
+	unsigned short offset;	/* Offset of magic in block */
+	unsigned short len;	/* Magic width (0 - unused slot) */
+	const void *value;	/* Magic bytes as they are on disk */
+};
+
+#define MAX_MAGICS	4
+
+#define MAGIC_STR(off, str)	{ (off), sizeof(str) - 1, (str) }
+#define MAGIC_INT(off, type, val)	{ (off), sizeof(type), (const type[]){ (val) } }
+
 struct imagetype {
 	off_t block;
 	const char name[12];
 	int (*identify) (const void *, unsigned long long *);
+	struct fs_magic magic[MAX_MAGICS];	/* Any of them selects identify() */
 };
 
 /*
@@ -539,75 +554,571 @@ struct imagetype {
  * is not used before creating the new fs.
  *
  * The same goes for LUKS as for LVM.
+ *
+ * Magics are used only to select candidates. Candidates are checked by
+ * identify() in order of this table so rules above are kept.
  */
 static struct imagetype images[] = {
-	{0, "gzip", gzip_image},
-	{0, "cramfs", cramfs_image},
-	{0, "romfs", romfs_image},
-	{0, "xfs", xfs_image},
-	{0, "squashfs", squashfs_image},
-	{1, "ext4dev", ext4dev_image},
-	{1, "ext4", ext4_image},
-	{1, "ext3", ext3_image},
-	{1, "ext2", ext2_image},
-	{1, "minix", minix_image},
-	{0, "ubi", ubi_image},
-	{0, "jffs2", jffs2_image},
-	{0, "vfat", vfat_image},
-	{1, "nilfs2", nilfs2_image},
-	{1, "f2fs", f2fs_image},
-	{2, "ocfs2", ocfs2_image},
-	{8, "reiserfs", reiserfs_image},
-	{64, "reiserfs", reiserfs_image},
-	{64, "reiser4", reiser4_image},
-	{64, "gfs2", gfs2_image},
-	{64, "btrfs", btrfs_image},
-	{32, "jfs", jfs_image},
-	{32, "iso9660", iso_image},
-	{0, "luks", luks_image},
-	{0, "lvm2", lvm2_image},
-	{1, "lvm2", lvm2_image},
-	{-1, "swap", swap_image},
-	{-1, "suspend", suspend_image},
-	{0, "", NULL}
+	{0, "gzip", gzip_image,
+		{ MAGIC_STR(0, "\037\213"), MAGIC_STR(0, "\037\236") } },
+	{0, "cramfs", cramfs_image,
+		{ MAGIC_INT(offsetof(struct cramfs_super, magic), __u32, CRAMFS_MAGIC) } },
+	{0, "romfs", romfs_image,
+		{ MAGIC_STR(0, "-rom1fs-") } },
+	{0, "xfs", xfs_image,
+		{ MAGIC_STR(0, "XFSB") } },
+	{0, "squashfs", squashfs_image,
+		{ MAGIC_INT(0, __u32, SQUASHFS_MAGIC),
+		  MAGIC_INT(0, __u32, SQUASHFS_MAGIC_SWAP),
+		  MAGIC_INT(0, __u32, SQUASHFS_MAGIC_LZMA),
+		  MAGIC_INT(0, __u32, SQUASHFS_MAGIC_LZMA_SWAP) } },
+	{1, "ext4dev", ext4dev_image,
+		{ MAGIC_INT(offsetof(struct ext2_super_block, s_magic), __u16,
+			    __constant_cpu_to_le16(EXT2_SUPER_MAGIC)) } },
+	{1, "ext4", ext4_image,
+		{ MAGIC_INT(offsetof(struct ext2_super_block, s_magic), __u16,
+			    __constant_cpu_to_le16(EXT2_SUPER_MAGIC)) } },
+	{1, "ext3", ext3_image,
+		{ MAGIC_INT(offsetof(struct ext2_super_block, s_magic), __u16,
+			    __constant_cpu_to_le16(EXT2_SUPER_MAGIC)) } },
+	{1, "ext2", ext2_image,
+		{ MAGIC_INT(offsetof(struct ext2_super_block, s_magic), __u16,
+			    __constant_cpu_to_le16(EXT2_SUPER_MAGIC)) } },
+	{1, "minix", minix_image,
+		{ MAGIC_INT(offsetof(struct minix_super_block, s_magic), __u16,
+			    MINIX_SUPER_MAGIC),
+		  MAGIC_INT(offsetof(struct minix_super_block, s_magic), __u16,
+			    MINIX_SUPER_MAGIC2) } },
+	{0, "ubi", ubi_image,
+		{ MAGIC_STR(0, "UBI#") } },
+	{0, "jffs2", jffs2_image,
+		{ MAGIC_STR(0, "\x85\x19") } },
+	{0, "vfat", vfat_image,
+		{ MAGIC_STR(54, "FAT12   "), MAGIC_STR(54, "FAT16   "),
+		  MAGIC_STR(82, "FAT32   ") } },
+	{1, "nilfs2", nilfs2_image,
+		{ MAGIC_INT(offsetof(struct nilfs_super_block, s_magic), __u16,
+			    __constant_cpu_to_le16(NILFS_SUPER_MAGIC)) } },
+	{1, "f2fs", f2fs_image,
+		{ MAGIC_INT(offsetof(struct f2fs_super_block, magic), __u32,
+			    __constant_cpu_to_le32(F2FS_SUPER_MAGIC)) } },
+	{2, "ocfs2", ocfs2_image,
+		{ MAGIC_STR(offsetof(struct ocfs2_dinode, i_signature),
+			    OCFS2_SUPER_BLOCK_SIGNATURE) } },
+	{8, "reiserfs", reiserfs_image,
+		{ MAGIC_STR(offsetof(struct reiserfs_super_block, s_v1.s_magic),
+			    REISERFS_SUPER_MAGIC_STRING),
+		  MAGIC_STR(offsetof(struct reiserfs_super_block, s_v1.s_magic),
+			    REISER2FS_SUPER_MAGIC_STRING),
+		  MAGIC_STR(offsetof(struct reiserfs_super_block, s_v1.s_magic),
+			    REISER2FS_JR_SUPER_MAGIC_STRING) } },
+	{64, "reiserfs", reiserfs_image,
+		{ MAGIC_STR(offsetof(struct reiserfs_super_block, s_v1.s_magic),
+			    REISERFS_SUPER_MAGIC_STRING),
+		  MAGIC_STR(offsetof(struct reiserfs_super_block, s_v1.s_magic),
+			    REISER2FS_SUPER_MAGIC_STRING),
+		  MAGIC_STR(offsetof(struct reiserfs_super_block, s_v1.s_magic),
+			    REISER2FS_JR_SUPER_MAGIC_STRING) } },
+	{64, "reiser4", reiser4_image,
+		{ MAGIC_STR(offsetof(struct reiser4_master_sb, ms_magic),
+			    REISER4_SUPER_MAGIC_STRING) } },
+	{64, "gfs2", gfs2_image,
+		{ MAGIC_INT(0, __u32, __constant_cpu_to_be32(GFS2_MAGIC)) } },
+	{64, "btrfs", btrfs_image,
+		{ MAGIC_STR(offsetof(struct btrfs_super_block, magic), BTRFS_MAGIC) } },
+	{32, "jfs", jfs_image,
+		{ MAGIC_STR(offsetof(struct jfs_superblock, s_magic), JFS_MAGIC) } },
+	{32, "iso9660", iso_image,
+		{ MAGIC_STR(offsetof(struct iso_volume_descriptor, id), ISO_MAGIC),
+		  MAGIC_STR(offsetof(struct iso_hs_volume_descriptor, id),
+			    ISO_HS_MAGIC) } },
+	{0, "luks", luks_image,
+		{ MAGIC_STR(offsetof(struct luks_partition_header, magic),
+			    LUKS_MAGIC) } },
+	{0, "lvm2", lvm2_image,
+		{ MAGIC_STR(0, LVM2_MAGIC), MAGIC_STR(0x200, LVM2_MAGIC) } },
+	{1, "lvm2", lvm2_image,
+		{ MAGIC_STR(0, LVM2_MAGIC), MAGIC_STR(0x200, LVM2_MAGIC) } },
+	{-1, "swap", swap_image,
+		{ MAGIC_STR(SWAP_RESERVED_L, SWAP_MAGIC_1),
+		  MAGIC_STR(SWAP_RESERVED_L, SWAP_MAGIC_2) } },
+	{-1, "suspend", suspend_image,
+		{ MAGIC_STR(SWAP_RESERVED_L, SUSP_MAGIC_1),
+		  MAGIC_STR(SWAP_RESERVED_L, SUSP_MAGIC_2),
+		  MAGIC_STR(SWAP_RESERVED_L, SUSP_MAGIC_U) } },
+	{0, "", NULL, { { 0, 0, NULL } } }
 };
 
-int identify_fs(int fd, const char **fstype,
-		unsigned long long *bytes, off_t offset)
+/*
+ * Dispatch index: every distinct magic location (block, offset, width)
+ * holds sorted list of magic values found there. Every value carries
+ * bitmask of images[] entries it selects.
+ */
+#define MAX_LOCATIONS	(ARRAY_SIZE(images) * MAX_MAGICS)
+#define MAX_VALUES	8
+
+struct magic_value {
+	const void *value;
+	unsigned long long candidates;	/* Bit N - images[N] */
+};
+
+struct magic_location {
+	off_t block;
+	unsigned short offset;
+	unsigned short len;
+	unsigned int count;
+	struct magic_value values[MAX_VALUES];
+};
+
+static struct magic_location locations[MAX_LOCATIONS];
+static unsigned int nlocations;
+static unsigned long long always_candidates;	/* Entries without magics */
+static int index_ready;
+
+static int magic_location_cmp(const void *a, const void *b)
 {
-	uint64_t buf[BLOCK_SIZE >> 3];	/* 64-bit worst case alignment */
-	off_t cur_block = (off_t) - 1;
-	struct imagetype *ip;
-	int ret;
-	unsigned long long dummy;
+	const struct magic_location *la = a, *lb = b;
+
+	/* Group locations by block to keep reads sequential */
+	if (la->block != lb->block)
+		return (la->block < lb->block ? -1 : 1);
+	if (la->offset != lb->offset)
+		return la->offset - lb->offset;
+	return la->len - lb->len;
+}
 
-	if (!bytes)
-		bytes = &dummy;
+static int magic_value_len;
 
-	*fstype = NULL;
-	*bytes = 0;
+static int magic_value_cmp(const void *a, const void *b)
+{
+	return memcmp(((const struct magic_value *)a)->value,
+		      ((const struct magic_value *)b)->value, magic_value_len);
+}
 
-	for (ip = images; ip->identify; ip++) {
+/* Add magic of images[n] into index */
+static int index_add_magic(int n, struct imagetype *ip, struct fs_magic *m)
+{
+	struct magic_location *loc;
+	unsigned int i;
+
+	if (m->offset + m->len > BLOCK_SIZE)
+		return -1;
+
+	for (i = 0; i < nlocations; i++) {
+		loc = &locations[i];
+		if (loc->block == ip->block && loc->offset == m->offset &&
+		    loc->len == m->len)
+			break;
+	}
+
+	if (i == nlocations) {
+		loc = &locations[nlocations++];
+		loc->block = ip->block;
+		loc->offset = m->offset;
+		loc->len = m->len;
+		loc->count = 0;
+	}
+
+	for (i = 0; i < loc->count; i++) {
+		if (!memcmp(loc->values[i].value, m->value, m->len)) {
+			loc->values[i].candidates |= 1ULL << n;
+			return 0;
+		}
+	}
+
+	if (loc->count >= MAX_VALUES)
+		return -1;
+
+	loc->values[loc->count].value = m->value;
+	loc->values[loc->count].candidates = 1ULL << n;
+	++loc->count;
+	return 0;
+}
+
+static void build_index(void)
+{
+	struct imagetype *ip;
+	struct fs_magic *m;
+	unsigned int i;
+	int n;
+
+	for (n = 0, ip = images; ip->identify; n++, ip++) {
 		/* Hack for swap, which apparently is dependent on page size */
 		if (ip->block == -1)
 			ip->block = SWAP_OFFSET();
 
-		if (cur_block != ip->block) {
-			/*
-			 * Read block.
-			 */
-			cur_block = ip->block;
-			ret = pread(fd, buf, BLOCK_SIZE,
-				    offset + cur_block * BLOCK_SIZE);
-			if (ret != BLOCK_SIZE)
-				return -1;	/* error */
+		if (!ip->magic[0].len)
+			always_candidates |= 1ULL << n;
+
+		for (m = ip->magic; m < ip->magic + MAX_MAGICS && m->len; m++) {
+			/* Can't index it - just check it every time */
+			if (index_add_magic(n, ip, m) < 0)
+				always_candidates |= 1ULL << n;
 		}
+	}
+
+	qsort(locations, nlocations, sizeof(*locations), magic_location_cmp);
+	for (i = 0; i < nlocations; i++) {
+		magic_value_len = locations[i].len;
+		qsort(locations[i].values, locations[i].count,
+		      sizeof(*locations[i].values), magic_value_cmp);
+	}
+
+	index_ready = 1;
+}
+
+/* Binary search of magic found at 'p' in location values */
+static unsigned long long lookup_magic(struct magic_location *loc,
+				       const char *p)
+{
+	int lo = 0, hi = loc->count - 1, mid, ret;
+
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		ret = memcmp(p, loc->values[mid].value, loc->len);
+		if (ret == 0)
+			return loc->values[mid].candidates;
+		if (ret < 0)
+			hi = mid - 1;
+		else
+			lo = mid + 1;
+	}
+	return 0;
+}
+
+/*
+ * Take UUID and last write time of filesystem from its superblock.
+ * Only filesystems which change that data on every write are supported.
+ */
+static void fingerprint_fs(const char *fstype, const void *buf,
+			   struct fs_fingerprint *fp)
+{
+	memset(fp, 0, sizeof(*fp));
+
+	if (!strncmp(fstype, "ext", 3)) {
+		const struct ext2_super_block *sb =
+		    (const struct ext2_super_block *)buf;
+
+		memcpy(fp->uuid, sb->s_uuid, sizeof(fp->uuid));
+		fp->wtime = (unsigned long long)__le32_to_cpu(sb->s_wtime) << 32
+		    | __le32_to_cpu(sb->s_mtime);
+		fp->valid = 1;
+	} else if (!strcmp(fstype, "btrfs")) {
+		const struct btrfs_super_block *sb =
+		    (const struct btrfs_super_block *)buf;
+
+		memcpy(fp->uuid, sb->fsid, sizeof(fp->uuid));
+		fp->wtime = __le64_to_cpu(sb->generation);
+		fp->valid = 1;
+	} else if (!strcmp(fstype, "squashfs")) {
+		const struct squashfs_super_block *sb =
+		    (const struct squashfs_super_block *)buf;
+
+		/* Read-only image: creation time and size are enough */
+		memcpy(fp->uuid, &sb->bytes_used, sizeof(sb->bytes_used));
+		fp->wtime = sb->mkfs_time;
+		fp->valid = 1;
+	}
+}
+
+/* Copy fixed size label which may be not NULL-terminated */
+static void copy_label(char *dst, const char *src, size_t len)
+{
+	if (len > FS_LABEL_SIZE - 1)
+		len = FS_LABEL_SIZE - 1;
+	memcpy(dst, src, len);
+	dst[len] = 0;
+}
+
+#define SET_UUID(res, src)	do { \
+		memcpy((res)->uuid, (src), sizeof((res)->uuid)); \
+		(res)->has_uuid = 1; \
+	} while (0)
+
+/* Take UUID and label where superblock structures expose them */
+static void get_fs_id(const char *fstype, const void *buf,
+		      struct fs_probe_result *res)
+{
+	res->has_uuid = 0;
+	res->label[0] = 0;
+
+	if (!strncmp(fstype, "ext", 3)) {
+		const struct ext2_super_block *sb = buf;
+
+		SET_UUID(res, sb->s_uuid);
+		copy_label(res->label, sb->s_volume_name,
+			   sizeof(sb->s_volume_name));
+	} else if (!strcmp(fstype, "btrfs")) {
+		const struct btrfs_super_block *sb = buf;
+
+		SET_UUID(res, sb->fsid);
+		copy_label(res->label, (const char *)sb->label,
+			   sizeof(sb->label));
+	} else if (!strcmp(fstype, "reiserfs")) {
+		const struct reiserfs_super_block *sb = buf;
+
+		SET_UUID(res, sb->s_uuid);
+		copy_label(res->label, (const char *)sb->s_label,
+			   sizeof(sb->s_label));
+	} else if (!strcmp(fstype, "reiser4")) {
+		const struct reiser4_master_sb *sb = buf;
+
+		SET_UUID(res, sb->ms_uuid);
+		copy_label(res->label, sb->ms_label, sizeof(sb->ms_label));
+	} else if (!strcmp(fstype, "nilfs2")) {
+		const struct nilfs_super_block *sb = buf;
+
+		SET_UUID(res, sb->s_uuid);
+		copy_label(res->label, sb->s_volume_name,
+			   sizeof(sb->s_volume_name));
+	} else if (!strcmp(fstype, "jfs")) {
+		const struct jfs_superblock *sb = buf;
+
+		SET_UUID(res, sb->s_uuid);
+		copy_label(res->label, sb->s_label, sizeof(sb->s_label));
+	} else if (!strcmp(fstype, "f2fs")) {
+		const struct f2fs_super_block *sb = buf;
+
+		SET_UUID(res, sb->uuid);
+	}
+}
+
+int identify_fs(int fd, const char **fstype,
+		unsigned long long *bytes, off_t offset)
+{
+	struct fs_probe_result res;
+	int ret;
+
+	ret = identify_fs_result(fd, offset, &res);
+	*fstype = res.fstype;
+	if (bytes)
+		*bytes = res.bytes;
+	return ret;
+}
 
-		if (ip->identify(buf, bytes)) {
-			*fstype = ip->name;
+/*
+ * All superblocks we know about live in the first 65 KiB of device, so
+ * read that area once and run every probe against it. Blocks outside of
+ * the area (swap on huge pages) are read separately.
+ */
+#define PROBE_BLOCKS	65
+#define PROBE_SIZE	(PROBE_BLOCKS * BLOCK_SIZE)
+
+static struct fs_probe_stats probe_stats;
+
+/* Read up to 'len' bytes at 'offset'. Return count of bytes read */
+static ssize_t probe_read(int fd, void *buf, size_t len, off_t offset)
+{
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < len) {
+		ret = pread(fd, (char *)buf + done, len - done, offset + done);
+		++probe_stats.reads;
+		if (ret < 0)
+			return done ? (ssize_t)done : -1;	/* use what we have */
+		if (ret == 0)
+			break;	/* Device is smaller than probe area */
+		done += ret;
+		probe_stats.bytes += ret;
+	}
+	return done;
+}
+
+/* Superblock area of device being probed */
+struct probe_area {
+	int fd;
+	off_t offset;			/* Offset of filesystem on device */
+	ssize_t len;			/* Bytes in area */
+	uint64_t area[PROBE_SIZE >> 3];	/* 64-bit worst case alignment */
+	off_t extra_block;		/* Block in 'extra' (-1 - none) */
+	uint64_t extra[BLOCK_SIZE >> 3];
+};
+
+/* Return pointer to block data or NULL if block can't be read */
+static const void *probe_block(struct probe_area *pa, off_t block)
+{
+	if (block < PROBE_BLOCKS) {
+		if ((block + 1) * BLOCK_SIZE > pa->len)
+			return NULL;	/* device is too small */
+		return (const char *)pa->area + block * BLOCK_SIZE;
+	}
+
+	if (pa->extra_block != block) {
+		if (probe_read(pa->fd, pa->extra, BLOCK_SIZE,
+			       pa->offset + block * BLOCK_SIZE) != BLOCK_SIZE)
+			return NULL;
+		pa->extra_block = block;
+	}
+	return pa->extra;
+}
+
+/* Account reads which block-by-block walk up to images[last] would issue */
+static void account_legacy_reads(int last)
+{
+	off_t cur_block = (off_t) - 1;
+	int n;
+
+	for (n = 0; images[n].identify && n <= last; n++) {
+		if (cur_block != images[n].block) {
+			cur_block = images[n].block;
+			++probe_stats.legacy_reads;
+			probe_stats.legacy_bytes += BLOCK_SIZE;
+		}
+	}
+}
+
+int identify_fs_result(int fd, off_t offset, struct fs_probe_result *res)
+{
+	static struct probe_area pa;
+	struct magic_location *loc;
+	unsigned long long candidates;
+	struct imagetype *ip;
+	const void *buf;
+	unsigned int i;
+	int n, missing = 0;
+
+	memset(res, 0, sizeof(*res));
+
+	if (!index_ready)
+		build_index();
+
+	pa.fd = fd;
+	pa.offset = offset;
+	pa.extra_block = -1;
+	pa.len = probe_read(fd, pa.area, PROBE_SIZE, offset);
+	if (pa.len < 0)
+		return -1;	/* error */
+
+	/* One lookup per magic location selects candidates */
+	candidates = always_candidates;
+	for (i = 0; i < nlocations; i++) {
+		loc = &locations[i];
+		buf = probe_block(&pa, loc->block);
+		if (!buf) {
+			missing = 1;
+			continue;
+		}
+		++probe_stats.lookups;
+		candidates |= lookup_magic(loc, (const char *)buf + loc->offset);
+	}
+
+	/* Check candidates in table order */
+	for (n = 0, ip = images; ip->identify; n++, ip++) {
+		if (!(candidates & (1ULL << n)))
+			continue;
+
+		buf = probe_block(&pa, ip->block);
+		if (!buf)
+			continue;
+
+		++probe_stats.probes;
+		if (ip->identify(buf, &res->bytes)) {
+			res->fstype = ip->name;
+			fingerprint_fs(ip->name, buf, &res->fp);
+			get_fs_id(ip->name, buf, res);
+			account_legacy_reads(n);
 			return 0;
 		}
 	}
 
-	return 1;		/* Unknown filesystem */
+	account_legacy_reads(ARRAY_SIZE(images));
+
+	/* Some superblock was not read - can't be sure it is unknown */
+	return missing ? -1 : 1;
+}
+
+void fstype_get_stats(struct fs_probe_stats *stats)
+{
+	*stats = probe_stats;
+}
+
+struct fs_cache_entry {
+	dev_t dev;			/* Device number */
+	unsigned long long size;	/* Device size when it was probed */
+	struct fs_probe_result res;
+};
+
+static struct fs_cache_entry *fs_cache;
+static unsigned int fs_cache_size, fs_cache_count;
+
+static struct fs_cache_entry *fs_cache_find(dev_t dev)
+{
+	unsigned int i;
+
+	for (i = 0; i < fs_cache_count; i++) {
+		if (fs_cache[i].dev == dev)
+			return &fs_cache[i];
+	}
+	return NULL;
+}
+
+int fstype_cache_get(dev_t dev, unsigned long long size,
+		struct fs_probe_result *res)
+{
+	struct fs_cache_entry *e;
+
+	e = fs_cache_find(dev);
+	if (!e)
+		return -1;
+
+	/* Media was changed */
+	if (e->size != size) {
+		fstype_cache_invalidate(dev);
+		return -1;
+	}
+
+	*res = e->res;
+	return 0;
+}
+
+void fstype_cache_put(dev_t dev, unsigned long long size,
+		const struct fs_probe_result *res)
+{
+	struct fs_cache_entry *e;
+
+	e = fs_cache_find(dev);
+	if (!e) {
+		if (fs_cache_count >= fs_cache_size) {
+			unsigned int new_size = fs_cache_size ? fs_cache_size * 2 : 8;
+			struct fs_cache_entry *new_cache;
+
+			new_cache = realloc(fs_cache, new_size * sizeof(*fs_cache));
+			if (!new_cache)
+				return;	/* It is just cache */
+			fs_cache = new_cache;
+			fs_cache_size = new_size;
+		}
+		e = &fs_cache[fs_cache_count++];
+	}
+
+	e->dev = dev;
+	e->size = size;
+	e->res = *res;
+}
+
+void fstype_cache_invalidate(dev_t dev)
+{
+	struct fs_cache_entry *e;
+
+	e = fs_cache_find(dev);
+	if (!e)
+		return;
+
+	*e = fs_cache[--fs_cache_count];
+}
+
+const char *fstype_lookup(const char *name)
+{
+	struct imagetype *ip;
+
+	if (!name)
+		return NULL;
+
+	for (ip = images; ip->identify; ip++) {
+		if (!strcmp(ip->name, name))
+			return ip->name;
+	}
+
+	return NULL;
 }
@@ -13,8 +13,56 @@
 #define FSTYPE_H
 
 #include <unistd.h>
+#include <sys/types.h>
+
+/* Filesystem identity used to detect changes between boots */
+struct fs_fingerprint {
+	int valid;			/* Filesystem provides fingerprint */
+	unsigned char uuid[16];		/* Filesystem UUID */
+	unsigned long long wtime;	/* Last write time or generation */
+};
+
+#define FS_LABEL_SIZE	64
+
+/* Everything known about filesystem after probe */
+struct fs_probe_result {
+	const char *fstype;		/* Static FS name (NULL - unknown) */
+	unsigned long long bytes;	/* FS size (if known) */
+	struct fs_fingerprint fp;	/* Superblock fingerprint */
+	int has_uuid;			/* UUID is known */
+	unsigned char uuid[16];		/* Filesystem UUID */
+	char label[FS_LABEL_SIZE];	/* Volume label ("" - none) */
+};
 
 int identify_fs(int fd, const char **fstype,
 		unsigned long long *bytes, off_t offset);
 
+/* Same as identify_fs() but also take fingerprint, UUID and label */
+int identify_fs_result(int fd, off_t offset, struct fs_probe_result *res);
+
+/*
+ * Probe results cache of this boot session. Entries are keyed by device
+ * number and dropped when device size is changed or on invalidation.
+ */
+int fstype_cache_get(dev_t dev, unsigned long long size,
+		struct fs_probe_result *res);
+void fstype_cache_put(dev_t dev, unsigned long long size,
+		const struct fs_probe_result *res);
+void fstype_cache_invalidate(dev_t dev);
+
+/* I/O done by identify_fs() calls in this process */
+struct fs_probe_stats {
+	unsigned int reads;		/* pread() calls issued */
+	unsigned long long bytes;	/* Bytes read */
+	unsigned int lookups;		/* Magic locations checked */
+	unsigned int probes;		/* identify() functions called */
+	unsigned int legacy_reads;	/* Reads block-by-block probing would issue */
+	unsigned long long legacy_bytes;	/* Bytes it would read */
+};
+
+void fstype_get_stats(struct fs_probe_stats *stats);
+
+/* Return static fstype name equal to 'name' or NULL if it is unknown */
+const char *fstype_lookup(const char *name);
+
 #endif
@@ -25,6 +25,7 @@
 
 #include "fb.h"
 #include "gui.h"
+#include "trace.h"
 
 #ifdef USE_ICONS
 #include "xpm.h"
@@ -79,7 +80,7 @@ void draw_background_low(struct gui_t *gui)
 struct gui_t *gui_init(int angle)
 {
 	struct gui_t *gui;
-	int ret;
+	int ret, tr;
 	gui = malloc(sizeof(*gui));
 	if (NULL == gui) {
 		DPRINTF("Can't allocate memory for GUI structure");
@@ -87,7 +88,9 @@ struct gui_t *gui_init(int angle)
 	}
 
 	/* init framebuffer */
+	tr = trace_begin("fb_new", NULL);
 	ret = fb_new(angle);
+	trace_end(tr);
 
 	if (-1 == ret) {
 		log_msg(lg, "Can't initialize framebuffer");
@@ -95,6 +98,9 @@ struct gui_t *gui_init(int angle)
 		return NULL;
 	}
 
+	gui->scanning = 0;
+	gui->shown_ml = NULL;
+
 	/* Tune GUI size */
 #ifdef USE_FBUI_WIDTH
 	if (fb.width > USE_FBUI_WIDTH)
@@ -114,12 +120,15 @@ struct gui_t *gui_init(int angle)
 	gui->y = (fb.height - gui->height)/2;
 
 #ifdef USE_ICONS
+	enum icon_id_t i;
+
 	/* Parse compiled images.
 	 * We don't care about result because drawing code is aware
 	 */
 
 	gui->icons = malloc(sizeof(*(gui->icons)) * ICON_ARRAY_SIZE);
 
+	tr = trace_begin("xpm_icons", NULL);
 	gui->icons[ICON_LOGO] = xpm_parse_image(logo_xpm, ROWS(logo_xpm));
 	gui->icons[ICON_STORAGE] = xpm_parse_image(storage_xpm, ROWS(storage_xpm));
 	gui->icons[ICON_MMC] = xpm_parse_image(mmc_xpm, ROWS(mmc_xpm));
@@ -131,6 +140,11 @@ struct gui_t *gui_init(int angle)
 	gui->icons[ICON_REBOOT] = xpm_parse_image(reboot_xpm, ROWS(reboot_xpm));
 	gui->icons[ICON_SHUTDOWN] = xpm_parse_image(shutdown_xpm, ROWS(shutdown_xpm));
 	gui->icons[ICON_EXIT] = xpm_parse_image(exit_xpm, ROWS(exit_xpm));
+
+	/* Convert them to framebuffer format now to not do it on first draw */
+	for (i = ICON_LOGO; i < ICON_ARRAY_SIZE; i++)
+		fb_prepare_picture(gui->icons[i]);
+	trace_end(tr);
 #endif
 
 #ifdef USE_BG_BUFFER
@@ -164,6 +178,7 @@ void gui_destroy(struct gui_t *gui)
 
 /* Clear screen */
 void gui_clear(struct gui_t *gui) {
+	gui->shown_ml = NULL;
 	fb_draw_rect(0, 0, fb.width, fb.height, CLR_BG);
 	fb_render();
 }
@@ -293,6 +308,16 @@ void draw_slot(struct gui_t *gui, kx_menu_item *item, int slot, int height,
 }
 
 
+/* Restore menu area background under slot */
+static void clear_slot(struct gui_t *gui, int slot, int height)
+{
+	/* Same shape as selection frame so frame corners are kept intact */
+	fb_draw_rounded_rect(gui->x + LYT_MNI_LEFT,
+			gui->y + LYT_MENU_AREA_TOP + LYT_MNI_HEIGHT * (slot-1),
+			LYT_MNI_WIDTH, height, CLR_MENU_BG);
+}
+
+
 /* Display bootlist menu with selection */
 void gui_show_menu(struct gui_t *gui, kx_menu *menu)
 {
@@ -308,24 +333,53 @@ void gui_show_menu(struct gui_t *gui, kx_menu *menu)
 
 	ml = menu->current;			/* active menu level */
 	cur_no = ml->current_no;	/* active menu item index */
-	
+
+	if(cur_no < firstslot)
+		firstslot = cur_no;
+	if(cur_no > firstslot + slots -1)
+		firstslot = cur_no - (slots -1);
+
+	if ( (gui->shown_ml == ml) && (gui->shown_changes == ml->changes) &&
+			(gui->shown_first == firstslot) &&
+			(gui->shown_scanning == gui->scanning) )
+	{
+		/* Only selection is moved. Redraw previous and new current slots */
+		if (gui->shown_cur != cur_no) {
+			i = gui->shown_cur - firstslot + 1;
+			clear_slot(gui, i, slotheight);
+			draw_slot(gui, ml->list[gui->shown_cur], i, slotheight, 0);
+
+			i = cur_no - firstslot + 1;
+			clear_slot(gui, i, slotheight);
+			draw_slot(gui, ml->list[cur_no], i, slotheight, 1);
+
+			gui->shown_cur = cur_no;
+		}
+		fb_render();
+		return;
+	}
+
 	/* FIXME: shouldn't be done here */
-	if (1 == ml->count) {
+	if ( (1 == ml->count) && gui->scanning ) {
+		/* Boot items are not found yet */
+		draw_background(gui, "Scanning devices.\nPlease wait...");
+	} else if (1 == ml->count) {
 		/* Only system menu in list */
 		draw_background(gui, "No boot devices found\nR: Reboot S: Rescan");
 	} else {
 		draw_background(gui, "KEXECBOOT");
 	}
 
-	if(cur_no < firstslot)
-		firstslot = cur_no;
-	if(cur_no > firstslot + slots -1)
-		firstslot = cur_no - (slots -1);
-
 	for(i=1, j=firstslot; i <= slots && j< ml->count; i++, j++) {
 		draw_slot(gui, ml->list[j], i, slotheight, j == cur_no);
 	}
 
+	gui->shown_ml = ml;
+	gui->shown_changes = ml->changes;
+	gui->shown_first = firstslot;
+	gui->shown_cur = cur_no;
+	gui->shown_scanning = gui->scanning;
+
 	fb_render();
 }
 
@@ -337,6 +391,7 @@ void gui_show_text(struct gui_t *gui, kx_text *text)
 	int i, y;
 	int max_x, max_y;
 
+	gui->shown_ml = NULL;
 	draw_background(gui, "KEXECBOOT");
 
 	/* No text to show */
@@ -364,6 +419,7 @@ void gui_show_msg(struct gui_t *gui, const char *text)
 {
 	if (!gui) return;
 
+	gui->shown_ml = NULL;
 	draw_background(gui, text);
 	fb_render();
 }
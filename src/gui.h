@@ -48,6 +48,12 @@ enum icon_id_t {
 struct gui_t {
 	int x,y;
 	int height, width;
+	int scanning;		/* Devices scan is in progress */
+
+	/* Menu state on screen. Only changed slots are redrawn when it matches */
+	kx_menu_level *shown_ml;	/* NULL - screen shows something else */
+	unsigned int shown_changes;
+	int shown_first, shown_cur, shown_scanning;
 #ifdef USE_BG_BUFFER
 	char *bg_buffer;
 #endif
@@ -0,0 +1,159 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *
+ *  Copyright (c) 2008-2011 Yuri Bushmelev <jay4mail@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sendfile.h>
+
+#include "config.h"
+#include "util.h"
+#include "initrd.h"
+
+/* copy_file_range() may refuse to copy between filesystems */
+#ifdef __NR_copy_file_range
+static int use_copy_range = 1;
+#endif
+
+
+struct charlist *initrd_split(const char *initrd)
+{
+	struct charlist *parts;
+	char *str, *p, *word;
+
+	parts = create_charlist(4);
+	if (!initrd) return parts;
+
+	str = strdup(initrd);
+	if (!str) return parts;
+
+	p = str;
+	for (;;) {
+		while (isspace(*p)) ++p;
+		if ('\0' == *p) break;
+
+		word = p;
+		while ( (*p) && !isspace(*p) ) ++p;
+		if (*p) *p++ = '\0';
+
+		addto_charlist(parts, word);
+	}
+
+	free(str);
+	return parts;
+}
+
+
+/* Append file to 'out' in kernel. Return bytes copied or -1 on error */
+static long long copy_fragment(int out, const char *path)
+{
+	struct stat st;
+	long long copied = 0;
+	ssize_t n;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (-1 == fd) {
+		log_msg(lg, "Can't open initrd fragment %s: %s", path, ERRMSG);
+		return -1;
+	}
+
+	if (-1 == fstat(fd, &st)) {
+		log_msg(lg, "Can't stat initrd fragment %s: %s", path, ERRMSG);
+		close(fd);
+		return -1;
+	}
+
+	while (copied < st.st_size) {
+#ifdef __NR_copy_file_range
+		if (use_copy_range) {
+			n = syscall(__NR_copy_file_range, fd, NULL, out, NULL,
+					(size_t)(st.st_size - copied), 0);
+			if ( (-1 == n) && ((EXDEV == errno) || (ENOSYS == errno) ||
+					(EINVAL == errno) || (EOPNOTSUPP == errno)) )
+			{
+				/* Both use file offsets so sendfile() continues here */
+				use_copy_range = 0;
+				continue;
+			}
+		} else
+#endif
+		n = sendfile(out, fd, NULL, (size_t)(st.st_size - copied));
+
+		if (-1 == n) {
+			if (EINTR == errno) continue;
+			log_msg(lg, "Can't copy initrd fragment %s: %s", path, ERRMSG);
+			close(fd);
+			return -1;
+		}
+		if (0 == n) break;	/* File is truncated meanwhile */
+
+		copied += n;
+	}
+
+	close(fd);
+	return copied;
+}
+
+
+int initrd_assemble(struct charlist *parts, char *path, size_t size)
+{
+	int i, out = -1;
+	long long n, total = 0;
+	unsigned long long start, us;
+
+	start = get_monotonic_us();
+
+#ifdef __NR_memfd_create
+	/* No MFD_CLOEXEC: kexec binary opens it as /proc/self/fd/N */
+	out = syscall(__NR_memfd_create, "initrd", 0);
+	if (-1 != out)
+		snprintf(path, size, "/proc/self/fd/%d", out);
+#endif
+	if (-1 == out) {
+		out = open(INITRD_ASSEMBLY_PATH, O_RDWR | O_CREAT | O_TRUNC, 0600);
+		if (-1 == out) {
+			log_msg(lg, "Can't create %s: %s", INITRD_ASSEMBLY_PATH, ERRMSG);
+			return -1;
+		}
+		snprintf(path, size, "%s", INITRD_ASSEMBLY_PATH);
+	}
+
+	for (i = 0; i < parts->fill; i++) {
+		n = copy_fragment(out, parts->list[i]);
+		if (-1 == n) {
+			close(out);
+			return -1;
+		}
+		total += n;
+	}
+
+	us = get_monotonic_us() - start;
+	if (0 == us) us = 1;
+	log_msg(lg, "Assembled initrd of %d fragments: %lluKb in %llums (%llu.%02lluMB/s)",
+			parts->fill, (unsigned long long)total >> 10, us / 1000,
+			(unsigned long long)total / us,
+			((unsigned long long)total * 100 / us) % 100);
+
+	return out;
+}
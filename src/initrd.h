@@ -0,0 +1,46 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *
+ *  Copyright (c) 2008-2011 Yuri Bushmelev <jay4mail@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+#ifndef _HAVE_INITRD_H_
+#define _HAVE_INITRD_H_
+
+#include <stddef.h>
+
+#include "config.h"
+#include "util.h"
+#include "cfgparser.h"
+
+/* File to assemble initrd in when memfd is not available (tmpfs) */
+#define INITRD_ASSEMBLY_PATH	PROBE_MOUNTROOT "/initrd"
+
+/*
+ * INITRD= may list several cpio fragments separated by white-space.
+ * Kernel unpacks concatenated cpio archives one by one, so fragments are
+ * joined into one initrd before loading.
+ */
+
+/* Split initrd list into fragments. Result should be free_charlist()'ed */
+struct charlist *initrd_split(const char *initrd);
+
+/*
+ * Join fragments into anonymous memory file without reading them into
+ * user space. Path to pass to loader is placed into 'path'. Returned
+ * descriptor should be kept open until kernel is loaded.
+ * Return file descriptor or -1 on error.
+ */
+int initrd_assemble(struct charlist *parts, char *path, size_t size);
+
+#endif //_HAVE_INITRD_H_
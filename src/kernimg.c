@@ -0,0 +1,367 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *
+ *  Copyright (c) 2008-2011 Yuri Bushmelev <jay4mail@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "util.h"
+#include "kernimg.h"
+
+/* ARM zImage: magic and start/end of image at fixed offsets (LE) */
+#define ZIMAGE_MAGIC		0x016F2818
+#define ZIMAGE_MAGIC_OFF	0x24
+#define ZIMAGE_START_OFF	0x28
+#define ZIMAGE_END_OFF		0x2C
+
+/* U-Boot legacy image header (BE), see u-boot include/image.h */
+#define UIMAGE_MAGIC		0x27051956
+#define UIMAGE_HDR_SIZE		64
+#define UIMAGE_HCRC_OFF		4
+#define UIMAGE_SIZE_OFF		12
+#define UIMAGE_LOAD_OFF		16
+#define UIMAGE_COMP_OFF		31
+#define UIMAGE_NAME_OFF		32
+#define UIMAGE_NAME_LEN		32
+
+/* arm64 Image header (LE), see Documentation/arm64/booting.rst */
+#define IMAGE_MAGIC			"ARM\x64"
+#define IMAGE_MAGIC_OFF		0x38
+#define IMAGE_TEXT_OFF		0x08
+#define IMAGE_SIZE_OFF		0x10
+
+/* x86 boot protocol header (LE), see Documentation/x86/boot.rst */
+#define BZIMAGE_MAGIC		"HdrS"
+#define BZIMAGE_MAGIC_OFF	0x202
+#define BZIMAGE_SETUP_SECTS	0x1F1
+#define BZIMAGE_SYSSIZE		0x1F4
+#define BZIMAGE_VERSION		0x206
+#define BZIMAGE_KVER_OFF	0x20E
+#define BZIMAGE_PAYLOAD_OFF	0x248
+#define BZIMAGE_PREF_ADDR	0x258
+
+/* Flattened device tree header (BE) */
+#define FDT_MAGIC			0xD00DFEED
+#define FDT_TOTALSIZE_OFF	4
+#define FDT_STRUCT_OFF		8
+#define FDT_STRINGS_OFF		12
+#define FDT_BEGIN_NODE		1
+#define FDT_END_NODE		2
+#define FDT_PROP			3
+#define FDT_NOP				4
+
+/* uImage ih_comp values */
+static const char *uimage_comp[] = {
+	"none", "gzip", "bzip2", "lzma", "lzo", "lz4", "zstd"
+};
+
+/* Compressed payload signatures. Weak ones are checked at known offsets only */
+struct comp_magic_t {
+	const char *name;
+	const char *magic;
+	int len;
+	int weak;
+};
+
+static const struct comp_magic_t comp_magic[] = {
+	{ "gzip",  "\x1f\x8b\x08", 3, 0 },
+	{ "xz",    "\xfd\x37\x7a\x58\x5a\x00", 6, 0 },
+	{ "lz4",   "\x02\x21\x4c\x18", 4, 0 },
+	{ "lzo",   "\x89\x4c\x5a\x4f", 4, 0 },
+	{ "zstd",  "\x28\xb5\x2f\xfd", 4, 0 },
+	{ "bzip2", "BZh", 3, 1 },
+	{ "lzma",  "\x5d\x00\x00", 3, 1 },
+	{ NULL, NULL, 0, 0 }
+};
+
+
+static unsigned long get_le32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static unsigned long long get_le64(const unsigned char *p)
+{
+	return get_le32(p) | ((unsigned long long)get_le32(p + 4) << 32);
+}
+
+static unsigned long get_be32(const unsigned char *p)
+{
+	return ((unsigned long)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+
+/* CRC-32 (IEEE 802.3) as used by U-Boot */
+static unsigned long crc32(const unsigned char *p, size_t len)
+{
+	unsigned long crc = 0xFFFFFFFF;
+	int k;
+
+	while (len--) {
+		crc ^= *p++;
+		for (k = 0; k < 8; k++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+	return crc ^ 0xFFFFFFFF;
+}
+
+
+/* Detect compression of data at p. Weak signatures are used if 'exact' */
+static const char *detect_comp(const unsigned char *p, size_t len, int exact)
+{
+	const struct comp_magic_t *cm;
+
+	for (cm = comp_magic; cm->name; cm++) {
+		if (cm->weak && !exact) continue;
+		if ( (len >= cm->len) && !memcmp(p, cm->magic, cm->len) )
+			return cm->name;
+	}
+	return NULL;
+}
+
+
+/* Look for compressed payload in header block (zImage decompressor is small) */
+static const char *scan_comp(const unsigned char *p, size_t len)
+{
+	const char *comp;
+	size_t i;
+
+	for (i = 0; i < len; i += 4) {	/* payload is word-aligned */
+		comp = detect_comp(p + i, len - i, 0);
+		if (comp) return comp;
+	}
+	return NULL;
+}
+
+
+/* Copy printable part of string */
+static void copy_str(char *dst, size_t size, const unsigned char *src, size_t len)
+{
+	size_t i;
+
+	for (i = 0; (i < len) && (i + 1 < size) && src[i]; i++)
+		dst[i] = (isprint(src[i]) ? src[i] : '?');
+	dst[i] = '\0';
+}
+
+
+static int inspect_uimage(const unsigned char *hdr, size_t len,
+		struct kernimg_t *ki)
+{
+	unsigned char h[UIMAGE_HDR_SIZE];
+	unsigned int comp;
+
+	if (len < UIMAGE_HDR_SIZE) return -1;
+
+	/* Header CRC is calculated with CRC field zeroed */
+	memcpy(h, hdr, UIMAGE_HDR_SIZE);
+	memset(h + UIMAGE_HCRC_OFF, 0, 4);
+	if (crc32(h, UIMAGE_HDR_SIZE) != get_be32(hdr + UIMAGE_HCRC_OFF)) {
+		log_msg(lg, "+ uImage header CRC mismatch");
+		return -1;
+	}
+
+	ki->type = KIMG_UIMAGE;
+	ki->size = UIMAGE_HDR_SIZE + get_be32(hdr + UIMAGE_SIZE_OFF);
+	ki->load_addr = get_be32(hdr + UIMAGE_LOAD_OFF);
+	comp = hdr[UIMAGE_COMP_OFF];
+	if (comp < sizeof(uimage_comp) / sizeof(*uimage_comp))
+		ki->comp = uimage_comp[comp];
+	copy_str(ki->version, sizeof(ki->version),
+			hdr + UIMAGE_NAME_OFF, UIMAGE_NAME_LEN);
+	return 0;
+}
+
+
+static int inspect_bzimage(int fd, const unsigned char *hdr, size_t len,
+		struct kernimg_t *ki)
+{
+	unsigned char magic[8];
+	unsigned long setup, off;
+	unsigned int proto;
+
+	setup = hdr[BZIMAGE_SETUP_SECTS];
+	if (0 == setup) setup = 4;
+	setup = (setup + 1) * 512;
+	proto = hdr[BZIMAGE_VERSION] | (hdr[BZIMAGE_VERSION + 1] << 8);
+
+	ki->type = KIMG_BZIMAGE;
+	ki->size = setup + get_le32(hdr + BZIMAGE_SYSSIZE) * 16ULL;
+
+	/* Pointer to version string is relative to 0x200 */
+	off = hdr[BZIMAGE_KVER_OFF] | (hdr[BZIMAGE_KVER_OFF + 1] << 8);
+	if ( (off > 0) && (0x200 + off < len) )
+		copy_str(ki->version, sizeof(ki->version),
+				hdr + 0x200 + off, len - 0x200 - off);
+
+	if (proto >= 0x020a)
+		ki->load_addr = get_le64(hdr + BZIMAGE_PREF_ADDR);
+
+	/* Payload is placed after decompressor (protocol 2.08+) */
+	if (proto >= 0x0208) {
+		off = setup + get_le32(hdr + BZIMAGE_PAYLOAD_OFF);
+		if (sizeof(magic) == pread(fd, magic, sizeof(magic), off))
+			ki->comp = detect_comp(magic, sizeof(magic), 1);
+	}
+	return 0;
+}
+
+
+/* Take FIT description from root node properties */
+static int inspect_fit(int fd, const unsigned char *hdr, size_t len,
+		struct kernimg_t *ki)
+{
+	static const char desc[] = "description";
+	char name[sizeof(desc)];
+	unsigned long p, strings, tag, plen, nameoff;
+	int depth = 0;
+
+	ki->type = KIMG_FIT;
+	ki->size = get_be32(hdr + FDT_TOTALSIZE_OFF);
+
+	p = get_be32(hdr + FDT_STRUCT_OFF);
+	strings = get_be32(hdr + FDT_STRINGS_OFF);
+
+	while (p + 4 <= len) {
+		tag = get_be32(hdr + p);
+		p += 4;
+		switch (tag) {
+		case FDT_BEGIN_NODE:
+			/* Root properties are before subnodes */
+			if (++depth > 1) return 0;
+			while ( (p < len) && hdr[p] ) ++p;
+			p = (p + 4) & ~3UL;
+			break;
+		case FDT_PROP:
+			if (p + 8 > len) return 0;
+			plen = get_be32(hdr + p);
+			nameoff = get_be32(hdr + p + 4);
+			p += 8;
+			/* Strings block is placed after (big) structure block */
+			if ( (p + plen <= len) &&
+					(sizeof(name) == pread(fd, name, sizeof(name), strings + nameoff)) &&
+					!memcmp(name, desc, sizeof(desc)) )
+			{
+				copy_str(ki->version, sizeof(ki->version), hdr + p, plen);
+				return 0;
+			}
+			p = (p + plen + 3) & ~3UL;
+			break;
+		case FDT_NOP:
+			break;
+		default:
+			return 0;
+		}
+	}
+	return 0;
+}
+
+
+int kernimg_inspect(const char *path, struct kernimg_t *ki)
+{
+	unsigned char hdr[KERNIMG_HDR_SIZE];
+	struct stat st;
+	ssize_t len;
+	int fd, rc = 0;
+
+	memset(ki, 0, sizeof(*ki));
+
+	fd = open(path, O_RDONLY);
+	if (-1 == fd) {
+		log_msg(lg, "+ can't open kernel %s: %s", path, ERRMSG);
+		return -1;
+	}
+
+	if ( (-1 == fstat(fd, &st)) ||
+			((len = read(fd, hdr, sizeof(hdr))) <= 0) )
+	{
+		log_msg(lg, "+ can't read kernel %s", path);
+		close(fd);
+		return -1;
+	}
+	ki->size = st.st_size;
+
+	if ( (len >= ZIMAGE_END_OFF + 4) &&
+			(ZIMAGE_MAGIC == get_le32(hdr + ZIMAGE_MAGIC_OFF)) )
+	{
+		ki->type = KIMG_ZIMAGE;
+		ki->size = get_le32(hdr + ZIMAGE_END_OFF) - get_le32(hdr + ZIMAGE_START_OFF);
+		ki->comp = scan_comp(hdr, len);
+	}
+	else if ( (len >= 4) && (UIMAGE_MAGIC == get_be32(hdr)) )
+		rc = inspect_uimage(hdr, len, ki);
+	else if ( (len >= IMAGE_MAGIC_OFF + 4) &&
+			!memcmp(hdr + IMAGE_MAGIC_OFF, IMAGE_MAGIC, 4) )
+	{
+		ki->type = KIMG_IMAGE;
+		ki->load_addr = get_le64(hdr + IMAGE_TEXT_OFF);
+		if (get_le64(hdr + IMAGE_SIZE_OFF))	/* 0 in old kernels */
+			ki->size = get_le64(hdr + IMAGE_SIZE_OFF);
+		ki->comp = "none";
+	}
+	else if ( (len >= BZIMAGE_PREF_ADDR + 8) &&
+			!memcmp(hdr + BZIMAGE_MAGIC_OFF, BZIMAGE_MAGIC, 4) )
+		rc = inspect_bzimage(fd, hdr, len, ki);
+	else if ( (len >= 16) && (FDT_MAGIC == get_be32(hdr)) )
+		rc = inspect_fit(fd, hdr, len, ki);
+
+	close(fd);
+
+	/* arm64 image_size includes bss which isn't stored in file */
+	if ( (0 == rc) && (KIMG_IMAGE != ki->type) && (ki->size > st.st_size) ) {
+		log_msg(lg, "+ kernel %s is truncated (%llu of %llu bytes)",
+				path, (unsigned long long)st.st_size, ki->size);
+		rc = -1;
+	}
+
+	return rc;
+}
+
+
+const char *kernimg_type_name(enum kernimg_type_t type)
+{
+	switch (type) {
+	case KIMG_ZIMAGE:	return "zImage";
+	case KIMG_UIMAGE:	return "uImage";
+	case KIMG_IMAGE:	return "Image";
+	case KIMG_BZIMAGE:	return "bzImage";
+	case KIMG_FIT:		return "FIT";
+	default:			return "kernel";
+	}
+}
+
+
+char *kernimg_describe(struct kernimg_t *ki, char *buf, size_t size)
+{
+	int n;
+
+	n = snprintf(buf, size, "%s %lluKb", kernimg_type_name(ki->type),
+			ki->size >> 10);
+	if ( (ki->comp) && (n < size) )
+		n += snprintf(buf + n, size - n, " %s", ki->comp);
+	if ( (ki->load_addr) && (n < size) )
+		n += snprintf(buf + n, size - n, " @0x%llx", ki->load_addr);
+	if ( (ki->version[0]) && (n < size) )
+		snprintf(buf + n, size - n, " %s", ki->version);
+
+	return buf;
+}
@@ -0,0 +1,62 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *
+ *  Copyright (c) 2008-2011 Yuri Bushmelev <jay4mail@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+#ifndef _HAVE_KERNIMG_H_
+#define _HAVE_KERNIMG_H_
+
+#include <sys/types.h>
+
+/* Bytes of image read to inspect it */
+#define KERNIMG_HDR_SIZE	16384
+
+enum kernimg_type_t {
+	KIMG_UNKNOWN,
+	KIMG_ZIMAGE,	/* ARM self-decompressing zImage */
+	KIMG_UIMAGE,	/* U-Boot legacy image */
+	KIMG_IMAGE,		/* arm64 Image */
+	KIMG_BZIMAGE,	/* x86 bzImage */
+	KIMG_FIT		/* Flattened image tree */
+};
+
+/* Facts about kernel image taken from its header */
+struct kernimg_t {
+	enum kernimg_type_t type;
+	unsigned long long size;		/* Image size (file size if not in header) */
+	unsigned long long load_addr;	/* Load address (0 - not specified) */
+	const char *comp;				/* Payload compression (NULL - unknown) */
+	char version[64];				/* Version or image name ("" - unknown) */
+};
+
+/*
+ * Function: kernimg_inspect()
+ * Read header of kernel image and fill image info. Unknown formats are
+ * accepted as is since kexec may know them better (e.g. ELF vmlinux).
+ * Args:
+ * - path to image
+ * - image info to fill
+ * Return value:
+ * - 0 if image looks fine
+ * - -1 if image is missing, truncated or header is corrupted
+ */
+int kernimg_inspect(const char *path, struct kernimg_t *ki);
+
+/* Short image format name */
+const char *kernimg_type_name(enum kernimg_type_t type);
+
+/* Format one-line human readable image description into buf */
+char *kernimg_describe(struct kernimg_t *ki, char *buf, size_t size);
+
+#endif //_HAVE_KERNIMG_H_
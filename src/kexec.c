@@ -0,0 +1,143 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *
+ *  Copyright (c) 2008-2011 Yuri Bushmelev <jay4mail@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+#include "config.h"
+
+#ifdef USE_NATIVE_KEXEC
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/reboot.h>
+#include <net/if.h>
+#include <linux/reboot.h>
+
+#include "util.h"
+#include "kexec.h"
+
+/* From linux/kexec.h */
+#ifndef KEXEC_FILE_NO_INITRAMFS
+#define KEXEC_FILE_NO_INITRAMFS	0x00000004
+#endif
+
+int kexec_file_load_kernel(const char *kernel, const char *initrd,
+		const char *cmdline)
+{
+#ifdef __NR_kexec_file_load
+	int kfd, ifd = -1;
+	unsigned long flags = 0;
+	long rc;
+
+	if (!cmdline) cmdline = "";
+
+	kfd = open(kernel, O_RDONLY);
+	if (-1 == kfd) {
+		log_msg(lg, "Can't open kernel %s: %s", kernel, ERRMSG);
+		return -1;
+	}
+
+	if (initrd) {
+		ifd = open(initrd, O_RDONLY);
+		if (-1 == ifd) {
+			log_msg(lg, "Can't open initrd %s: %s", initrd, ERRMSG);
+			close(kfd);
+			return -1;
+		}
+	} else {
+		flags |= KEXEC_FILE_NO_INITRAMFS;
+	}
+
+	/* Length should include terminating NUL */
+	rc = syscall(__NR_kexec_file_load, kfd, ifd,
+			strlen(cmdline) + 1, cmdline, flags);
+	if (-1 == rc)
+		log_msg(lg, "kexec_file_load failed: %s", ERRMSG);
+
+	if (-1 != ifd) close(ifd);
+	close(kfd);
+
+	return (-1 == rc ? -1 : 0);
+#else
+	log_msg(lg, "kexec_file_load is not supported on this architecture");
+	return -1;
+#endif
+}
+
+
+/* Bring all network interfaces down like kexec-tools ifdown() does */
+static void kexec_ifdown(void)
+{
+	DIR *dp;
+	struct dirent *de;
+	struct ifreq ifr;
+	int sock;
+
+	dp = opendir("/sys/class/net");
+	if (!dp) {
+		log_msg(lg, "Can't open /sys/class/net: %s", ERRMSG);
+		return;
+	}
+
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (-1 == sock) {
+		log_msg(lg, "Can't create socket: %s", ERRMSG);
+		closedir(dp);
+		return;
+	}
+
+	while ( (de = readdir(dp)) ) {
+		if ('.' == de->d_name[0]) continue;
+		if (strlen(de->d_name) >= IFNAMSIZ) continue;
+
+		memset(&ifr, 0, sizeof(ifr));
+		strcpy(ifr.ifr_name, de->d_name);
+
+		if (-1 == ioctl(sock, SIOCGIFFLAGS, &ifr)) continue;
+		if (!(ifr.ifr_flags & IFF_UP)) continue;
+
+		ifr.ifr_flags &= ~IFF_UP;
+		if (-1 == ioctl(sock, SIOCSIFFLAGS, &ifr))
+			log_msg(lg, "Can't bring %s down: %s", ifr.ifr_name, ERRMSG);
+	}
+
+	close(sock);
+	closedir(dp);
+}
+
+
+int kexec_reboot(void)
+{
+	struct stat sinfo;
+
+	/* Same as 'kexec -e': shut network down unless there is none (-x) */
+	if (0 == stat("/proc/sys/net", &sinfo))
+		kexec_ifdown();
+
+	/* Flush buffers and jump to staged kernel */
+	sync();
+	reboot(LINUX_REBOOT_CMD_KEXEC);
+
+	log_msg(lg, "Can't boot staged kernel: %s", ERRMSG);
+	return -1;
+}
+
+#endif	/* USE_NATIVE_KEXEC */
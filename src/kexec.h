@@ -0,0 +1,39 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *
+ *  Copyright (c) 2008-2011 Yuri Bushmelev <jay4mail@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+#ifndef _HAVE_KEXEC_H_
+#define _HAVE_KEXEC_H_
+
+#include "config.h"
+
+/*
+ * Function: kexec_file_load_kernel()
+ * Load kernel with kexec_file_load syscall without kexec binary.
+ * Args:
+ * - kernel image path
+ * - initrd path (NULL - none)
+ * - kernel command line (NULL - empty)
+ * Return value:
+ * - 0 on success (kernel is staged, use kexec_reboot() to boot it)
+ * - -1 on error (syscall is not available or image is rejected)
+ */
+int kexec_file_load_kernel(const char *kernel, const char *initrd,
+		const char *cmdline);
+
+/* Bring network down (if any) and boot staged kernel. Returns only on error */
+int kexec_reboot(void);
+
+#endif //_HAVE_KEXEC_H_
@@ -27,16 +27,29 @@
 #include <sys/mount.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/reboot.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <limits.h>
+#include <sys/sysmacros.h>
 
 #include "config.h"
 #include "util.h"
 #include "cfgparser.h"
 #include "devicescan.h"
+#include "scanpool.h"
+#include "uevent.h"
 #include "evdevs.h"
 #include "menu.h"
+#include "trace.h"
+#include "kexec.h"
+#include "stage.h"
+#include "mountcache.h"
+#include "fit.h"
+#include "dtbindex.h"
+#include "initrd.h"
+#include "sha256.h"
 #include "kexecboot.h"
 
 #ifdef USE_FBMENU
@@ -57,6 +70,13 @@
 #define MAX_LOAD_ARGV_NR	(12 + 1)
 #define MAX_EXEC_ARGV_NR	(3 + 1)
 #define MAX_ARG_LEN		256
+#define MAX_DEV_LEN		64
+
+/* Sub-images of chosen FIT configuration are extracted here (tmpfs) */
+#define FIT_EXTRACT_DIR	PROBE_MOUNTROOT "/fit"
+
+/* Period of /proc/partitions polling while watching for late devices (ms) */
+#define WATCH_POLL_INTERVAL	250
 
 /* NULL-terminated array of kernel search paths
  * First item should be filled with machine-dependent path */
@@ -87,6 +107,25 @@ struct params_t {
 	struct bootconf_t *bootcfg;
 	kx_menu *menu;
 	kx_context context;
+	kx_inputs *inputs;
+	kx_scanpool scan;	/* Devices probing pool */
+	int scanning;		/* Devices scan is in progress */
+	struct charlist *fslist;
+	kx_bootcache *cache;	/* Boot items cache (NULL - disabled) */
+	int uevent_fd;		/* Hotplug events socket (-1 - none) */
+	int next_order;		/* Order of next queued device */
+	int scan_trace;		/* Trace span of running scan */
+#ifdef USE_PRESTAGE
+	kx_stage stage;		/* Speculatively staged boot item */
+#endif
+#ifdef USE_KEEP_MOUNTED
+	kx_mountcache mounts;	/* Devices left mounted by scan */
+#endif
+	unsigned long long watch_deadline;	/* Stop watching for late devices (0 - not watching) */
+	struct charlist *partitions;	/* Partitions known to scan (incremental rescan) */
+	int mounted;		/* Boot device is left mounted by verify_item() */
+	char *waitdev;		/* Expected device (NULL - none) */
+	int waitdev_found;	/* Expected device is present */
 #ifdef USE_FBMENU
 	struct gui_t *gui;
 #endif
@@ -148,6 +187,23 @@ static void add_cmd_option(char **load_argv,
 	load_argv[(*idx)++] = arg;
 }
 
+/*
+ * Get UBI volume to mount for item on ubi container (remembered since
+ * scan). Return UBI device number or -1 if MTD is not attached.
+ */
+static int ubi_item_dev(struct boot_item_t *item, char *mount_dev,
+		size_t size, char *str_mtd_id)
+{
+	int u;
+
+	/* mtd id [0-15] - one or two digits */
+	snprintf(str_mtd_id, 3, "%d", ubi_mtd_num(item->device));
+
+	u = find_attached_ubi_device(str_mtd_id);
+	ubi_volume_dev(mount_dev, size, u);
+	return u;
+}
+
 /*
  * Add extra tags if UBI device is found.
  *
@@ -163,31 +219,17 @@ static int check_for_ubi(struct boot_item_t *item,
 			  char *str_mtd_id,
 			  const char *str_ubimtd_off)
 {
-	int u;
-
 	if (!strncmp(item->fstype,"ubi",3)) {
 
-		/* mtd id [0-15] - one or two digits */
-		if(isdigit(atoi(item->device+strlen(item->device)-2))) {
-			strcpy(str_mtd_id, item->device+strlen(item->device)-2);
-			strcat(str_mtd_id, item->device+strlen(item->device)-1);
-		} else {
-			strcpy(str_mtd_id, item->device+strlen(item->device)-1);
-		}
 		/* get corresponding ubi dev to mount */
-		u = find_attached_ubi_device(str_mtd_id);
-
-		sprintf(mount_dev, "/dev/ubi%d", u);
-		/* FIXME: first volume is hardcoded */
-		strcat(mount_dev, "_0");
+		ubi_item_dev(item, mount_dev, MAX_DEV_LEN, str_mtd_id);
 
 		/* HARDCODED: we assume it's ubifs */
 		strcpy(mount_fstype,"ubifs");
 
 		/* extra cmdline tags when we detect ubi */
 		strcat(cmdline_arg, str_ubirootdev);
-		/* FIXME: first volume is hardcoded */
-		strcat(cmdline_arg, "_0");
+		strcat(cmdline_arg, UBI_VOLUME_SUFFIX);
 
 		strcat(cmdline_arg, str_ubimtd);
 		strcat(cmdline_arg, str_mtd_id);
@@ -201,13 +243,395 @@ static int check_for_ubi(struct boot_item_t *item,
 }
 
 
+/* Max count of files to prefetch (kernel, initrd, dtb) */
+#define PREFETCH_MAX	3
+
+/*
+ * Prime page cache with boot files. Readahead of all files is started
+ * at once so media works on them in parallel, then every file is read
+ * through to wait for it and measure throughput.
+ */
+static void prefetch_files(const char **paths, int count)
+{
+	char buf[65536];
+	int i, fd[PREFETCH_MAX];
+#ifdef POSIX_FADV_WILLNEED
+	struct stat st;
+#endif
+	ssize_t n;
+	unsigned long long size, start, us;
+
+	if (count > PREFETCH_MAX) count = PREFETCH_MAX;
+
+	for (i = 0; i < count; i++) {
+		fd[i] = -1;
+		if (!paths[i]) continue;
+
+		fd[i] = open(paths[i], O_RDONLY);
+		if (-1 == fd[i]) continue;
+
+#ifdef POSIX_FADV_WILLNEED
+		if (0 == fstat(fd[i], &st))
+			posix_fadvise(fd[i], 0, st.st_size, POSIX_FADV_WILLNEED);
+#endif
+	}
+
+	for (i = 0; i < count; i++) {
+		if (-1 == fd[i]) continue;
+
+		size = 0;
+		start = get_monotonic_us();
+		do {
+			n = read(fd[i], buf, sizeof(buf));
+			if (n > 0) size += n;
+		} while ( (n > 0) || ((-1 == n) && (EINTR == errno)) );
+		us = get_monotonic_us() - start;
+		close(fd[i]);
+
+		if (0 == us) us = 1;
+		log_msg(lg, "Prefetched %s: %lluKb in %llums (%llu.%02lluMB/s)",
+				paths[i], size >> 10, us / 1000,
+				size / us, (size * 100 / us) % 100);
+	}
+}
+
+
+/*
+ * Move mount of item's device left by scan to MOUNTPOINT.
+ * Return 0 if boot device is mounted there now, -1 otherwise.
+ */
+static int take_mount(struct params_t *params, struct boot_item_t *item)
+{
+	if (params->mounted) return 0;
+
+#ifdef USE_KEEP_MOUNTED
+	if (0 == mountcache_take(&params->mounts, item->device, MOUNTPOINT)) {
+		log_msg(lg, "Reusing mount of %s", item->device);
+		params->mounted = 1;
+		return 0;
+	}
+#endif
+	return -1;
+}
+
+
+/*
+ * Read file through and add it to SHA-256 context. This read also
+ * primes page cache, so loader doesn't touch media again.
+ * Return 0 on success, -1 on error.
+ */
+static int hash_file(kx_sha256 *ctx, const char *path)
+{
+	char buf[65536];
+	int fd;
+#ifdef POSIX_FADV_WILLNEED
+	struct stat st;
+#endif
+	ssize_t n;
+	unsigned long long size, t, read_us, hash_us;
+
+	fd = open(path, O_RDONLY);
+	if (-1 == fd) {
+		log_msg(lg, "Can't open %s: %s", path, ERRMSG);
+		return -1;
+	}
+
+#ifdef POSIX_FADV_WILLNEED
+	if (0 == fstat(fd, &st))
+		posix_fadvise(fd, 0, st.st_size, POSIX_FADV_WILLNEED);
+#endif
+
+	size = read_us = hash_us = 0;
+	for (;;) {
+		t = get_monotonic_us();
+		n = read(fd, buf, sizeof(buf));
+		read_us += get_monotonic_us() - t;
+		if ( (-1 == n) && (EINTR == errno) ) continue;
+		if (n <= 0) break;
+
+		t = get_monotonic_us();
+		sha256_update(ctx, buf, n);
+		hash_us += get_monotonic_us() - t;
+		size += n;
+	}
+	close(fd);
+
+	if (-1 == n) {
+		log_msg(lg, "Can't read %s: %s", path, ERRMSG);
+		return -1;
+	}
+
+	if (0 == read_us) read_us = 1;
+	if (0 == hash_us) hash_us = 1;
+	log_msg(lg, "Hashed %s: %lluKb, read %llu.%02lluMB/s, sha256 %llu.%02lluMB/s",
+			path, size >> 10,
+			size / read_us, (size * 100 / read_us) % 100,
+			size / hash_us, (size * 100 / hash_us) % 100);
+
+	return 0;
+}
+
+/*
+ * Hash files as one stream and compare digest with 'hex'.
+ * Return 0 if checksum matches, -1 on mismatch or error.
+ */
+static int check_files(struct charlist *paths, const char *hex)
+{
+	unsigned char digest[SHA256_DIGEST_SIZE];
+	kx_sha256 ctx;
+	int i;
+
+	sha256_init(&ctx);
+	for (i = 0; i < paths->fill; i++) {
+		if (-1 == hash_file(&ctx, paths->list[i])) return -1;
+	}
+	sha256_final(&ctx, digest);
+
+	if (0 != sha256_cmp_hex(digest, hex)) {
+		log_msg(lg, "Checksum mismatch for %s%s", paths->list[0],
+				(paths->fill > 1 ? " and following fragments" : ""));
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Check FIT of item against configured checksums. CHECKSUM is of FDT blob
+ * which holds hash nodes of all sub-images, so these may be trusted after
+ * it. INITRD_CHECKSUM is compared with hash node of configuration ramdisk
+ * if there is one ('ramdisk' is set then). Return 0 if FIT is fine.
+ */
+static int check_fit(struct boot_item_t *item, kx_fit *fit, int *ramdisk)
+{
+	kx_fit_conf *conf;
+	kx_fit_image *img;
+
+	*ramdisk = 0;
+	conf = fit_find_conf(fit, item->fitconf);
+	if (!conf) {
+		log_msg(lg, "FIT configuration %s is not found", item->fitconf);
+		return -1;
+	}
+
+	if ( item->checksum &&
+			(-1 == fit_check_fdt(item->kernelpath, fit, item->checksum)) )
+		return -1;
+
+	if ( !conf->ramdisk[0] || !item->initrd_checksum ) return 0;
+
+	*ramdisk = 1;
+	img = fit_find_image(fit, conf->ramdisk);
+	if ( (!img) || (!img->has_sha256) ) {
+		log_msg(lg, "FIT ramdisk %s has no sha256 hash to check INITRD_CHECKSUM",
+				conf->ramdisk);
+		return -1;
+	}
+
+	/* Extracted data is checked against this hash node */
+	if (0 != sha256_cmp_hex(img->sha256, item->initrd_checksum)) {
+		log_msg(lg, "Checksum mismatch for FIT ramdisk %s", conf->ramdisk);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Check kernel and initrd of chosen item against configured checksums.
+ * Boot device is left mounted on success to boot from page cache.
+ * Return 0 if item may be booted, -1 otherwise.
+ */
+static int verify_item(struct params_t *params, int choice)
+{
+	struct boot_item_t *item;
+	struct charlist *files;
+	kx_fit fit;
+	char mount_dev[MAX_DEV_LEN];
+	char str_mtd_id[3];
+	const char *dev, *fstype;
+	int rc, tr, fit_ramdisk = 0;
+
+	item = params->bootcfg->list[choice];
+	if (!item->checksum && !item->initrd_checksum) return 0;
+
+#ifdef USE_FBMENU
+	gui_show_msg(params->gui, "Verifying...");
+#endif
+#ifdef USE_TEXTUI
+	tui_show_msg(params->tui, "Verifying...");
+#endif
+
+	if (-1 == take_mount(params, item)) {
+		if (!item->device) {
+			log_msg(lg, "Can't verify checksums of %s", item->label);
+			return -1;
+		}
+
+		dev = item->device;
+		fstype = item->fstype;
+		if ( fstype && !strncmp(fstype, "ubi", 3) ) {
+			/* Same volume as start_kernel() mounts */
+			if (-1 == ubi_item_dev(item, mount_dev, sizeof(mount_dev),
+					str_mtd_id))
+			{
+				log_msg(lg, "Can't find UBI device on %s", item->device);
+				return -1;
+			}
+			dev = mount_dev;
+			fstype = "ubifs";	/* HARDCODED as in check_for_ubi() */
+		}
+
+		if (-1 == mount(dev, MOUNTPOINT, fstype, MS_RDONLY, NULL)) {
+			log_msg(lg, "Can't mount %s: %s", dev, ERRMSG);
+			return -1;
+		}
+		params->mounted = 1;
+	}
+
+	tr = trace_begin("verify", item->kernelpath);
+	rc = 0;
+	if (item->fitconf) {
+		/* Sub-images are checked by their hash nodes on extraction */
+		rc = fit_open(item->kernelpath, &fit);
+		if (0 == rc) {
+			rc = check_fit(item, &fit, &fit_ramdisk);
+			fit_close(&fit);
+		}
+	} else if (item->checksum) {
+		files = create_charlist(2);
+		addto_charlist(files, item->kernelpath);
+		rc = check_files(files, item->checksum);
+		free_charlist(files);
+	}
+	if ( (0 == rc) && item->initrd_checksum && !fit_ramdisk ) {
+		if (!item->initrd) {
+			log_msg(lg, "INITRD_CHECKSUM is set without INITRD");
+			rc = -1;
+		} else {
+			/* Checksum is of assembled initrd */
+			files = initrd_split(item->initrd);
+			rc = check_files(files, item->initrd_checksum);
+			free_charlist(files);
+		}
+	}
+	trace_end(tr);
+
+	if (-1 == rc) {
+		log_msg(lg, "Refusing to boot %s", item->label);
+		umount(MOUNTPOINT);
+		params->mounted = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Extract one FIT sub-image to FIT_EXTRACT_DIR. Sub-image without sha256
+ * hash node is refused when 'verify' is set. Return new path or NULL
+ */
+static char *extract_fit_image(const char *path, kx_fit *fit,
+		const char *name, const char *file, int verify)
+{
+	kx_fit_image *img;
+	char dest[PATH_MAX];
+
+	img = fit_find_image(fit, name);
+	if ( (!img) || (0 == img->size) ) {
+		log_msg(lg, "FIT sub-image %s has no data", name);
+		return NULL;
+	}
+
+	if ( verify && !img->has_sha256 ) {
+		log_msg(lg, "FIT sub-image %s has no sha256 hash to verify", name);
+		return NULL;
+	}
+
+	snprintf(dest, sizeof(dest), "%s/%s", FIT_EXTRACT_DIR, file);
+	if (-1 == fit_extract(path, img, dest)) return NULL;
+
+	log_msg(lg, "Extracted %s (%lluKb) from FIT", name, img->size >> 10);
+	return strdup(dest);
+}
+
+/*
+ * Copy kernel, fdt and ramdisk of chosen FIT configuration to tmpfs and
+ * point item to them. Only byte ranges of these sub-images are read.
+ * DTB and INITRD from boot.cfg are used if configuration has none.
+ * Checksums are checked again here as FIT is parsed anew. Sub-images
+ * without sha256 hash node are refused when their hash is needed.
+ */
+static int extract_fit(struct boot_item_t *item)
+{
+	kx_fit fit;
+	kx_fit_conf *conf;
+	char *kernel = NULL, *fdt = NULL, *ramdisk = NULL;
+	int verify, fit_ramdisk, rc = -1;
+
+	if (-1 == fit_open(item->kernelpath, &fit)) return -1;
+
+	/* Hash nodes are trusted below only after FDT checksum matched */
+	if (-1 == check_fit(item, &fit, &fit_ramdisk)) goto close;
+	conf = fit_find_conf(&fit, item->fitconf);
+
+	if (-1 == mkdir_parents(FIT_EXTRACT_DIR, 0700)) {
+		log_msg(lg, "Can't create %s: %s", FIT_EXTRACT_DIR, ERRMSG);
+		goto close;
+	}
+
+	verify = (NULL != item->checksum);
+	kernel = extract_fit_image(item->kernelpath, &fit, conf->kernel,
+			"kernel", verify);
+	if (!kernel) goto close;
+
+	if (conf->fdt[0]) {
+		fdt = extract_fit_image(item->kernelpath, &fit, conf->fdt, "fdt", verify);
+		if (!fdt) goto close;
+		dispose(item->dtbpath);
+		item->dtbpath = fdt;
+	}
+
+	if (conf->ramdisk[0]) {
+		ramdisk = extract_fit_image(item->kernelpath, &fit, conf->ramdisk,
+				"ramdisk", (verify || fit_ramdisk));
+		if (!ramdisk) goto close;
+		dispose(item->initrd);
+		item->initrd = ramdisk;
+	}
+
+	free(item->kernelpath);
+	item->kernelpath = kernel;
+	kernel = NULL;
+	rc = 0;
+
+close:
+	dispose(kernel);
+	fit_close(&fit);
+	return rc;
+}
+
+
+#ifdef USE_TRACE
+/* Write boot timeline to file from cmdline or configured one */
+static void save_trace(struct params_t *params)
+{
+	trace_save(params->cfg->tracepath ? params->cfg->tracepath : TRACE_PATH);
+}
+#endif
+
+
 void start_kernel(struct params_t *params, int choice)
 {
-	int n, idx, u;
+	int n, idx, u, tr;
 	struct stat sinfo;
 	struct boot_item_t *item;
+	const char *files[PREFETCH_MAX];
+	struct charlist *parts;
+	char initrd_path[PATH_MAX];
 
-	char mount_dev[16];
+	char mount_dev[MAX_DEV_LEN];
 	char mount_fstype[16];
 	char str_mtd_id[3];
 
@@ -356,6 +780,53 @@ void start_kernel(struct params_t *params, int choice)
 		}
 	}
 
+	/* Mount boot device unless it is mounted already */
+	if (-1 == take_mount(params, item)) {
+		tr = trace_begin("mount", mount_dev);
+		if ( -1 == mount(mount_dev, mount_point, mount_fstype,
+				MS_RDONLY, NULL) ) {
+			perror("Can't mount boot device");
+			exit(-1);
+		}
+		trace_end(tr);
+	}
+
+	if (item->fitconf) {
+		/* Boot files are read from FIT and placed to tmpfs */
+		tr = trace_begin("extract_fit", item->fitconf);
+		if (-1 == extract_fit(item)) {
+			log_msg(lg, "Can't extract FIT configuration %s", item->fitconf);
+			exit(-1);
+		}
+		trace_end(tr);
+	}
+
+	/* Join initrd fragments in memory. Descriptor is kept till exec */
+	parts = initrd_split(item->initrd);
+	if (parts->fill > 1) {
+		tr = trace_begin("initrd_assemble", item->initrd);
+		if (-1 == initrd_assemble(parts, initrd_path, sizeof(initrd_path))) {
+			log_msg(lg, "Can't assemble initrd of %s", item->label);
+			exit(-1);
+		}
+		trace_end(tr);
+		free(item->initrd);
+		item->initrd = strdup(initrd_path);
+	}
+
+	if (!item->fitconf) {
+		/* Read boot files at once instead of small chunks by loader.
+		 * Verified and assembled files are in memory already */
+		files[0] = (item->checksum ? NULL : item->kernelpath);
+		files[1] = ( (item->initrd_checksum || (parts->fill > 1)) ?
+				NULL : item->initrd );
+		files[2] = item->dtbpath;
+		tr = trace_begin("prefetch", item->kernelpath);
+		prefetch_files(files, PREFETCH_MAX);
+		trace_end(tr);
+	}
+	free_charlist(parts);
+
 	add_cmd_option(load_argv, "--dtb=", item->dtbpath, &idx);
 	add_cmd_option(load_argv, "--initrd=", item->initrd, &idx);
 	add_cmd_option(load_argv, NULL, item->kernelpath, &idx);
@@ -364,366 +835,688 @@ void start_kernel(struct params_t *params, int choice)
 		DPRINTF("load_argv[%d]: %s", u, load_argv[u]);
 	}
 
-	/* Mount boot device */
-	if ( -1 == mount(mount_dev, mount_point, mount_fstype,
-			MS_RDONLY, NULL) ) {
-		perror("Can't mount boot device");
-		exit(-1);
+#if defined(USE_NATIVE_KEXEC) && !defined(USE_HOST_DEBUG) && !defined(USE_HARDBOOT)
+	/* Stage kernel without kexec binary. DTB can't be passed this way */
+	if (!item->dtbpath) {
+		tr = trace_begin("kexec_file_load", item->kernelpath);
+		n = kexec_file_load_kernel(item->kernelpath, item->initrd,
+				(item->cmdline ? item->cmdline :
+				(cmdline_arg ? cmdline_arg + sizeof(str_cmdline_start) - 1 : NULL)));
+		trace_end(tr);
+
+		if (0 == n) {
+			umount(mount_point);
+#ifdef USE_TRACE
+			save_trace(params);
+#endif
+			kexec_reboot();
+			mount(mount_dev, mount_point, mount_fstype, MS_RDONLY, NULL);
+		}
+		log_msg(lg, "Falling back to %s", load_argv[0]);
 	}
+#endif
 
 	/* Load kernel */
+	tr = trace_begin("kexec_load", item->kernelpath);
 	n = fexecw(load_argv[0], (char *const *)load_argv, envp);
+	trace_end(tr);
 	if (-1 == n) {
 		perror("Kexec can't load kernel");
 		exit(-1);
 	}
 
-	umount(mount_point);
+	umount(mount_point);
+
+	dispose(cmdline_arg);
+
+	/* Check /proc/sys/net presence */
+	if ( -1 == stat("/proc/sys/net", &sinfo) ) {
+		if (ENOENT == errno) {
+			/* We have no network, don't issue ifdown() while kexec'ing */
+			exec_argv[2] = "-x";
+			DPRINTF("No network is detected, disabling ifdown()");
+		} else {
+			perror("Can't stat /proc/sys/net");
+		}
+	}
+
+	DPRINTF("exec_argv: %s, %s, %s, %s", exec_argv[0],
+			exec_argv[1], exec_argv[2], exec_argv[3]);
+
+#ifdef USE_TRACE
+	/* Last chance to save timeline */
+	save_trace(params);
+#endif
+
+	/* Boot new kernel */
+	execve(exec_argv[0], (char *const *)exec_argv, envp);
+
+free:
+	dispose(cmdline_arg);
+	for (idx = 0; idx < MAX_LOAD_ARGV_NR; idx++)
+		free(load_argv[idx]);
+	dispose(load_argv);
+	for (idx = 0; idx < MAX_EXEC_ARGV_NR; idx++)
+		free(exec_argv[idx]);
+	dispose(exec_argv);
+}
+
+
+/* Create system menu */
+kx_menu *build_menu(struct params_t *params)
+{
+	kx_menu *menu;
+	kx_menu_level *ml;
+	kx_menu_item *mi;
+	
+#ifdef USE_ICONS
+	kx_picture **icons;
+	
+	if (params->gui) icons = params->gui->icons;
+	else icons = NULL;
+#endif
+	
+	/* Create menu with 2 levels (main and system) */
+	menu = menu_create(2);
+	if (!menu) {
+		DPRINTF("Can't create menu");
+		return NULL;
+	}
+	
+	/* Create main menu level */
+	menu->top = menu_level_create(menu, 4, NULL);
+	
+	/* Create system menu level */
+	ml = menu_level_create(menu, 6, menu->top);
+	if (!ml) {
+		DPRINTF("Can't create system menu");
+		return menu;
+	}
+
+	mi = menu_item_add(menu->top, A_SUBMENU, "System menu", NULL, ml);
+#ifdef USE_ICONS
+	if (icons) menu_item_set_data(mi, icons[ICON_SYSTEM]);
+#endif
+
+	mi = menu_item_add(ml, A_PARENTMENU, "Back", NULL, NULL);
+#ifdef USE_ICONS
+	if (icons) menu_item_set_data(mi, icons[ICON_BACK]);
+#endif
+
+	mi = menu_item_add(ml, A_RESCAN, "Rescan", NULL, NULL);
+#ifdef USE_ICONS
+	if (icons) menu_item_set_data(mi, icons[ICON_RESCAN]);
+#endif
+
+	mi = menu_item_add(ml, A_DEBUG, "Show debug info", NULL, NULL);
+#ifdef USE_ICONS
+	if (icons) menu_item_set_data(mi, icons[ICON_DEBUG]);
+#endif
+
+	mi = menu_item_add(ml, A_REBOOT, "Reboot", NULL, NULL);
+#ifdef USE_ICONS
+	if (icons) menu_item_set_data(mi, icons[ICON_REBOOT]);
+#endif
+
+	mi = menu_item_add(ml, A_SHUTDOWN, "Shutdown", NULL, NULL);
+#ifdef USE_ICONS
+	if (icons) menu_item_set_data(mi, icons[ICON_SHUTDOWN]);
+#endif
+
+	if (!initmode) {
+		mi = menu_item_add(ml, A_EXIT, "Exit", NULL, NULL);
+#ifdef USE_ICONS
+		if (icons) menu_item_set_data(mi, icons[ICON_EXIT]);
+#endif
+	}
+
+	menu->current = menu->top;
+	menu_item_select(menu, 0);
+	return menu;
+}
+
+
+/* Return non-zero when boot item 'a' should be above boot item 'b' in menu */
+static int boot_item_before(struct boot_item_t *a, int a_no,
+		struct boot_item_t *b, int b_no)
+{
+	if (a->priority != b->priority) return (a->priority > b->priority);
+	if (a->order != b->order) return (a->order < b->order);
+	return (a_no < b_no);
+}
+
+
+#ifdef USE_TIMEOUT
+/* Return non-zero while expected device is not found and probed yet */
+static int waiting_for_device(struct params_t *params)
+{
+	if ( (0 == params->watch_deadline) || (NULL == params->waitdev) )
+		return 0;
+
+	return ( !params->waitdev_found || params->scanning );
+}
+#endif
+
+
+/* Add boot item 'no' to main menu keeping items sorted by priority */
+int add_menu_item(struct params_t *params, int no)
+{
+	kx_menu_item *mi;
+	kx_menu_level *ml;
+	int i, id;
+	struct boot_item_t *tbi;
+	struct bootconf_t *bl;
+	char desc[160];
+	char *label;
+#ifdef USE_ICONS
+	kx_picture *icon;
+	struct gui_t *gui;
+
+	gui = params->gui;
+#endif
+
+	bl = params->bootcfg;
+	ml = params->menu->top;
+	tbi = bl->list[no];
+
+	/* Find position: 1st item is system menu */
+	for (i = 1; i < ml->count; i++) {
+		id = ml->list[i]->id - A_DEVICES;
+		if (boot_item_before(tbi, no, bl->list[id], id)) break;
+	}
+
+	if (tbi->kernel_info)
+		snprintf(desc, sizeof(desc), "%s %s %lluMb, %s",
+				tbi->device, tbi->fstype, tbi->blocks/1024, tbi->kernel_info);
+	else
+		snprintf(desc, sizeof(desc), "%s %s %lluMb",
+				tbi->device, tbi->fstype, tbi->blocks/1024);
+
+	if (tbi->label)
+		label = tbi->label;
+	else
+		label = tbi->kernelpath + sizeof(MOUNTPOINT) - 1;
+
+	log_msg(lg, "+ [%s]", label);
+	mi = menu_item_insert(ml, i, A_DEVICES + no, label, desc, NULL);
+	if (!mi) return -1;
+
+#ifdef USE_ICONS
+	if (gui) {
+		/* Search associated with boot item icon if any */
+		icon = tbi->icondata;
+		if (!icon && (gui->icons)) {
+			/* We have no custom icon - use default */
+			switch (tbi->dtype) {
+			case DVT_STORAGE:
+				icon = gui->icons[ICON_STORAGE];
+				break;
+			case DVT_MMC:
+				icon = gui->icons[ICON_MMC];
+				break;
+			case DVT_MTD:
+				icon = gui->icons[ICON_MEMORY];
+				break;
+			case DVT_UNKNOWN:
+			default:
+				break;
+			}
+		}
+
+		/* Add icon to menu */
+		mi->data = icon;
+	}
+#endif
+
+#ifdef USE_TIMEOUT
+	/* We have default item now - start countdown */
+	if ( (params->inputs) && (0 == params->inputs->timeout) &&
+			!waiting_for_device(params) )
+		inputs_set_timeout(params->inputs, USE_TIMEOUT);
+#endif
+
+	return 0;
+}
+
+
+/* Add worker pipes of scan pool to inputs to wake up main loop */
+static void sync_scan_inputs(struct params_t *params)
+{
+	int i;
+	kx_scan_job *job;
+
+	if (!params->inputs) return;
+
+	inputs_del_type(params->inputs, KX_IT_SCAN);
+	if (!params->scanning) return;
+
+	for (i = 0; i < params->scan.count; i++) {
+		job = params->scan.list[i];
+		if (SCAN_RUNNING == job->state)
+			inputs_add_fd(params->inputs, job->fd, KX_IT_SCAN);
+	}
+}
+
+
+/* Set scanning flag and show it in UI */
+static void set_scanning(struct params_t *params, int scanning)
+{
+	params->scanning = scanning;
+#ifdef USE_FBMENU
+	if (params->gui) params->gui->scanning = scanning;
+#endif
+}
+
+
+/* Stop scan and free scan pool. Running workers are killed */
+static void finish_scan(struct params_t *params)
+{
+	if (!params->scanning) return;
+
+	scanpool_clean(&params->scan);
+	free_charlist(params->fslist);
+	params->fslist = NULL;
+	set_scanning(params, 0);
+	sync_scan_inputs(params);
+
+	trace_end(params->scan_trace);
+	log_msg(lg, "Scan finished: %d item(s) found", params->bootcfg->fill);
+
+#ifdef USE_BOOTCACHE
+	if (params->cache) bootcache_save(params->cache);
+#endif
+}
+
+
+/* Prepare scan pool if it is not running yet and open partitions list */
+static FILE *open_scan(struct params_t *params)
+{
+	struct charlist *fslist;
+	int with_icons = 0, keep_mounted = 0;
+	FILE *f;
+
+	if (NULL == params->bootcfg) {
+		params->bootcfg = create_bootcfg(4);
+		if (NULL == params->bootcfg) {
+			DPRINTF("Can't allocate bootconf structure");
+			return NULL;
+		}
+	}
+
+	f = devscan_open(&fslist);
+	if (NULL == f) {
+		log_msg(lg, "Can't initiate device scan");
+		return NULL;
+	}
+
+	/* Pool is running already - add devices to it */
+	if (params->scanning) {
+		free_charlist(fslist);
+		return f;
+	}
+
+#ifdef USE_ICONS
+	if (params->gui) with_icons = 1;
+#endif
+
+#ifdef USE_KEEP_MOUNTED
+	keep_mounted = 1;
+#endif
+
+	if (-1 == scanpool_init(&params->scan, SCAN_WORKERS,
+			fslist, params->cache, with_icons, keep_mounted)) {
+		log_msg(lg, "Can't initialize scan pool");
+		fclose(f);
+		free_charlist(fslist);
+		return NULL;
+	}
+
+	params->fslist = fslist;
+	params->scan_trace = trace_begin("scan", NULL);
+	set_scanning(params, 1);
+	return f;
+}
+
+
+/* Queue device for probing */
+static void queue_device(struct params_t *params, struct device_t *dev)
+{
+	dev->order = params->next_order++;
+
+#ifdef USE_KEEP_MOUNTED
+	/* Worker will mount device again */
+	mountcache_drop(&params->mounts, dev->device);
+#endif
+
+	if ( (params->waitdev) &&
+			!strcmp(dev->device + sizeof("/dev/") - 1, params->waitdev) )
+		params->waitdev_found = 1;
 
-	dispose(cmdline_arg);
+	if (-1 == scanpool_add(&params->scan, dev)) free(dev->device);
+}
 
-	/* Check /proc/sys/net presence */
-	if ( -1 == stat("/proc/sys/net", &sinfo) ) {
-		if (ENOENT == errno) {
-			/* We have no network, don't issue ifdown() while kexec'ing */
-			exec_argv[2] = "-x";
-			DPRINTF("No network is detected, disabling ifdown()");
-		} else {
-			perror("Can't stat /proc/sys/net");
-		}
-	}
 
-	DPRINTF("exec_argv: %s, %s, %s, %s", exec_argv[0],
-			exec_argv[1], exec_argv[2], exec_argv[3]);
+/* Probe devices in background. Menu is populated while we waiting */
+static void start_scan(struct params_t *params)
+{
+	scanpool_start(&params->scan);
+	sync_scan_inputs(params);
 
-	/* Boot new kernel */
-	execve(exec_argv[0], (char *const *)exec_argv, envp);
+	if (0 == scanpool_busy(&params->scan)) finish_scan(params);
+}
 
-free:
-	dispose(cmdline_arg);
-	for (idx = 0; idx < MAX_LOAD_ARGV_NR; idx++)
-		free(load_argv[idx]);
-	dispose(load_argv);
-	for (idx = 0; idx < MAX_EXEC_ARGV_NR; idx++)
-		free(exec_argv[idx]);
-	dispose(exec_argv);
+
+/* Remember current partitions list to find changes later */
+static void take_snapshot(struct params_t *params)
+{
+	if (params->partitions) free_charlist(params->partitions);
+	params->partitions = devscan_snapshot();
 }
 
 
+/* Start devices scan. Results are processed by process_scan() */
 int scan_devices(struct params_t *params)
 {
-	struct charlist *fl;
-	struct bootconf_t *bootconf;
 	struct device_t dev;
-	struct cfgdata_t cfgdata;
-	int rc,n;
+	int rc;
 	FILE *f;
 
-	char mount_dev[16];
-	char mount_fstype[16];
-	char str_mtd_id[3];
+	f = open_scan(params);
+	if (NULL == f) return -1;
 
-#ifdef USE_ICONS
-	kx_cfg_section *sc;
-	int i;
-	int rows;
-	char **xpm_data;
+	take_snapshot(params);
 
-#endif
+	/* Queue all partitions */
+	for (;;) {
+		rc = devscan_next(f, &dev);
+		if (rc < 0) continue;	/* Error */
+		if (0 == rc) break;		/* EOF */
 
-	bootconf = create_bootcfg(4);
-	if (NULL == bootconf) {
-		DPRINTF("Can't allocate bootconf structure");
-		return -1;
+		queue_device(params, &dev);
 	}
+	fclose(f);
 
-	f = devscan_open(&fl);
-	if (NULL == f) {
-		log_msg(lg, "Can't initiate device scan");
-		return -1;
-	}
+	start_scan(params);
+	return 0;
+}
 
-	for (;;) {
-		rc = devscan_next(f, fl, &dev);
-		if (rc < 0) continue;	/* Error */
-		if (0 == rc) break;		/* EOF */
 
-		/* initialize with defaults */
-		strcpy(mount_dev, dev.device);
-		strcpy(mount_fstype, dev.fstype);
+/* Start probing of one hotplugged device */
+static int scan_device(struct params_t *params, const char *devname)
+{
+	struct device_t dev;
+	int rc;
+	FILE *f;
+
+	f = open_scan(params);
+	if (NULL == f) return -1;
 
-		/* We found an ubi erase counter */
-		if (!strncmp(dev.fstype, "ubi",3)) {
+	rc = devscan_get(f, devname, &dev);
+	fclose(f);
 
-			/* attach ubi boot device - mtd id [0-15] */
-			if(isdigit(atoi(dev.device+strlen(dev.device)-2))) {
-				strcpy(str_mtd_id, dev.device+strlen(dev.device)-2);
-				strcat(str_mtd_id, dev.device+strlen(dev.device)-1);
-			} else {
-				strcpy(str_mtd_id, dev.device+strlen(dev.device)-1);
-			}
-			n = ubi_attach(str_mtd_id);
+	if (rc > 0) queue_device(params, &dev);
 
-			/* we have attached ubiX and we mount /dev/ubiX_0  */
-			sprintf(mount_dev, "/dev/ubi%d", n);
-			 /* HARDCODED: first volume */
-			strcat(mount_dev, "_0");
+	start_scan(params);
+	return 0;
+}
 
-			/* HARDCODED: we assume it's ubifs */
-			strcpy(mount_fstype, "ubifs");
-		}
 
-		/* Mount device */
-		if (-1 == mount(mount_dev, MOUNTPOINT, mount_fstype, MS_RDONLY, NULL)) {
-			log_msg(lg, "+ can't mount device %s: %s", mount_dev, ERRMSG);
-			goto free_device;
-		}
+/* Remove menu items and pending scan jobs of device */
+static int remove_device(struct params_t *params, int major, int minor,
+		const char *device)
+{
+	kx_menu_level *ml;
+	struct boot_item_t *tbi;
+	int i, id, n = 0;
+
+	if (params->scanning) {
+		n = scanpool_cancel(&params->scan, major, minor);
+		if (0 == scanpool_busy(&params->scan)) finish_scan(params);
+		else sync_scan_inputs(params);
+	}
 
-		/* NOTE: Don't go out before umount'ing */
+#ifdef USE_KEEP_MOUNTED
+	mountcache_drop(&params->mounts, device);
+#endif
 
-		/* Search boot method and return boot info */
-		rc = get_bootinfo(&cfgdata);
+	if (!params->bootcfg) return n;
 
-		if (-1 == rc) {	/* Error */
-			goto umount;
-		}
+	/* 1st item is system menu. Boot items are kept in bootcfg till
+	 * full rescan because menu ids are indexes in bootcfg */
+	ml = params->menu->top;
+	for (i = ml->count - 1; i > 0; i--) {
+		id = ml->list[i]->id - A_DEVICES;
+		if ( (id < 0) || (id >= params->bootcfg->fill) ) continue;
+		tbi = params->bootcfg->list[id];
+		if (strcmp(tbi->device, device)) continue;
 
+		log_msg(lg, "+ removing [%s]", ml->list[i]->label);
+		menu_item_del(ml, i);
 #ifdef USE_ICONS
-		/* Iterate over sections found */
-		if (params->gui) {
-			for (i = 0; i < cfgdata.count; i++) {
-				sc = cfgdata.list[i];
-				if (!sc) continue;
-
-				/* Load custom icon */
-				if (sc->iconpath) {
-					rows = xpm_load_image(&xpm_data, sc->iconpath);
-					if (-1 == rows) {
-						log_msg(lg, "+ can't load xpm icon %s", sc->iconpath);
-						continue;
-					}
-
-					sc->icondata = xpm_parse_image(xpm_data, rows);
-					if (!sc->icondata) {
-						log_msg(lg, "+ can't parse xpm icon %s", sc->iconpath);
-						continue;
-					}
-					xpm_destroy_image(xpm_data, rows);
-				}
-			}
-		}
+		fb_destroy_picture(tbi->icondata);
+		tbi->icondata = NULL;
 #endif
+		++n;
+	}
 
-umount:
-		/* Umount device */
-		if (-1 == umount(MOUNTPOINT)) {
-			log_msg(lg, "+ can't umount device: %s", ERRMSG);
-			goto free_cfgdata;
-		}
+#ifdef USE_TIMEOUT
+	/* No default item anymore */
+	if ( (1 == ml->count) && (params->inputs) )
+		inputs_set_timeout(params->inputs, 0);
+#endif
 
-		if (-1 == rc) {	/* Error */
-			goto free_cfgdata;
-		}
+	return n;
+}
 
-		/* Now we have something in cfgdata */
-		rc = addto_bootcfg(bootconf, &dev, &cfgdata);
 
-free_cfgdata:
-		destroy_cfgdata(&cfgdata);
-free_device:
-		free(dev.device);
+/* Read uevents and probe changed block devices only */
+int process_hotplug(struct params_t *params)
+{
+	struct uevent_t ev;
+	char device[64];
+	int rc, n = 0;
+
+	while ( (rc = uevent_read(params->uevent_fd, &ev)) >= 0 ) {
+		if (0 == rc) continue;
+
+		snprintf(device, sizeof(device), "/dev/%s", ev.devname);
+		log_msg(lg, "Hotplug: %s %s (%d, %d)",
+				(UEV_ADD == ev.action ? "add" :
+				(UEV_REMOVE == ev.action ? "remove" : "change")),
+				device, ev.major, ev.minor);
+
+		/* Media may be changed. Forget everything about device */
+		fstype_cache_invalidate(makedev(ev.major, ev.minor));
+		dtbindex_invalidate(makedev(ev.major, ev.minor));
+		n += remove_device(params, ev.major, ev.minor, device);
+
+		if (UEV_REMOVE != ev.action) {
+			scan_device(params, ev.devname);
+			++n;
+		}
 	}
 
-	free_charlist(fl);
-	params->bootcfg = bootconf;
-	return 0;
+	/* Keep snapshot in sync to not probe these devices again on rescan */
+	if ( (n > 0) && (params->partitions) ) take_snapshot(params);
+
+	return n;
 }
 
 
-/* Create system menu */
-kx_menu *build_menu(struct params_t *params)
+/*
+ * Probe appeared devices and drop gone ones since last snapshot.
+ * Devices are compared by whole /proc/partitions line i.e. by
+ * (major, minor, blocks, name) so resized device is probed again.
+ */
+static int watch_partitions(struct params_t *params)
 {
-	kx_menu *menu;
-	kx_menu_level *ml;
-	kx_menu_item *mi;
-	
-#ifdef USE_ICONS
-	kx_picture **icons;
-	
-	if (params->gui) icons = params->gui->icons;
-	else icons = NULL;
-#endif
-	
-	/* Create menu with 2 levels (main and system) */
-	menu = menu_create(2);
-	if (!menu) {
-		DPRINTF("Can't create menu");
-		return NULL;
+	struct charlist *cur, *old;
+	char name[32], device[64];
+	int i, major, minor, n = 0;
+
+	cur = devscan_snapshot();
+	if (NULL == cur) return 0;
+
+	old = params->partitions;
+	params->partitions = cur;
+	if (NULL == old) return 0;
+
+	/* Gone or resized devices */
+	for (i = 0; i < old->fill; i++) {
+		if (in_charlist(cur, old->list[i]) >= 0) continue;
+		if (devscan_split(old->list[i], &major, &minor, name, sizeof(name)))
+			continue;
+
+		snprintf(device, sizeof(device), "/dev/%s", name);
+		log_msg(lg, "Device %s is gone", device);
+		fstype_cache_invalidate(makedev(major, minor));
+		dtbindex_invalidate(makedev(major, minor));
+		n += remove_device(params, major, minor, device);
 	}
-	
-	/* Create main menu level */
-	menu->top = menu_level_create(menu, 4, NULL);
-	
-	/* Create system menu level */
-	ml = menu_level_create(menu, 6, menu->top);
-	if (!ml) {
-		DPRINTF("Can't create system menu");
-		return menu;
+
+	/* Appeared devices */
+	for (i = 0; i < cur->fill; i++) {
+		if (in_charlist(old, cur->list[i]) >= 0) continue;
+		if (devscan_split(cur->list[i], &major, &minor, name, sizeof(name)))
+			continue;
+
+		scan_device(params, name);
+		++n;
 	}
 
-	mi = menu_item_add(menu->top, A_SUBMENU, "System menu", NULL, ml);
-#ifdef USE_ICONS
-	if (icons) menu_item_set_data(mi, icons[ICON_SYSTEM]);
-#endif
+	free_charlist(old);
+	return n;
+}
 
-	mi = menu_item_add(ml, A_PARENTMENU, "Back", NULL, NULL);
-#ifdef USE_ICONS
-	if (icons) menu_item_set_data(mi, icons[ICON_BACK]);
-#endif
 
-	mi = menu_item_add(ml, A_RESCAN, "Rescan", NULL, NULL);
-#ifdef USE_ICONS
-	if (icons) menu_item_set_data(mi, icons[ICON_RESCAN]);
-#endif
+/* Start watching for late devices during 'timeout' seconds */
+static void start_watch(struct params_t *params, int timeout)
+{
+	params->watch_deadline = get_monotonic_us() + timeout * 1000000ULL;
+	inputs_set_poll(params->inputs, WATCH_POLL_INTERVAL);
 
-	mi = menu_item_add(ml, A_DEBUG, "Show debug info", NULL, NULL);
-#ifdef USE_ICONS
-	if (icons) menu_item_set_data(mi, icons[ICON_DEBUG]);
-#endif
+	if (params->waitdev)
+		log_msg(lg, "Waiting up to %ds for device %s", timeout, params->waitdev);
+	else
+		log_msg(lg, "Watching for late devices during %ds", timeout);
+}
 
-	mi = menu_item_add(ml, A_REBOOT, "Reboot", NULL, NULL);
-#ifdef USE_ICONS
-	if (icons) menu_item_set_data(mi, icons[ICON_REBOOT]);
-#endif
 
-	mi = menu_item_add(ml, A_SHUTDOWN, "Shutdown", NULL, NULL);
-#ifdef USE_ICONS
-	if (icons) menu_item_set_data(mi, icons[ICON_SHUTDOWN]);
-#endif
+/* Stop watching when expected device is probed or deadline is reached */
+static void update_watch(struct params_t *params)
+{
+	if (0 == params->watch_deadline) return;
 
-	if (!initmode) {
-		mi = menu_item_add(ml, A_EXIT, "Exit", NULL, NULL);
-#ifdef USE_ICONS
-		if (icons) menu_item_set_data(mi, icons[ICON_EXIT]);
-#endif
+	if ( (params->waitdev) && (params->waitdev_found) && !params->scanning ) {
+		log_msg(lg, "Expected device %s is found", params->waitdev);
+	} else if (get_monotonic_us() >= params->watch_deadline) {
+		if ( (params->waitdev) && !params->waitdev_found )
+			log_msg(lg, "Expected device %s is not found", params->waitdev);
+	} else {
+		return;
 	}
 
-	menu->current = menu->top;
-	menu_item_select(menu, 0);
-	return menu;
+	params->watch_deadline = 0;
+	inputs_set_poll(params->inputs, 0);
+
+#ifdef USE_TIMEOUT
+	/* Countdown was postponed till expected device is probed */
+	if ( (0 == params->inputs->timeout) && (params->menu->top->count > 1) )
+		inputs_set_timeout(params->inputs, USE_TIMEOUT);
+#endif
 }
 
 
-/* Fill main menu with boot items */
-int fill_menu(struct params_t *params)
+#ifdef USE_KEEP_MOUNTED
+/* Keep mounts of default and highlighted items from LRU unmounting */
+static void touch_mounts(struct params_t *params)
 {
-	kx_menu_item *mi;
-	int i, b_items, max_pri, max_i, *a;
-	struct boot_item_t *tbi;
-	struct bootconf_t *bl;
-	const int sizeof_desc = 160;
-	char *desc, *label;
-#ifdef USE_ICONS
-	kx_picture *icon;
-	struct gui_t *gui;
-
-	gui = params->gui;
-#endif
+	kx_menu_level *ml;
+	int id;
 
-	bl = params->bootcfg;
+	if (!params->bootcfg) return;
 
-	if ( (NULL != bl) && (bl->fill > 0) ) b_items = bl->fill;
-	else {
-		log_msg(lg, "No items for menu found");
-		return 0;
+	/* 1st item is system menu. Next one is booted by timeout */
+	ml = params->menu->top;
+	if (ml->count > 1) {
+		id = ml->list[1]->id - A_DEVICES;
+		mountcache_touch(&params->mounts, params->bootcfg->list[id]->device);
 	}
 
-	log_msg(lg, "Populating menu: %d item(s)", b_items);
+	id = params->menu->current->current->id - A_DEVICES;
+	if ( (id >= 0) && (id < params->bootcfg->fill) )
+		mountcache_touch(&params->mounts, params->bootcfg->list[id]->device);
+}
+#endif
+
 
-	desc = malloc(sizeof_desc);
-	if (NULL == desc) {
-		DPRINTF("Can't allocate item description");
-		goto dirty_exit;
-	}
+/* Process data from scan workers and add found items to menu */
+int process_scan(struct params_t *params)
+{
+	int i, j, first, tr;
+	kx_scan_job *job;
+#ifdef USE_KEEP_MOUNTED
+	char mountpoint[PATH_MAX];
+#endif
+
+	if (!params->scanning) return 0;
 
-	a = malloc(b_items * sizeof(*a));	/* Markers array */
-	if (NULL == a) {
-		DPRINTF("Can't allocate markers array");
-		goto dirty_exit;
+	if (-1 == scanpool_process(&params->scan, 0)) {
+		finish_scan(params);
+		return -1;
 	}
 
-	for (i = 0; i < b_items; i++) a[i] = 0;	/* Clean markers array */
+	for (i = 0; i < params->scan.count; i++) {
+		job = params->scan.list[i];
+		if (SCAN_DONE != job->state) continue;
 
-	/* Create menu of sorted by priority boot items */
-	max_i = -1;
-	for(;;) {
-		max_pri = -1;
-		/* Search item with maximum priority */
-		for (i = 0; i < b_items; i++) {
-			if (0 == a[i]) {	/* Check that item is not processed yet */
-				tbi = bl->list[i];
-				if (tbi->priority > max_pri) {
-					max_pri = tbi->priority;	/* Max priority */
-					max_i = i;					/* Max priority item index */
-				}
-			}
+		/* Now we have something in cfgdata */
+		tr = trace_begin("fill_menu", job->dev.device);
+		first = params->bootcfg->fill;
+		addto_bootcfg(params->bootcfg, &job->dev, &job->cfgdata);
+		job->state = SCAN_MERGED;
+#ifdef USE_KEEP_MOUNTED
+		if (job->mounted) {
+			scanpool_mountpoint(mountpoint, sizeof(mountpoint), job->dev.device);
+			if (-1 == mountcache_add(&params->mounts, job->dev.device, mountpoint))
+				scanpool_umount(job);	/* Will mount again on boot */
 		}
+#endif
 
-		if (max_pri >= 0) {
-			a[max_i] = 1;	/* Mark item as processed */
-			/* We have found new max priority - insert into menu */
-			tbi = bl->list[max_i];
-			snprintf(desc, sizeof_desc, "%s %s %lluMb",
-					tbi->device, tbi->fstype, tbi->blocks/1024);
+		for (j = first; j < params->bootcfg->fill; j++)
+			add_menu_item(params, j);
+#ifdef USE_KEEP_MOUNTED
+		touch_mounts(params);
+#endif
+		trace_end(tr);
+	}
 
-			if (tbi->label)
-				label = tbi->label;
-			else
-				label = tbi->kernelpath + sizeof(MOUNTPOINT) - 1;
+	if (0 == scanpool_busy(&params->scan)) finish_scan(params);
+	else sync_scan_inputs(params);
 
-			log_msg(lg, "+ [%s]", label);
-			mi = menu_item_add(params->menu->top, A_DEVICES + max_i,
-					label, desc, NULL);
+	return 0;
+}
 
-#ifdef USE_ICONS
-			if (gui) {
-				/* Search associated with boot item icon if any */
-				icon = tbi->icondata;
-				if (!icon && (gui->icons)) {
-					/* We have no custom icon - use default */
-					switch (tbi->dtype) {
-					case DVT_STORAGE:
-						icon = gui->icons[ICON_STORAGE];
-						break;
-					case DVT_MMC:
-						icon = gui->icons[ICON_MMC];
-						break;
-					case DVT_MTD:
-						icon = gui->icons[ICON_MEMORY];
-						break;
-					case DVT_UNKNOWN:
-					default:
-						break;
-					}
-				}
 
-				/* Add icon to menu */
-				if (mi) mi->data = icon;
-			}
-#endif
-		}
+#ifdef USE_PRESTAGE
+/* Stage default boot item while user decides */
+static void update_stage(struct params_t *params)
+{
+	kx_menu_level *ml;
+	int no = -1;
 
-		if (-1 == max_pri) break;	/* We have no items to process */
-	}
+	/* Don't compete with probing for I/O */
+	if (params->scanning) return;
 
-	free(a);
-	free(desc);
-	return 0;
+	/* 1st item is system menu. Next one is booted by timeout */
+	ml = params->menu->top;
+	if (ml->count > 1) no = ml->list[1]->id - A_DEVICES;
+	if (no == params->stage.item) return;
 
-dirty_exit:
-	dispose(desc);
-	return -1;
+	stage_discard(&params->stage);
+	if (no >= 0) stage_start(&params->stage, no, params->bootcfg->list[no]);
 }
+#endif
 
 
 /* Return 0 if we are ordinary app or 1 if we are init */
@@ -772,10 +1565,51 @@ int do_init(void)
 }
 
 
+/*
+ * Forget everything known about devices. Media may be swapped for one
+ * of the same size without uevent so /proc/partitions is not changed.
+ */
+static void forget_devices(struct params_t *params)
+{
+	char name[32];
+	int i, major, minor;
+
+	if (params->partitions) {
+		for (i = 0; i < params->partitions->fill; i++) {
+			if (devscan_split(params->partitions->list[i], &major, &minor,
+					name, sizeof(name)))
+				continue;
+
+			fstype_cache_invalidate(makedev(major, minor));
+			dtbindex_invalidate(makedev(major, minor));
+		}
+	}
+
+#ifdef USE_BOOTCACHE
+	bootcache_clear(params->cache);
+#endif
+}
+
+
+/* Probe all devices again. Used by 'Rescan' menu item */
 int do_rescan(struct params_t *params)
 {
 	int i;
 
+	log_msg(lg, "Rescanning all devices");
+
+	/* Kill workers of previous scan if any */
+	finish_scan(params);
+	forget_devices(params);
+
+#ifdef USE_PRESTAGE
+	/* Boot items are going away */
+	stage_discard(&params->stage);
+#endif
+#ifdef USE_KEEP_MOUNTED
+	mountcache_clean(&params->mounts);
+#endif
+
 	/* Clean top menu level except system menu item */
 	/* FIXME should be done by some function from menu module */
 	kx_menu_item *mi;
@@ -789,6 +1623,13 @@ int do_rescan(struct params_t *params)
 		params->menu->top->list[i] = NULL;
 	}
 	params->menu->top->count = 1;
+	params->menu->top->current = params->menu->top->list[0];
+	params->menu->top->current_no = 0;
+
+#ifdef USE_TIMEOUT
+	/* No default item anymore */
+	if (params->inputs) inputs_set_timeout(params->inputs, 0);
+#endif
 
 #ifdef USE_ICONS
 	/* Destroy icons */
@@ -800,9 +1641,8 @@ int do_rescan(struct params_t *params)
 
 	free_bootcfg(params->bootcfg);
 	params->bootcfg = NULL;
-	scan_devices(params);
 
-	return fill_menu(params);
+	return scan_devices(params);
 }
 
 
@@ -881,20 +1721,18 @@ int process_ctx_menu(struct params_t *params, int action) {
 		break;
 
 	case A_RESCAN:
-#ifdef USE_FBMENU
-		gui_show_msg(params->gui, "Rescanning devices.\nPlease wait...");
-#endif
-#ifdef USE_TEXTUI
-		tui_show_msg(params->tui, "Rescanning devices.\nPlease wait...");
-#endif
 		if (-1 == do_rescan(params)) {
 			log_msg(lg, "Rescan failed");
 			return -1;
 		}
-		menu = params->menu;
+		/* Show main menu to watch it populating */
+		menu->current = menu->top;
 		break;
 
 	case A_DEBUG:
+#ifdef USE_TRACE
+		trace_dump(lg);
+#endif
 		params->context = KX_CTX_TEXTVIEW;
 		break;
 
@@ -926,12 +1764,18 @@ int process_ctx_menu(struct params_t *params, int action) {
 /* Draw menu context */
 void draw_ctx_menu(struct params_t *params)
 {
+	static int rendered = 0;
+	int tr;
+
+	tr = ( rendered ? -1 : trace_begin("first_render", NULL) );
+	rendered = 1;
 #ifdef USE_FBMENU
 	gui_show_menu(params->gui, params->menu);
 #endif
 #ifdef USE_TEXTUI
 	tui_show_menu(params->tui, params->menu);
 #endif
+	trace_end(tr);
 }
 
 
@@ -989,14 +1833,65 @@ int do_main_loop(struct params_t *params, kx_inputs *inputs)
 
 	/* Event loop */
 	do {
+#ifdef USE_PRESTAGE
+		/* Default item may be changed by previous event */
+		update_stage(params);
+#endif
+
 		/* Read events */
 		action = inputs_process(inputs);
+
+		/* Block device was added or removed */
+		if (A_HOTPLUG == action) {
+			if ( (process_hotplug(params) > 0) &&
+					(KX_CTX_MENU == params->context) )
+				draw_ctx_menu(params);
+			update_watch(params);
+			rc = 1;
+			continue;
+		}
+
+		/* Time to look for late devices */
+		if (A_POLL == action) {
+			/* Kernel tells us about new devices if uevents are available */
+			if ( (params->uevent_fd < 0) && (watch_partitions(params) > 0) &&
+					(KX_CTX_MENU == params->context) )
+				draw_ctx_menu(params);
+			update_watch(params);
+			rc = 1;
+			continue;
+		}
+
+		/* Scan workers have some results for us */
+		if (A_SCAN == action) {
+			process_scan(params);
+			update_watch(params);
+			if (KX_CTX_MENU == params->context) draw_ctx_menu(params);
+			rc = 1;
+			continue;
+		}
+
 		if (action != A_NONE) {
 
 			/* Process events in current context */
 			switch (params->context) {
 			case KX_CTX_MENU:
 				rc = process_ctx_menu(params, action);
+#ifdef USE_KEEP_MOUNTED
+				if (rc > 0) touch_mounts(params);
+#endif
+				/* Refuse item with bad checksum and show why */
+				if ( (0 == rc) && (-1 == verify_item(params,
+						params->menu->current->current->id - A_DEVICES)) )
+				{
+#ifdef USE_TIMEOUT
+					/* Don't boot anything behind user's back */
+					inputs_set_timeout(inputs, -1);
+#endif
+					lg->current_line_no = lg->rows->fill - 1;
+					params->context = KX_CTX_TEXTVIEW;
+					rc = 1;
+				}
 				break;
 			case KX_CTX_TEXTVIEW:
 				rc = process_ctx_textview(params, action);
@@ -1030,6 +1925,7 @@ int do_main_loop(struct params_t *params, kx_inputs *inputs)
 int main(int argc, char **argv)
 {
 	int rc = 0;
+	int waittime, tr;
 	struct cfgdata_t cfg;
 	struct params_t params;
 	kx_inputs inputs;
@@ -1037,13 +1933,17 @@ int main(int argc, char **argv)
 	lg = log_open(16);
 	log_msg(lg, "%s starting", PACKAGE_STRING);
 
+	tr = trace_begin("do_init", NULL);
 	initmode = do_init();
+	trace_end(tr);
 
 	/* Get cmdline parameters */
 	params.cfg = &cfg;
 	init_cfgdata(&cfg);
 	cfg.angle = 0;	/* No rotation by default */
+	tr = trace_begin("parse_cmdline", NULL);
 	parse_cmdline(&cfg);
+	trace_end(tr);
 
 	kxb_ttydev = cfg.ttydev;
 	setup_terminal(kxb_ttydev, &kxb_echo_state, 1);
@@ -1052,16 +1952,16 @@ int main(int argc, char **argv)
 
 	log_msg(lg, "FB angle is %d, tty is %s", cfg.angle, cfg.ttydev);
 
-#ifdef USE_DELAY
-	/* extra delay for initializing slow SD/CF */
-	sleep(USE_DELAY);
-#endif
+	/* Slow SD/CF cards will be probed when kernel reports them */
+	params.uevent_fd = uevent_open();
 
 	int no_ui = 1;	/* UI presence flag */
 #ifdef USE_FBMENU
 	params.gui = NULL;
 	if (no_ui) {
+		tr = trace_begin("gui_init", NULL);
 		params.gui = gui_init(cfg.angle);
+		trace_end(tr);
 		if (NULL == params.gui) {
 			log_msg(lg, "Can't initialize GUI");
 		} else no_ui = 0;
@@ -1086,21 +1986,78 @@ int main(int argc, char **argv)
 	
 	params.menu = build_menu(&params);
 	params.bootcfg = NULL;
-	scan_devices(&params);
+	params.scanning = 0;
+	params.fslist = NULL;
+	params.cache = NULL;
+	params.next_order = 0;
+	params.scan_trace = -1;
+#ifdef USE_PRESTAGE
+	stage_init(&params.stage);
+#endif
+	params.watch_deadline = 0;
+	params.partitions = NULL;
+	params.mounted = 0;
+#ifdef USE_KEEP_MOUNTED
+	mountcache_init(&params.mounts, USE_KEEP_MOUNTED);
+#endif
+	params.waitdev = cfg.waitdev;
+	params.waitdev_found = 0;
 
-	if (-1 == fill_menu(&params)) {
-		exit(-1);
+#ifdef USE_BOOTCACHE
+	/* Load boot items cache. Path from cmdline takes precedence */
+	if (cfg.cachepath) {
+		params.cache = bootcache_open(cfg.cachepath);
+	}
+#ifdef BOOTCACHE_PATH
+	else {
+		params.cache = bootcache_open(BOOTCACHE_PATH);
 	}
+#endif
+#endif
 
 	/* Collect input devices */
 	inputs_init(&inputs, 8);
 	inputs_open(&inputs);
+	if (params.uevent_fd >= 0)
+		inputs_add_fd(&inputs, params.uevent_fd, KX_IT_SOCKET);
 	inputs_preprocess(&inputs);
+	params.inputs = &inputs;
+
+	/* Slow SD/CF may appear after scan start. Look for them for a while */
+	waittime = cfg.waittime;
+#ifdef USE_DELAY
+	if (waittime < 0) waittime = USE_DELAY;
+#endif
+	if (waittime > 0) start_watch(&params, waittime);
+
+	/* Start scan. Menu will be populated from main loop */
+	scan_devices(&params);
+	update_watch(&params);
 
 	/* Run main event loop
 	 * Return values: <0 - error, >=0 - selected item id */
 	rc = do_main_loop(&params, &inputs);
 
+	/* Don't leave scan workers behind */
+	finish_scan(&params);
+
+#ifdef USE_PRESTAGE
+	/* Staged data is useless if other item is chosen */
+	if (params.stage.item != rc - A_DEVICES) stage_discard(&params.stage);
+#endif
+	inputs_del_type(&inputs, KX_IT_SOCKET);
+	uevent_close(params.uevent_fd);
+
+#ifdef USE_KEEP_MOUNTED
+	/* Chosen device is booted from its scan mount, others aren't needed */
+	if (rc >= A_DEVICES) take_mount(&params, params.bootcfg->list[rc - A_DEVICES]);
+	mountcache_clean(&params.mounts);
+#endif
+
+#ifdef USE_BOOTCACHE
+	bootcache_close(params.cache);
+#endif
+
 #ifdef USE_FBMENU
 	if (params.gui) {
 		if (rc < 0) gui_clear(params.gui);
@@ -1120,7 +2077,12 @@ int main(int argc, char **argv)
 	lg = NULL;
 
 	/* rc < 0 indicate error */
-	if (rc < 0) exit(rc);
+	if (rc < 0) {
+#ifdef USE_TRACE
+		save_trace(&params);
+#endif
+		exit(rc);
+	}
 
 	menu_destroy(params.menu, 0);
 
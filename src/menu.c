@@ -97,6 +97,7 @@ kx_menu_level *menu_level_create(kx_menu *menu, kx_menu_dim size,
 	level->count = 0;
 	level->current_no = 0;
 	level->current = NULL;
+	level->changes = 0;
 	level->parent = parent;
 
 	menu->list[menu->count] = level;
@@ -112,10 +113,21 @@ kx_menu_level *menu_level_create(kx_menu *menu, kx_menu_dim size,
 /* Add menu item to menu level */
 kx_menu_item *menu_item_add(kx_menu_level *level, kx_menu_id id,
 		char *label, char *description, kx_menu_level *submenu)
+{
+	if (!level) return NULL;
+	return menu_item_insert(level, level->count, id, label, description, submenu);
+}
+
+
+kx_menu_item *menu_item_insert(kx_menu_level *level, kx_menu_dim no,
+		kx_menu_id id, char *label, char *description,
+		kx_menu_level *submenu)
 {
 	kx_menu_item *item;
+	kx_menu_dim i;
 
 	if (!level) return NULL;
+	if (no > level->count) no = level->count;
 	
 	/* Resize list when needed before adding item */
 	if (level->count >= level->size) {
@@ -144,15 +156,22 @@ kx_menu_item *menu_item_add(kx_menu_level *level, kx_menu_id id,
 	item->id = id;
 	item->submenu = submenu;
 
-	level->list[level->count] = item;
+	/* Shift following items */
+	for (i = level->count; i > no; i--)
+		level->list[i] = level->list[i - 1];
+	level->list[no] = item;
 
 	/* If there is no current item yet then make this item current */
 	if (!level->current) {
 		level->current = item;
-		level->current_no = level->count;
+		level->current_no = no;
+	} else if (no <= level->current_no) {
+		/* Current item is moved down */
+		++level->current_no;
 	}
 
 	++level->count;
+	++level->changes;
 
 	return item;
 }
@@ -251,6 +270,39 @@ kx_menu_dim menu_item_select_by_no(kx_menu *menu, int no)
 }
 
 
+/* Remove item 'no' from menu level. Item data is not touched */
+void menu_item_del(kx_menu_level *level, kx_menu_dim no)
+{
+	kx_menu_item *item;
+	kx_menu_dim i;
+
+	if (!level || (no >= level->count)) return;
+
+	item = level->list[no];
+
+	/* Shift following items */
+	for (i = no; i < level->count - 1; i++)
+		level->list[i] = level->list[i + 1];
+	--level->count;
+	++level->changes;
+	level->list[level->count] = NULL;
+
+	if (no < level->current_no) {
+		/* Current item is moved up */
+		--level->current_no;
+	} else if (no == level->current_no) {
+		/* Current item is removed - select item at same position */
+		if ( (level->current_no >= level->count) && (level->current_no > 0) )
+			--level->current_no;
+		level->current = ( level->count ? level->list[level->current_no] : NULL );
+	}
+
+	dispose(item->label);
+	dispose(item->description);
+	free(item);
+}
+
+
 inline void menu_item_set_data(kx_menu_item *item, void *data)
 {
 	item->data = data;
@@ -40,6 +40,7 @@ typedef struct kx_menu_level {
 	kx_menu_dim count;			/* Filled items count */
 	kx_menu_dim current_no;		/* Current active item No */
 	kx_menu_item *current;		/* Current active item */
+	unsigned int changes;		/* Items insertions/removals counter */
 	struct kx_menu_level *parent;	/* Upper menu level */
 	kx_menu_item **list;		/* Menu items array */
 } kx_menu_level;
@@ -74,6 +75,14 @@ kx_menu_level *menu_level_create(kx_menu *menu, kx_menu_dim size,
 kx_menu_item *menu_item_add(kx_menu_level *level, kx_menu_id id,
 		char *label, char *description, kx_menu_level *submenu);
 
+/* Insert menu item into menu level before item 'no' */
+kx_menu_item *menu_item_insert(kx_menu_level *level, kx_menu_dim no,
+		kx_menu_id id, char *label, char *description,
+		kx_menu_level *submenu);
+
+/* Remove item 'no' from menu level */
+void menu_item_del(kx_menu_level *level, kx_menu_dim no);
+
 void menu_item_set_data(kx_menu_item *item, void *data);
 
 void menu_destroy(kx_menu *menu, int destroy_data);
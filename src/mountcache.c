@@ -0,0 +1,192 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *
+ *  Copyright (c) 2008-2011 Yuri Bushmelev <jay4mail@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+#include "config.h"
+
+#ifdef USE_KEEP_MOUNTED
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mount.h>
+
+#include "util.h"
+#include "mountcache.h"
+
+
+/* Unmount entry and free it */
+static void mountcache_release(kx_mount *m)
+{
+	/* Device may be gone already - detach lazily */
+	if (-1 == umount2(m->mountpoint, MNT_DETACH))
+		log_msg(lg, "Can't umount %s: %s", m->mountpoint, ERRMSG);
+	rmdir(m->mountpoint);
+
+	free(m->device);
+	free(m->mountpoint);
+	free(m);
+}
+
+
+/* Remove entry i from list keeping order */
+static void mountcache_remove(kx_mountcache *mc, unsigned int i)
+{
+	--mc->fill;
+	memmove(mc->list + i, mc->list + i + 1,
+			(mc->fill - i) * sizeof(*(mc->list)));
+}
+
+
+static int mountcache_find(kx_mountcache *mc, const char *device)
+{
+	unsigned int i;
+
+	for (i = 0; i < mc->fill; i++) {
+		if (!strcmp(mc->list[i]->device, device)) return i;
+	}
+	return -1;
+}
+
+
+int mountcache_init(kx_mountcache *mc, unsigned int max)
+{
+	mc->size = 4;
+	mc->fill = 0;
+	mc->max = (max > 0 ? max : 1);
+
+	mc->list = malloc(mc->size * sizeof(*(mc->list)));
+	if (NULL == mc->list) {
+		DPRINTF("Can't allocate mounts array");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int mountcache_add(kx_mountcache *mc, const char *device,
+		const char *mountpoint)
+{
+	unsigned int i, lru;
+	kx_mount *m, **new_list;
+
+	/* Free room for new entry */
+	if (mc->fill >= mc->max) {
+		lru = 0;
+		for (i = 1; i < mc->fill; i++) {
+			if (mc->list[i]->used < mc->list[lru]->used) lru = i;
+		}
+		DPRINTF("Unmounting LRU device %s", mc->list[lru]->device);
+		mountcache_release(mc->list[lru]);
+		mountcache_remove(mc, lru);
+	}
+
+	if (mc->fill >= mc->size) {
+		mc->size <<= 1;
+		new_list = realloc(mc->list, mc->size * sizeof(*(mc->list)));
+		if (NULL == new_list) {
+			DPRINTF("Can't resize mounts array");
+			mc->size >>= 1;
+			return -1;
+		}
+		mc->list = new_list;
+	}
+
+	m = malloc(sizeof(*m));
+	if (NULL == m) {
+		DPRINTF("Can't allocate mount entry");
+		return -1;
+	}
+
+	m->device = strdup(device);
+	m->mountpoint = strdup(mountpoint);
+	m->used = get_monotonic_us();
+	if ( (NULL == m->device) || (NULL == m->mountpoint) ) {
+		DPRINTF("Can't allocate mount entry");
+		dispose(m->device);
+		dispose(m->mountpoint);
+		free(m);
+		return -1;
+	}
+
+	mc->list[mc->fill++] = m;
+	return 0;
+}
+
+
+const char *mountcache_touch(kx_mountcache *mc, const char *device)
+{
+	int i;
+
+	i = mountcache_find(mc, device);
+	if (-1 == i) return NULL;
+
+	mc->list[i]->used = get_monotonic_us();
+	return mc->list[i]->mountpoint;
+}
+
+
+int mountcache_take(kx_mountcache *mc, const char *device,
+		const char *target)
+{
+	int i;
+	kx_mount *m;
+
+	i = mountcache_find(mc, device);
+	if (-1 == i) return -1;
+	m = mc->list[i];
+
+	if (-1 == mount(m->mountpoint, target, NULL, MS_MOVE, NULL)) {
+		log_msg(lg, "Can't move mount of %s: %s", device, ERRMSG);
+		return -1;
+	}
+	rmdir(m->mountpoint);
+
+	free(m->device);
+	free(m->mountpoint);
+	free(m);
+	mountcache_remove(mc, i);
+
+	return 0;
+}
+
+
+void mountcache_drop(kx_mountcache *mc, const char *device)
+{
+	int i;
+
+	i = mountcache_find(mc, device);
+	if (-1 == i) return;
+
+	mountcache_release(mc->list[i]);
+	mountcache_remove(mc, i);
+}
+
+
+void mountcache_clean(kx_mountcache *mc)
+{
+	unsigned int i;
+
+	if (!mc->list) return;
+
+	for (i = 0; i < mc->fill; i++)
+		mountcache_release(mc->list[i]);
+
+	mc->fill = 0;
+}
+
+#endif	/* USE_KEEP_MOUNTED */
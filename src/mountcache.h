@@ -0,0 +1,66 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *
+ *  Copyright (c) 2008-2011 Yuri Bushmelev <jay4mail@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+#ifndef _HAVE_MOUNTCACHE_H_
+#define _HAVE_MOUNTCACHE_H_
+
+#include "config.h"
+
+/* Device left mounted by scan worker */
+typedef struct {
+	char *device;			/* Device node */
+	char *mountpoint;		/* Private mountpoint of device */
+	unsigned long long used;	/* Time of last use (LRU) */
+} kx_mount;
+
+/*
+ * Devices kept mounted read-only between scan and start_kernel(), so
+ * chosen item is booted without mounting (and replaying journal or
+ * attaching UBI) again. Mount is moved to MOUNTPOINT when taken.
+ * At most 'max' devices are kept, least recently used is unmounted.
+ */
+typedef struct {
+	unsigned int size;		/* Allocated entries count */
+	unsigned int fill;		/* Filled entries count */
+	unsigned int max;		/* Mounted devices limit */
+	kx_mount **list;		/* Entries array */
+} kx_mountcache;
+
+/* Initialize cache of up to 'max' mounted devices */
+int mountcache_init(kx_mountcache *mc, unsigned int max);
+
+/* Remember device mounted on mountpoint. LRU device may be unmounted.
+ * On error (-1) mount is not taken and stays with caller */
+int mountcache_add(kx_mountcache *mc, const char *device,
+		const char *mountpoint);
+
+/* Mark device as used recently. Return mountpoint or NULL */
+const char *mountcache_touch(kx_mountcache *mc, const char *device);
+
+/*
+ * Move mount of device to 'target' and forget it.
+ * Return 0 on success, -1 if device is not mounted or move failed
+ */
+int mountcache_take(kx_mountcache *mc, const char *device,
+		const char *target);
+
+/* Unmount device (it may be gone already) */
+void mountcache_drop(kx_mountcache *mc, const char *device);
+
+/* Unmount all devices. Cache may be used further */
+void mountcache_clean(kx_mountcache *mc);
+
+#endif //_HAVE_MOUNTCACHE_H_
@@ -0,0 +1,581 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *
+ *  Copyright (c) 2008-2011 Yuri Bushmelev <jay4mail@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/mount.h>
+
+#include "config.h"
+#include "util.h"
+#include "fstype/fstype.h"
+#include "scanpool.h"
+#include "trace.h"
+#include "dtbindex.h"
+
+
+/* Mount tmpfs to hold private mountpoints. Return 0 on success */
+static int mount_probe_root(void)
+{
+	static int mounted = 0;
+
+	if (mounted) return 0;
+
+	/* Initramfs may have no parent directories */
+	if (-1 == mkdir_parents(PROBE_MOUNTROOT, 0700)) {
+		log_msg(lg, "Can't create %s: %s", PROBE_MOUNTROOT, ERRMSG);
+		return -1;
+	}
+
+	if (-1 == mount("tmpfs", PROBE_MOUNTROOT, "tmpfs", 0, "mode=0700")) {
+		log_msg(lg, "Can't mount tmpfs on %s: %s", PROBE_MOUNTROOT, ERRMSG);
+		return -1;
+	}
+	mounted = 1;
+	return 0;
+}
+
+
+/* Initialize pool structure */
+int scanpool_init(kx_scanpool *pool, unsigned int max_workers,
+		struct charlist *fslist, kx_bootcache *cache, int with_icons,
+		int keep_mounted)
+{
+	pool->size = 4;
+	pool->count = 0;
+	pool->running = 0;
+	pool->max_workers = (max_workers > 0 ? max_workers : 1);
+	pool->with_icons = with_icons;
+	pool->keep_mounted = keep_mounted;
+	pool->fslist = fslist;
+	pool->cache = cache;
+
+	pool->list = malloc(pool->size * sizeof(*(pool->list)));
+	if (NULL == pool->list) {
+		DPRINTF("Can't allocate scan jobs array");
+		return -1;
+	}
+
+	if (-1 == mount_probe_root()) {
+		dispose(pool->list);
+		pool->list = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+char *scanpool_mountpoint(char *buf, size_t size, const char *device)
+{
+	const char *name;
+
+	name = strrchr(device, '/');
+	name = (name ? name + 1 : device);
+	snprintf(buf, size, "%s/%s", PROBE_MOUNTROOT, name);
+	return buf;
+}
+
+
+/* Unmount device left mounted by worker when nobody takes it */
+void scanpool_umount(kx_scan_job *job)
+{
+	char mountpoint[PATH_MAX];
+
+	if (!job->mounted) return;
+
+	scanpool_mountpoint(mountpoint, sizeof(mountpoint), job->dev.device);
+	umount(mountpoint);
+	rmdir(mountpoint);
+	job->mounted = 0;
+}
+
+
+/* Kill running worker and remove mount it may have left */
+static void scanpool_kill(kx_scan_job *job)
+{
+	char mountpoint[PATH_MAX];
+
+	kill(job->pid, SIGKILL);
+	close(job->fd);
+	waitpid(job->pid, NULL, 0);
+	job->fd = -1;
+	job->pid = -1;
+
+	/* Device may be gone already so don't wait for it */
+	scanpool_mountpoint(mountpoint, sizeof(mountpoint), job->dev.device);
+	umount2(mountpoint, MNT_DETACH);
+	rmdir(mountpoint);
+}
+
+
+/* Queue device for probing */
+int scanpool_add(kx_scanpool *pool, struct device_t *dev)
+{
+	kx_scan_job *job;
+
+	/* Resize list when needed before adding item */
+	if (pool->count >= pool->size) {
+		kx_scan_job **new_list;
+		unsigned int new_size;
+
+		new_size = pool->size * 2;
+		new_list = realloc(pool->list, new_size * sizeof(*(pool->list)));
+		if (NULL == new_list) {
+			DPRINTF("Can't resize scan jobs list");
+			return -1;
+		}
+
+		pool->size = new_size;
+		pool->list = new_list;
+	}
+
+	job = malloc(sizeof(*job));
+	if (NULL == job) {
+		DPRINTF("Can't allocate scan job");
+		return -1;
+	}
+
+	job->dev = *dev;
+	job->state = SCAN_QUEUED;
+	job->pid = -1;
+	job->fd = -1;
+	job->buf.data = NULL;
+	job->buf.size = 0;
+	job->buf.fill = 0;
+	job->buf.pos = 0;
+
+	job->fs_probed = 0;
+	job->mounted = 0;
+	job->fs_cached = (0 == fstype_cache_get(makedev(dev->major, dev->minor),
+			dev->blocks, &job->fsres));
+
+	pool->list[pool->count] = job;
+	++pool->count;
+
+	return pool->count - 1;
+}
+
+
+/*
+ * Worker process body. Probe device and write results to fd.
+ * Message layout: fstype, probe rc, store-in-cache flag, mounted flag,
+ * attached UBI device, fingerprint, FS probed flag, FS probe result (when probed), trace spans
+ * (USE_TRACE), DTB index flag, DTB index (when flag set), log lines, cfgdata (when rc == 0)
+ */
+static void scanpool_worker(kx_scanpool *pool, kx_scan_job *job, int fd)
+{
+	struct cfgdata_t cfgdata;
+	struct device_t *dev = &job->dev;
+	kx_bootcache_entry *entry = NULL;
+	kx_buffer buf;
+	char mountpoint[PATH_MAX];
+	int i, rc, store = 0, mounted = 0, ubi = -1;
+	kx_dtbindex *dtbidx;
+#ifdef USE_TRACE
+	int mark, tr;
+
+	/* Send spans of this worker only */
+	mark = trace_mark();
+	tr = trace_begin("probe", dev->device);
+#endif
+
+	/* Collect own log to pass it to parent */
+	lg = log_open(16);
+
+	scanpool_mountpoint(mountpoint, sizeof(mountpoint), dev->device);
+
+	if (job->fs_cached) {
+		log_msg(lg, "+ FS probe result is taken from cache");
+	} else {
+		/* Don't cache result of failed read */
+		job->fs_probed = (probe_fstype(dev->device, &job->fsres) >= 0);
+	}
+
+	dev->fp = job->fsres.fp;
+	dev->fstype = check_fstype(&job->fsres, pool->fslist);
+	if (NULL == dev->fstype) {
+		rc = -1;
+	} else {
+#ifdef USE_BOOTCACHE
+		if (pool->cache)
+			entry = bootcache_find(pool->cache, dev, pool->with_icons);
+
+		if (entry) {
+			/* Device is not changed since last boot */
+			log_msg(lg, "+ boot config is taken from cache");
+			rc = bootcache_get(entry, &cfgdata);
+		}
+#endif
+		if (!entry) {
+			rc = devscan_probe(dev, mountpoint, &cfgdata, pool->with_icons,
+					pool->keep_mounted);
+			/* Mount was successful so result may be cached */
+			store = ( (pool->cache) && (rc >= 0) && (dev->fp.valid) );
+			mounted = ( (0 == rc) && pool->keep_mounted );
+		}
+	}
+
+#ifdef USE_TRACE
+	trace_end(tr);
+#endif
+
+	/* Let parent know UBI mapping to not look for it again */
+	if ( (dev->fstype) && !strncmp(dev->fstype, "ubi", 3) )
+		ubi = ubi_lookup(ubi_mtd_num(dev->device));
+
+	if (-1 == buffer_init(&buf, 4096)) _exit(1);
+
+	buffer_put_str(&buf, dev->fstype);
+	buffer_put_int(&buf, rc);
+	buffer_put_int(&buf, store);
+	buffer_put_int(&buf, mounted);
+	buffer_put_int(&buf, ubi);
+	buffer_put(&buf, &dev->fp, sizeof(dev->fp));
+	buffer_put_int(&buf, job->fs_probed);
+	if (job->fs_probed) {
+		buffer_put_str(&buf, job->fsres.fstype);
+		buffer_put(&buf, &job->fsres, sizeof(job->fsres));
+	}
+#ifdef USE_TRACE
+	trace_pack(&buf, mark);
+#endif
+	/* Parent keeps DTB index for next rescans */
+	dtbidx = (entry ? NULL : dtbindex_get(makedev(dev->major, dev->minor)));
+	buffer_put_int(&buf, (NULL != dtbidx));
+	if (dtbidx) dtbindex_pack(dtbidx, &buf);
+
+	buffer_put_int(&buf, lg->rows->fill);
+	for (i = 0; i < lg->rows->fill; i++)
+		buffer_put_str(&buf, lg->rows->list[i]);
+
+	if (0 == rc) cfgdata_pack(&cfgdata, &buf);
+
+	buffer_write_fd(&buf, fd);
+	close(fd);
+
+	/* Don't run parent's atexit() handlers */
+	_exit(0);
+}
+
+
+/* Spawn worker for job */
+static int scanpool_spawn(kx_scanpool *pool, kx_scan_job *job)
+{
+	int p[2];
+	pid_t pid;
+
+	if (-1 == pipe(p)) {
+		log_msg(lg, "Can't create pipe: %s", ERRMSG);
+		return -1;
+	}
+
+	/* Flush stdio buffers to not duplicate them in child */
+	fflush(stdout);
+	fflush(stderr);
+
+	pid = fork();
+	if (pid < 0) {
+		log_msg(lg, "Can't fork scan worker: %s", ERRMSG);
+		close(p[0]);
+		close(p[1]);
+		return -1;
+	} else if (0 == pid) {
+		/* it is child */
+		close(p[0]);
+		scanpool_worker(pool, job, p[1]);
+	}
+
+	/* it is parent */
+	close(p[1]);
+	fcntl(p[0], F_SETFL, O_NONBLOCK);
+
+	job->pid = pid;
+	job->fd = p[0];
+	job->state = SCAN_RUNNING;
+	if (-1 == buffer_init(&job->buf, 4096)) {
+		DPRINTF("Can't allocate scan job buffer");
+	}
+	++pool->running;
+
+	return 0;
+}
+
+
+/* Start workers for queued jobs */
+int scanpool_start(kx_scanpool *pool)
+{
+	int i, rc = 0;
+	kx_scan_job *job;
+
+	for (i = 0; (i < pool->count) && (pool->running < pool->max_workers); i++) {
+		job = pool->list[i];
+		if (SCAN_QUEUED != job->state) continue;
+
+		if (-1 == scanpool_spawn(pool, job)) {
+			/* Can't fork - skip device but start the rest */
+			job->state = SCAN_FAILED;
+			rc = -1;
+		}
+	}
+
+	return rc;
+}
+
+
+/* Decode data received from worker */
+static void scanpool_decode(kx_scanpool *pool, kx_scan_job *job)
+{
+	char *str;
+	int i, rc, store, ubi, lines, dtbidx;
+#ifdef USE_BOOTCACHE
+	unsigned int cfgpos;
+#endif
+
+	job->state = SCAN_FAILED;
+	job->buf.pos = 0;
+
+	if (-1 == buffer_get_str(&job->buf, &str)) goto broken;
+	job->dev.fstype = fstype_lookup(str);
+	dispose(str);
+
+	if ( (-1 == buffer_get_int(&job->buf, &rc)) ||
+			(-1 == buffer_get_int(&job->buf, &store)) ||
+			(-1 == buffer_get_int(&job->buf, &job->mounted)) ||
+			(-1 == buffer_get_int(&job->buf, &ubi)) ||
+			(-1 == buffer_get(&job->buf, &job->dev.fp, sizeof(job->dev.fp))) ||
+			(-1 == buffer_get_int(&job->buf, &job->fs_probed)) )
+		goto broken;
+
+	if (ubi >= 0) ubi_remember(ubi_mtd_num(job->dev.device), ubi);
+
+	if (job->fs_probed) {
+		/* FS name pointer is valid only in worker */
+		if (-1 == buffer_get_str(&job->buf, &str)) goto broken;
+		if (-1 == buffer_get(&job->buf, &job->fsres, sizeof(job->fsres))) {
+			dispose(str);
+			goto broken;
+		}
+		job->fsres.fstype = fstype_lookup(str);
+		dispose(str);
+
+		fstype_cache_put(makedev(job->dev.major, job->dev.minor),
+				job->dev.blocks, &job->fsres);
+	}
+
+#ifdef USE_TRACE
+	if (-1 == trace_unpack(&job->buf)) goto broken;
+#endif
+
+	if (-1 == buffer_get_int(&job->buf, &dtbidx)) goto broken;
+	if ( dtbidx && (-1 == dtbindex_unpack(makedev(job->dev.major,
+			job->dev.minor), &job->buf)) )
+		goto broken;
+
+	if (-1 == buffer_get_int(&job->buf, &lines)) goto broken;
+
+	/* Add worker's log to our log. Worker have printed it already */
+	for (i = 0; i < lines; i++) {
+		if (-1 == buffer_get_str(&job->buf, &str)) goto broken;
+		if (str) {
+			if (lg) addto_charlist(lg->rows, str);
+			free(str);
+		}
+	}
+
+#ifdef USE_BOOTCACHE
+	/* Rest of message is packed cfgdata */
+	cfgpos = job->buf.pos;
+#endif
+
+	if (0 == rc) {
+		if (-1 == cfgdata_unpack(&job->cfgdata, &job->buf)) {
+			destroy_cfgdata(&job->cfgdata);
+			goto broken;
+		}
+		job->state = SCAN_DONE;
+	}
+
+#ifdef USE_BOOTCACHE
+	if ( store && pool->cache && (rc >= 0) ) {
+		bootcache_update(pool->cache, &job->dev, pool->with_icons,
+				job->buf.data + cfgpos,
+				(0 == rc ? job->buf.fill - cfgpos : 0));
+	}
+#endif
+
+	return;
+
+broken:
+	log_msg(lg, "+ got broken data from worker probing %s", job->dev.device);
+	scanpool_umount(job);
+}
+
+
+/* Finish job when worker closed pipe */
+static void scanpool_finish(kx_scanpool *pool, kx_scan_job *job)
+{
+	close(job->fd);
+	job->fd = -1;
+	waitpid(job->pid, NULL, 0);
+	job->pid = -1;
+	--pool->running;
+
+	scanpool_decode(pool, job);
+	buffer_clean(&job->buf);
+}
+
+
+/* Wait for data from workers and process it */
+int scanpool_process(kx_scanpool *pool, int timeout)
+{
+	fd_set fds;
+	struct timeval tv;
+	int i, n, maxfd, nready, finished;
+	kx_scan_job *job;
+
+	if (0 == pool->running) return 0;
+
+	FD_ZERO(&fds);
+	maxfd = -1;
+	for (i = 0; i < pool->count; i++) {
+		job = pool->list[i];
+		if (SCAN_RUNNING != job->state) continue;
+		FD_SET(job->fd, &fds);
+		if (job->fd > maxfd) maxfd = job->fd;
+	}
+
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+
+	nready = select(maxfd + 1, &fds, NULL, NULL, (timeout < 0 ? NULL : &tv));
+	if (-1 == nready) {
+		if (EINTR == errno) return 0;
+		log_msg(lg, "Error occured in select() call: %s", ERRMSG);
+		return -1;
+	}
+
+	finished = 0;
+	for (i = 0; (i < pool->count) && (nready > 0); i++) {
+		job = pool->list[i];
+		if (SCAN_RUNNING != job->state) continue;
+		if (!FD_ISSET(job->fd, &fds)) continue;
+
+		--nready;
+		do {
+			n = buffer_read_fd(&job->buf, job->fd);
+		} while (n > 0);
+
+		if ( (0 == n) || ((EAGAIN != errno) && (EINTR != errno)) ) {
+			/* EOF or error - worker is done */
+			scanpool_finish(pool, job);
+			++finished;
+		}
+	}
+
+	/* Give freed workers next jobs */
+	if (finished) scanpool_start(pool);
+
+	return finished;
+}
+
+
+/* Return count of queued and running jobs */
+unsigned int scanpool_busy(kx_scanpool *pool)
+{
+	int i;
+	unsigned int n = 0;
+
+	for (i = 0; i < pool->count; i++) {
+		if ( (SCAN_QUEUED == pool->list[i]->state) ||
+				(SCAN_RUNNING == pool->list[i]->state) )
+			++n;
+	}
+	return n;
+}
+
+
+/* Drop jobs of device. Running worker is killed */
+int scanpool_cancel(kx_scanpool *pool, int major, int minor)
+{
+	int i, n = 0;
+	kx_scan_job *job;
+
+	for (i = 0; i < pool->count; i++) {
+		job = pool->list[i];
+		if ( (job->dev.major != major) || (job->dev.minor != minor) )
+			continue;
+
+		switch (job->state) {
+		case SCAN_RUNNING:
+			scanpool_kill(job);
+			buffer_clean(&job->buf);
+			--pool->running;
+			break;
+		case SCAN_DONE:
+			destroy_cfgdata(&job->cfgdata);
+			scanpool_umount(job);
+			break;
+		case SCAN_QUEUED:
+			break;
+		default:
+			/* Finished already */
+			continue;
+		}
+
+		job->state = SCAN_FAILED;
+		++n;
+	}
+
+	/* Give freed workers next jobs */
+	if (n) scanpool_start(pool);
+
+	return n;
+}
+
+
+/* Kill running workers and free jobs */
+void scanpool_clean(kx_scanpool *pool)
+{
+	int i;
+	kx_scan_job *job;
+
+	for (i = 0; i < pool->count; i++) {
+		job = pool->list[i];
+		if (SCAN_RUNNING == job->state)
+			scanpool_kill(job);
+		if ( (SCAN_DONE == job->state) || (SCAN_MERGED == job->state) )
+			destroy_cfgdata(&job->cfgdata);
+		if (SCAN_DONE == job->state) scanpool_umount(job);
+		buffer_clean(&job->buf);
+		free(job->dev.device);
+		free(job);
+	}
+	dispose(pool->list);
+	pool->list = NULL;
+	pool->count = 0;
+	pool->running = 0;
+}
@@ -0,0 +1,118 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *
+ *  Copyright (c) 2008-2011 Yuri Bushmelev <jay4mail@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+#ifndef _HAVE_SCANPOOL_H_
+#define _HAVE_SCANPOOL_H_
+
+#include <sys/types.h>
+
+#include "config.h"
+#include "util.h"
+#include "cfgparser.h"
+#include "devicescan.h"
+#include "bootcache.h"
+
+/* Default number of devices probed concurrently */
+#ifndef SCAN_WORKERS
+#define SCAN_WORKERS 4
+#endif
+
+/* Scan job states */
+enum scan_state_t {
+	SCAN_QUEUED,	/* Waiting for free worker */
+	SCAN_RUNNING,	/* Worker is probing device */
+	SCAN_DONE,		/* Boot config is found */
+	SCAN_MERGED,	/* Boot config is taken by caller */
+	SCAN_FAILED		/* Nothing to boot from this device */
+};
+
+/* One device to probe */
+typedef struct {
+	struct device_t dev;		/* Device being probed */
+	enum scan_state_t state;	/* Job state */
+	pid_t pid;					/* Worker process id */
+	int fd;						/* Read end of worker's pipe */
+	kx_buffer buf;				/* Data received from worker */
+	struct cfgdata_t cfgdata;	/* Probe result (SCAN_DONE/SCAN_MERGED) */
+	int fs_cached;				/* FS probe result is taken from cache */
+	int fs_probed;				/* Worker has read superblock */
+	struct fs_probe_result fsres;	/* FS probe result */
+	int mounted;				/* Device is left mounted by worker */
+} kx_scan_job;
+
+/*
+ * Pool of worker processes. Every device is probed by forked worker
+ * on private mountpoint under PROBE_MOUNTROOT. Results are passed back
+ * through pipe and stored in jobs list in order of scanpool_add() calls.
+ * Devices with matching boot cache entry are not mounted at all; fresh
+ * results are stored into cache by parent. Same applies to FS probe
+ * cache which lives in parent because workers are short-lived.
+ * With 'keep_mounted' set devices having boot config stay mounted on
+ * their mountpoints; caller owns these mounts after taking results.
+ */
+typedef struct {
+	unsigned int size;			/* Allocated jobs count */
+	unsigned int count;			/* Filled jobs count */
+	unsigned int running;		/* Running workers count */
+	unsigned int max_workers;	/* Concurrent workers limit */
+	int with_icons;				/* Load custom icons flag */
+	int keep_mounted;			/* Leave devices with boot config mounted */
+	struct charlist *fslist;	/* Filesystems known by kernel */
+	kx_bootcache *cache;		/* Boot items cache (NULL - disabled) */
+	kx_scan_job **list;			/* Jobs array */
+} kx_scanpool;
+
+
+/* Initialize pool of 'max_workers' workers. Cache is optional */
+int scanpool_init(kx_scanpool *pool, unsigned int max_workers,
+		struct charlist *fslist, kx_bootcache *cache, int with_icons,
+		int keep_mounted);
+
+/* Get private mountpoint of device */
+char *scanpool_mountpoint(char *buf, size_t size, const char *device);
+
+/* Unmount device left mounted by worker of job when nobody takes it */
+void scanpool_umount(kx_scan_job *job);
+
+/* Queue device for probing. Pool takes ownership of dev->device.
+ * Superblock is not read again when device is in FS probe cache */
+int scanpool_add(kx_scanpool *pool, struct device_t *dev);
+
+/* Start workers for queued jobs up to workers limit */
+int scanpool_start(kx_scanpool *pool);
+
+/*
+ * Function: scanpool_process()
+ * Wait for data from workers and process it.
+ * Args:
+ * - pool structure
+ * - timeout in milliseconds (-1 to wait infinitely)
+ * Return value:
+ * - count of jobs finished during this call
+ * - -1 on error
+ */
+int scanpool_process(kx_scanpool *pool, int timeout);
+
+/* Return count of queued and running jobs */
+unsigned int scanpool_busy(kx_scanpool *pool);
+
+/* Drop not merged jobs of device (major, minor). Return count of dropped jobs */
+int scanpool_cancel(kx_scanpool *pool, int major, int minor);
+
+/* Kill running workers and free jobs */
+void scanpool_clean(kx_scanpool *pool);
+
+#endif //_HAVE_SCANPOOL_H_
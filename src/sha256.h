@@ -0,0 +1,44 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *
+ *  Copyright (c) 2008-2011 Yuri Bushmelev <jay4mail@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+#ifndef _HAVE_SHA256_H_
+#define _HAVE_SHA256_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE	32
+
+/* Streaming SHA-256 context */
+typedef struct {
+	uint32_t state[8];
+	uint64_t count;			/* Bytes hashed */
+	unsigned char buf[64];	/* Not hashed yet tail */
+} kx_sha256;
+
+/* Start new hash */
+void sha256_init(kx_sha256 *ctx);
+
+/* Hash next 'len' bytes of data */
+void sha256_update(kx_sha256 *ctx, const void *data, size_t len);
+
+/* Finish hash and store digest */
+void sha256_final(kx_sha256 *ctx, unsigned char *digest);
+
+/* Compare digest with hex string (case insensitive). Return 0 when equal */
+int sha256_cmp_hex(const unsigned char *digest, const char *hex);
+
+#endif //_HAVE_SHA256_H_
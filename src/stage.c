@@ -0,0 +1,160 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *
+ *  Copyright (c) 2008-2011 Yuri Bushmelev <jay4mail@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+#include "config.h"
+
+#ifdef USE_PRESTAGE
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/mount.h>
+
+#include "util.h"
+#include "stage.h"
+#include "fit.h"
+#include "initrd.h"
+
+/* Read file to page cache */
+static void stage_file(const char *path)
+{
+	char buf[65536];
+	char spath[PATH_MAX];
+	int fd;
+	ssize_t n;
+
+	if (!path) return;
+
+	probe_path(spath, sizeof(spath), STAGE_MOUNTPOINT, path);
+	fd = open(spath, O_RDONLY);
+	if (-1 == fd) return;
+
+	do {
+		n = read(fd, buf, sizeof(buf));
+	} while ( (n > 0) || ((-1 == n) && (EINTR == errno)) );
+
+	close(fd);
+}
+
+
+/* Read sub-images of FIT configuration to page cache */
+static void stage_fit(struct boot_item_t *item)
+{
+	char spath[PATH_MAX];
+	kx_fit fit;
+	kx_fit_conf *conf;
+	kx_fit_image *img;
+
+	probe_path(spath, sizeof(spath), STAGE_MOUNTPOINT, item->kernelpath);
+	if (-1 == fit_open(spath, &fit)) return;
+
+	conf = fit_find_conf(&fit, item->fitconf);
+	if (conf) {
+		if ( (img = fit_find_image(&fit, conf->kernel)) )
+			fit_extract(spath, img, NULL);
+		if ( conf->fdt[0] && (img = fit_find_image(&fit, conf->fdt)) )
+			fit_extract(spath, img, NULL);
+		if ( conf->ramdisk[0] && (img = fit_find_image(&fit, conf->ramdisk)) )
+			fit_extract(spath, img, NULL);
+	}
+
+	fit_close(&fit);
+}
+
+
+void stage_init(kx_stage *stage)
+{
+	stage->pid = -1;
+	stage->item = -1;
+}
+
+
+int stage_start(kx_stage *stage, int no, struct boot_item_t *item)
+{
+	pid_t pid;
+	struct charlist *parts;
+	int i;
+
+	stage_discard(stage);
+
+	/* UBI volumes are attached by start_kernel() only */
+	if (!item->device || !item->fstype || !strncmp(item->fstype, "ubi", 3))
+		return -1;
+
+	fflush(stdout);
+	fflush(stderr);
+
+	pid = fork();
+	if (pid < 0) {
+		log_msg(lg, "Can't fork stager: %s", ERRMSG);
+		return -1;
+	} else if (0 == pid) {
+		/* it is child */
+		if ( (-1 == mkdir_parents(STAGE_MOUNTPOINT, 0700)) ||
+				(-1 == mount(item->device, STAGE_MOUNTPOINT, item->fstype,
+					MS_RDONLY, NULL)) )
+			_exit(1);
+
+		if (item->fitconf) {
+			/* Don't read whole container */
+			stage_fit(item);
+		} else {
+			stage_file(item->kernelpath);
+		}
+		parts = initrd_split(item->initrd);
+		for (i = 0; i < parts->fill; i++)
+			stage_file(parts->list[i]);
+		free_charlist(parts);
+		stage_file(item->dtbpath);
+
+		/* Mountpoint is kept till stage_discard() */
+		_exit(0);
+	}
+
+	/* it is parent */
+	log_msg(lg, "Staging %s from %s", item->kernelpath, item->device);
+	stage->pid = pid;
+	stage->item = no;
+
+	return 0;
+}
+
+
+void stage_discard(kx_stage *stage)
+{
+	if (-1 == stage->item) return;
+
+	if (stage->pid > 0) {
+		kill(stage->pid, SIGKILL);
+		waitpid(stage->pid, NULL, 0);
+	}
+
+	/* Page cache of device is dropped with last mount */
+	umount(STAGE_MOUNTPOINT);
+	rmdir(STAGE_MOUNTPOINT);
+
+	stage->pid = -1;
+	stage->item = -1;
+}
+
+#endif	/* USE_PRESTAGE */
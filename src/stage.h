@@ -0,0 +1,48 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *
+ *  Copyright (c) 2008-2011 Yuri Bushmelev <jay4mail@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+#ifndef _HAVE_STAGE_H_
+#define _HAVE_STAGE_H_
+
+#include <sys/types.h>
+
+#include "config.h"
+#include "devicescan.h"
+
+/* Private mountpoint of staged boot item */
+#define STAGE_MOUNTPOINT	PROBE_MOUNTROOT "/stage"
+
+/*
+ * Speculative staging of boot item. Forked stager mounts item's device
+ * on STAGE_MOUNTPOINT and reads kernel, initrd and dtb to page cache.
+ * Mount is kept so cache lives till start_kernel() mounts same device
+ * again (superblock is shared) and kexec reads files from memory.
+ */
+typedef struct {
+	pid_t pid;		/* Stager process (-1 - none) */
+	int item;		/* Staged boot item No (-1 - none) */
+} kx_stage;
+
+/* Initialize stage structure */
+void stage_init(kx_stage *stage);
+
+/* Start staging of boot item 'no'. Previous stage is discarded */
+int stage_start(kx_stage *stage, int no, struct boot_item_t *item);
+
+/* Stop stager and drop staged data */
+void stage_discard(kx_stage *stage);
+
+#endif //_HAVE_STAGE_H_
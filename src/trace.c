@@ -0,0 +1,175 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *
+ *  Copyright (c) 2008-2011 Yuri Bushmelev <jay4mail@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+#include "config.h"
+
+#ifdef USE_TRACE
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+
+#include "util.h"
+#include "trace.h"
+
+struct trace_span {
+	char name[16];			/* Phase name */
+	char arg[32];			/* Phase argument (device, path) */
+	int pid;				/* Process which recorded span */
+	unsigned long long start;	/* Monotonic time in microseconds */
+	unsigned long long end;		/* 0 - span is not finished */
+	int shown;				/* Span is shown in log already */
+};
+
+static struct trace_span spans[TRACE_MAX_SPANS];
+static int spans_count = 0;
+static int spans_dumped = 0;
+static unsigned long long origin = 0;
+
+
+int trace_begin(const char *name, const char *arg)
+{
+	struct trace_span *sp;
+
+	if (spans_count >= TRACE_MAX_SPANS) return -1;
+
+	sp = &spans[spans_count];
+	strncpy(sp->name, name, sizeof(sp->name) - 1);
+	sp->name[sizeof(sp->name) - 1] = '\0';
+	if (arg) {
+		strncpy(sp->arg, arg, sizeof(sp->arg) - 1);
+		sp->arg[sizeof(sp->arg) - 1] = '\0';
+	} else {
+		sp->arg[0] = '\0';
+	}
+	sp->pid = getpid();
+	sp->start = get_monotonic_us();
+	sp->end = 0;
+	sp->shown = 0;
+
+	if (0 == origin) origin = sp->start;
+
+	return spans_count++;
+}
+
+
+void trace_end(int id)
+{
+	if ( (id < 0) || (id >= spans_count) ) return;
+	spans[id].end = get_monotonic_us();
+}
+
+
+int trace_mark(void)
+{
+	return spans_count;
+}
+
+
+void trace_pack(kx_buffer *buf, int mark)
+{
+	int i;
+
+	buffer_put_int(buf, spans_count - mark);
+	for (i = mark; i < spans_count; i++)
+		buffer_put(buf, &spans[i], sizeof(spans[i]));
+}
+
+
+int trace_unpack(kx_buffer *buf)
+{
+	struct trace_span sp;
+	int i, n;
+
+	if (-1 == buffer_get_int(buf, &n)) return -1;
+
+	for (i = 0; i < n; i++) {
+		if (-1 == buffer_get(buf, &sp, sizeof(sp))) return -1;
+		if (spans_count < TRACE_MAX_SPANS)
+			spans[spans_count++] = sp;
+	}
+
+	return 0;
+}
+
+
+void trace_dump(kx_text *log)
+{
+	struct trace_span *sp;
+	int i;
+
+	for (i = spans_dumped; i < spans_count; i++) {
+		sp = &spans[i];
+
+		/* Unfinished spans are shown later */
+		if ( sp->shown || (0 == sp->end) ) continue;
+
+		sp->shown = 1;
+		log_msg(log, "trace: %s %s at %llu.%03llums took %llu.%03llums",
+				sp->name, sp->arg,
+				(sp->start - origin) / 1000, (sp->start - origin) % 1000,
+				(sp->end - sp->start) / 1000, (sp->end - sp->start) % 1000);
+	}
+
+	/* Skip spans which are shown already next time */
+	while ( (spans_dumped < spans_count) && spans[spans_dumped].shown )
+		++spans_dumped;
+}
+
+
+/* Write string escaped for JSON */
+static void json_str(FILE *f, const char *str)
+{
+	fputc('"', f);
+	for (; *str; str++) {
+		if ( ('"' == *str) || ('\\' == *str) ) fputc('\\', f);
+		if ((unsigned char)*str < 0x20) continue;
+		fputc(*str, f);
+	}
+	fputc('"', f);
+}
+
+
+int trace_save(const char *path)
+{
+	FILE *f;
+	struct trace_span *sp;
+	int i;
+
+	f = fopen(path, "w");
+	if (NULL == f) {
+		log_msg(lg, "Can't write trace to %s: %s", path, ERRMSG);
+		return -1;
+	}
+
+	for (i = 0; i < spans_count; i++) {
+		sp = &spans[i];
+		fputs("{\"name\":", f);
+		json_str(f, sp->name);
+		fputs(",\"arg\":", f);
+		json_str(f, sp->arg);
+		fprintf(f, ",\"pid\":%d,\"ts\":%llu,\"dur\":%lld}\n", sp->pid,
+				sp->start - origin,
+				(sp->end ? (long long)(sp->end - sp->start) : -1LL));
+	}
+
+	fclose(f);
+	return 0;
+}
+
+#endif	/* USE_TRACE */
@@ -0,0 +1,61 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *
+ *  Copyright (c) 2008-2011 Yuri Bushmelev <jay4mail@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+#ifndef _HAVE_TRACE_H_
+#define _HAVE_TRACE_H_
+
+#include "config.h"
+#include "util.h"
+
+#ifdef USE_TRACE
+
+/* Maximum count of spans recorded during session */
+#define TRACE_MAX_SPANS	256
+
+/*
+ * Timeline of boot phases. Spans are stamped with monotonic clock so
+ * spans recorded by forked scan workers fit into parent's timeline.
+ */
+
+/* Start span 'name' with optional argument (device e.g.). Return span id */
+int trace_begin(const char *name, const char *arg);
+
+/* Finish span 'id' */
+void trace_end(int id);
+
+/* Return count of recorded spans. Used by workers to send new spans only */
+int trace_mark(void);
+
+/* Append spans recorded since 'mark' to buffer */
+void trace_pack(kx_buffer *buf, int mark);
+
+/* Fetch spans from buffer and add them to timeline */
+int trace_unpack(kx_buffer *buf);
+
+/* Append spans which are not shown yet to log */
+void trace_dump(kx_text *log);
+
+/* Write timeline as JSON lines to 'path' */
+int trace_save(const char *path);
+
+#else
+
+static inline int trace_begin(const char *name, const char *arg) { return -1; }
+static inline void trace_end(int id) { }
+
+#endif	/* USE_TRACE */
+
+#endif //_HAVE_TRACE_H_
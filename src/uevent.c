@@ -0,0 +1,122 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *
+ *  Copyright (c) 2008-2011 Yuri Bushmelev <jay4mail@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "config.h"
+#include "util.h"
+#include "uevent.h"
+
+/* Kernel limits uevent size to 2048 bytes of environment plus header */
+#define UEVENT_BUFFER_SIZE	2560
+
+/* Open netlink socket to receive kernel uevents */
+int uevent_open(void)
+{
+	int fd;
+	struct sockaddr_nl snl;
+
+	fd = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT);
+	if (-1 == fd) {
+		log_msg(lg, "Can't open uevent socket: %s", ERRMSG);
+		return -1;
+	}
+
+	memset(&snl, 0, sizeof(snl));
+	snl.nl_family = AF_NETLINK;
+	snl.nl_pid = getpid();
+	snl.nl_groups = 1;	/* Kernel events group */
+
+	if (-1 == bind(fd, (struct sockaddr *)&snl, sizeof(snl))) {
+		log_msg(lg, "Can't bind uevent socket: %s", ERRMSG);
+		close(fd);
+		return -1;
+	}
+
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	return fd;
+}
+
+
+/* Read one uevent from socket */
+int uevent_read(int fd, struct uevent_t *ev)
+{
+	char buf[UEVENT_BUFFER_SIZE];
+	char *p, *end;
+	int is_block = 0;
+	ssize_t len;
+
+	do {
+		len = recv(fd, buf, sizeof(buf) - 1, 0);
+	} while ( (-1 == len) && (EINTR == errno) );
+
+	if (len <= 0) {
+		if ( (0 != len) && (EAGAIN != errno) )
+			log_msg(lg, "Can't read uevent: %s", ERRMSG);
+		return -1;
+	}
+	buf[len] = '\0';
+	end = buf + len;
+
+	ev->action = UEV_UNKNOWN;
+	ev->major = -1;
+	ev->minor = -1;
+	ev->devname[0] = '\0';
+
+	/* Message is 'action@devpath' followed by NUL-separated KEY=value pairs */
+	for (p = buf + strlen(buf) + 1; p < end; p += strlen(p) + 1) {
+		if (!strncmp(p, "ACTION=", 7)) {
+			p += 7;
+			if (!strcmp(p, "add")) ev->action = UEV_ADD;
+			else if (!strcmp(p, "remove")) ev->action = UEV_REMOVE;
+			else if (!strcmp(p, "change")) ev->action = UEV_CHANGE;
+		} else if (!strncmp(p, "SUBSYSTEM=", 10)) {
+			is_block = !strcmp(p + 10, "block");
+		} else if (!strncmp(p, "MAJOR=", 6)) {
+			ev->major = atoi(p + 6);
+		} else if (!strncmp(p, "MINOR=", 6)) {
+			ev->minor = atoi(p + 6);
+		} else if (!strncmp(p, "DEVNAME=", 8)) {
+			strncpy(ev->devname, p + 8, sizeof(ev->devname) - 1);
+			ev->devname[sizeof(ev->devname) - 1] = '\0';
+		}
+	}
+
+	if ( !is_block || (UEV_UNKNOWN == ev->action) || (ev->major < 0) ||
+			(ev->minor < 0) || ('\0' == ev->devname[0]) )
+		return 0;
+
+	/* Nodes in /dev subdirectories are not named so in /proc/partitions */
+	if (strchr(ev->devname, '/')) return 0;
+
+	return 1;
+}
+
+
+/* Close uevent socket */
+void uevent_close(int fd)
+{
+	if (fd >= 0) close(fd);
+}
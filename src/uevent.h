@@ -0,0 +1,56 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *
+ *  Copyright (c) 2008-2011 Yuri Bushmelev <jay4mail@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+#ifndef _HAVE_UEVENT_H_
+#define _HAVE_UEVENT_H_
+
+#include "config.h"
+
+/* Block device events we are interested in */
+enum uevent_action_t {
+	UEV_UNKNOWN,
+	UEV_ADD,
+	UEV_REMOVE,
+	UEV_CHANGE
+};
+
+/* Kernel uevent of block device */
+struct uevent_t {
+	enum uevent_action_t action;
+	int major, minor;		/* Device numbers */
+	char devname[32];		/* Kernel device name (mmcblk0p1) */
+};
+
+/* Open netlink socket to receive kernel uevents. Return fd or -1 */
+int uevent_open(void);
+
+/*
+ * Function: uevent_read()
+ * Read one uevent from non-blocking socket.
+ * Args:
+ * - socket fd
+ * - event structure to fill
+ * Return value:
+ * - 1 when block device event is read
+ * - 0 when event is not interesting for us
+ * - -1 when there are no more events or on error
+ */
+int uevent_read(int fd, struct uevent_t *ev);
+
+/* Close uevent socket */
+void uevent_close(int fd);
+
+#endif //_HAVE_UEVENT_H_
@@ -22,12 +22,17 @@
 #include <unistd.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
 #include <termios.h>
 #include <limits.h>		/* LONG_MAX, INT_MAX */
 #include <stdarg.h>		/* va_start/va_end */
+#include <time.h>		/* clock_gettime */
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <mtd/ubi-user.h>
 
 #include "config.h"
 #include "util.h"
@@ -93,6 +98,160 @@ int in_charlist(struct charlist *cl, const char *str)
 }
 
 
+/* Initialize buffer structure */
+int buffer_init(kx_buffer *buf, unsigned int size)
+{
+	buf->data = malloc(size);
+	if (NULL == buf->data) {
+		DPRINTF("Can't allocate buffer data");
+		buf->size = 0;
+		return -1;
+	}
+	buf->size = size;
+	buf->fill = 0;
+	buf->pos = 0;
+	return 0;
+}
+
+
+/* Free buffer data */
+void buffer_clean(kx_buffer *buf)
+{
+	dispose(buf->data);
+	buf->data = NULL;
+	buf->size = 0;
+	buf->fill = 0;
+	buf->pos = 0;
+}
+
+
+/* Resize buffer to hold at least 'len' more bytes */
+static int buffer_reserve(kx_buffer *buf, unsigned int len)
+{
+	char *new_data;
+	unsigned int new_size;
+
+	if (buf->fill + len <= buf->size) return 0;
+
+	new_size = (buf->size ? buf->size : 64);
+	while (new_size < buf->fill + len) new_size <<= 1;	/* size *= 2; */
+
+	new_data = realloc(buf->data, new_size);
+	if (NULL == new_data) {
+		DPRINTF("Can't resize buffer");
+		return -1;
+	}
+
+	buf->data = new_data;
+	buf->size = new_size;
+	return 0;
+}
+
+
+/* Append data to buffer */
+int buffer_put(kx_buffer *buf, const void *data, unsigned int len)
+{
+	if (-1 == buffer_reserve(buf, len)) return -1;
+
+	memcpy(buf->data + buf->fill, data, len);
+	buf->fill += len;
+	return 0;
+}
+
+
+/* Append integer to buffer */
+int buffer_put_int(kx_buffer *buf, int val)
+{
+	return buffer_put(buf, &val, sizeof(val));
+}
+
+
+/* Append string to buffer. NULL is stored as length -1 */
+int buffer_put_str(kx_buffer *buf, const char *str)
+{
+	int len;
+
+	if (NULL == str) return buffer_put_int(buf, -1);
+
+	len = strlen(str);
+	if (-1 == buffer_put_int(buf, len)) return -1;
+	return buffer_put(buf, str, len);
+}
+
+
+/* Fetch data from buffer */
+int buffer_get(kx_buffer *buf, void *data, unsigned int len)
+{
+	if (buf->pos + len > buf->fill) return -1;
+
+	memcpy(data, buf->data + buf->pos, len);
+	buf->pos += len;
+	return 0;
+}
+
+
+/* Fetch integer from buffer */
+int buffer_get_int(kx_buffer *buf, int *val)
+{
+	return buffer_get(buf, val, sizeof(*val));
+}
+
+
+/* Fetch string from buffer */
+int buffer_get_str(kx_buffer *buf, char **str)
+{
+	int len;
+
+	*str = NULL;
+	if (-1 == buffer_get_int(buf, &len)) return -1;
+	if (-1 == len) return 0;	/* NULL string */
+
+	if ( (len < 0) || (buf->pos + len > buf->fill) ) return -1;
+
+	*str = malloc(len + 1);
+	if (NULL == *str) {
+		DPRINTF("Can't allocate memory for string");
+		return -1;
+	}
+
+	memcpy(*str, buf->data + buf->pos, len);
+	(*str)[len] = '\0';
+	buf->pos += len;
+	return 0;
+}
+
+
+/* Read available data from fd into buffer */
+int buffer_read_fd(kx_buffer *buf, int fd)
+{
+	int n;
+
+	if (-1 == buffer_reserve(buf, 4096)) return -1;
+
+	n = read(fd, buf->data + buf->fill, buf->size - buf->fill);
+	if (n > 0) buf->fill += n;
+	return n;
+}
+
+
+/* Write whole buffer into fd */
+int buffer_write_fd(kx_buffer *buf, int fd)
+{
+	unsigned int done = 0;
+	int n;
+
+	while (done < buf->fill) {
+		n = write(fd, buf->data + done, buf->fill - done);
+		if (-1 == n) {
+			if (EINTR == errno) continue;
+			return -1;
+		}
+		done += n;
+	}
+	return 0;
+}
+
+
 kx_text *log_open(unsigned int size)
 {
 	kx_text *log;
@@ -282,6 +441,16 @@ int get_nni(const char *str, char **endptr)
 }
 
 
+/* Return monotonic time in microseconds */
+unsigned long long get_monotonic_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+
 /*
  * Change terminal settings.
  * Mode: 1 - change; 0 - restore.
@@ -387,8 +556,108 @@ int fexecw(const char *path, char *const argv[], char *const envp[])
 	return status;
 }
 
+/* Create directory with missing parents. Existing directory is not an error */
+int mkdir_parents(const char *path, mode_t mode)
+{
+	char buf[PATH_MAX];
+	char *p;
+
+	if (strlen(path) >= sizeof(buf)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(buf, path);
+
+	for (p = buf + 1; *p; p++) {
+		if ('/' != *p) continue;
+		*p = '\0';
+		if ( (-1 == mkdir(buf, 0755)) && (EEXIST != errno) )
+			return -1;
+		*p = '/';
+	}
+
+	if ( (-1 == mkdir(buf, mode)) && (EEXIST != errno) )
+		return -1;
+
+	return 0;
+}
+
+/* Known MTD to UBI devices mapping (ubi_num + 1, 0 - unknown) */
+static int ubi_map[UBI_MAX_MTD];
+
+int ubi_lookup(int mtd_num)
+{
+	if ( (mtd_num < 0) || (mtd_num >= UBI_MAX_MTD) ) return -1;
+	return ubi_map[mtd_num] - 1;
+}
+
+void ubi_remember(int mtd_num, int ubi_num)
+{
+	if ( (mtd_num < 0) || (mtd_num >= UBI_MAX_MTD) ) return;
+	ubi_map[mtd_num] = ubi_num + 1;
+}
+
+
+/* Get MTD number from trailing digits of device name (/dev/mtdblock2) */
+int ubi_mtd_num(const char *device)
+{
+	const char *p;
+
+	p = device + strlen(device);
+	while ( (p > device) && isdigit(*(p - 1)) ) --p;
+	if ('\0' == *p) return -1;
+
+	return atoi(p);
+}
+
+
+/* Format UBI volume to mount (/dev/ubi0_0 or ubi0:name) */
+char *ubi_volume_dev(char *buf, size_t size, int ubi_num)
+{
+#ifdef UBI_VOLUME
+	snprintf(buf, size, "ubi%d:%s", ubi_num, UBI_VOLUME);
+#else
+	snprintf(buf, size, "/dev/ubi%d_0", ubi_num);
+#endif
+	return buf;
+}
+
+
 /*
- * wrapper around fexecw ubiattach
+ * Attach MTD by UBI_IOCATT ioctl. Kernel tells us new UBI device number,
+ * so sysfs is not scanned. Return -1 on error, -2 if ioctl is not available
+ */
+static int ubi_attach_ioctl(int mtd_num)
+{
+	struct ubi_attach_req req;
+	int fd, rc;
+
+	fd = open(UBI_CTRL_DEV, O_RDONLY);
+	if (-1 == fd) return -2;
+
+	memset(&req, 0, sizeof(req));
+	req.ubi_num = UBI_DEV_NUM_AUTO;
+	req.mtd_num = mtd_num;
+#ifdef UBI_VID_HDR_OFFSET
+	req.vid_hdr_offset = atoi(UBI_VID_HDR_OFFSET);
+#endif
+
+	rc = ioctl(fd, UBI_IOCATT, &req);
+	if (-1 == rc) {
+		if (ENOTTY == errno) rc = -2;
+		else log_msg(lg, "+ can't attach mtd%d: %s", mtd_num, ERRMSG);
+	} else {
+		rc = req.ubi_num;
+		log_msg(lg, "+ map /dev/ubi%d on /dev/mtd%d", rc, mtd_num);
+	}
+	close(fd);
+
+	return rc;
+}
+
+
+/*
+ * Attach UBI to mtd_id by ioctl or by ubiattach if ioctl is not available.
  * returns ubi_id attached to mtd_id
  * on error, returns -1 so that mount fails
  */
@@ -399,6 +668,17 @@ int ubi_attach(const char *mtd_id)
 	char *const envp[] = { NULL };
 	int n,res;
 
+	res = ubi_lookup(atoi(mtd_id));
+	if (res >= 0) return res;
+
+	res = ubi_attach_ioctl(atoi(mtd_id));
+	if (res >= 0) {
+		ubi_remember(atoi(mtd_id), res);
+		return res;
+	}
+	/* Attached already (EEXIST) or attach failed. Look at sysfs */
+	if (-1 == res) return find_attached_ubi_device(mtd_id);
+
 	ubiattach_argv[0] = UBIATTACH_PATH;
 	ubiattach_argv[1] = "-m";
 	ubiattach_argv[2] = mtd_id;
@@ -423,15 +703,19 @@ int ubi_attach(const char *mtd_id)
  * loop until /sys/class/ubi/ubiX/mtd_num == mtd_id
  * kernel: max 32 ubi devices (0-31)
  * kernel: max 16 mtd char devices (0-15)
+ * Found mapping is remembered and sysfs is not read again
  */
 int find_attached_ubi_device(const char *mtd_id)
 {
 	char sys_class_ubi[32]; /* max 26 + 2 + 1 */
 	int ubi_id;
-	char line[3];
+	char line[4];
 	int res = -1;
 	FILE *f;
 
+	res = ubi_lookup(atoi(mtd_id));
+	if (res >= 0) return res;
+
 	for (ubi_id = 0; ubi_id < 32; ubi_id++)
 	{
 		snprintf(sys_class_ubi, sizeof(sys_class_ubi), "/sys/class/ubi/ubi%d/mtd_num", ubi_id);
@@ -441,8 +725,7 @@ int find_attached_ubi_device(const char *mtd_id)
 		} else {
 			/* We have only one line in that file */
 			if (fgets(line, sizeof(line), f)) {
-				line[strlen(line) - 1] = '\0';
-				if (!strncmp(line, mtd_id, 2)) {
+				if (atoi(line) == atoi(mtd_id)) {
 					log_msg(lg, "+ map /dev/ubi%d on /dev/mtd%s", ubi_id, mtd_id);
 					res = ubi_id;
 				}
@@ -451,5 +734,7 @@ int find_attached_ubi_device(const char *mtd_id)
 			if (res >= 0) break;
 		}
 	}
+
+	if (res >= 0) ubi_remember(atoi(mtd_id), res);
 	return res;
 }
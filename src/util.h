@@ -20,6 +20,7 @@
 #define _HAVE_UTIL_H_
 
 #include <stdint.h>     /* uint's below */
+#include <sys/types.h>  /* mode_t */
 
 #ifndef COMMAND_LINE_SIZE
 #define COMMAND_LINE_SIZE 1024
@@ -64,6 +65,14 @@ struct charlist {
 	unsigned int fill;
 };
 
+/* Growable byte buffer (used to pass data between processes) */
+typedef struct {
+	char *data;
+	unsigned int size;	/* Allocated bytes */
+	unsigned int fill;	/* Filled bytes */
+	unsigned int pos;	/* Read position */
+} kx_buffer;
+
 /* Text structure */
 typedef struct {
 	unsigned int current_line_no;
@@ -90,6 +99,37 @@ void addto_charlist(struct charlist *cl, const char *str);
 int in_charlist(struct charlist *cl, const char *str);
 
 
+/* Initialize buffer of 'size' bytes initial */
+int buffer_init(kx_buffer *buf, unsigned int size);
+
+/* Free buffer data */
+void buffer_clean(kx_buffer *buf);
+
+/* Append 'len' bytes of 'data' to buffer */
+int buffer_put(kx_buffer *buf, const void *data, unsigned int len);
+
+/* Append integer to buffer */
+int buffer_put_int(kx_buffer *buf, int val);
+
+/* Append string (may be NULL) to buffer */
+int buffer_put_str(kx_buffer *buf, const char *str);
+
+/* Fetch 'len' bytes from buffer into 'data' */
+int buffer_get(kx_buffer *buf, void *data, unsigned int len);
+
+/* Fetch integer from buffer */
+int buffer_get_int(kx_buffer *buf, int *val);
+
+/* Fetch string from buffer. Result is allocated (or NULL) and should be free()'d */
+int buffer_get_str(kx_buffer *buf, char **str);
+
+/* Read available data from fd into buffer. Return bytes read, 0 on EOF, -1 on error */
+int buffer_read_fd(kx_buffer *buf, int fd);
+
+/* Write whole buffer into fd */
+int buffer_write_fd(kx_buffer *buf, int fd);
+
+
 /* Create log structure of 'size' initial rows */
 kx_text *log_open(unsigned int size);
 
@@ -129,6 +169,9 @@ int get_nni(const char *str, char **endptr);
 /* Return unsigned long long from string 'str' and end of number in 'endptr' */
 unsigned long long get_nnll(const char *str, char **endptr, int *error_flag);
 
+/* Return monotonic time in microseconds */
+unsigned long long get_monotonic_us(void);
+
 /* Change terminal settings */
 void setup_terminal(char *ttydev, int *echo_state, int mode);
 
@@ -151,10 +194,39 @@ void setup_terminal(char *ttydev, int *echo_state, int mode);
  */
 int fexecw(const char *path, char *const argv[], char *const envp[]);
 
+/* Create directory with missing parents like 'mkdir -p'.
+ * Return 0 on success, -1 on error (errno is set) */
+int mkdir_parents(const char *path, mode_t mode);
+
+/* UBI control device */
+#define UBI_CTRL_DEV	"/dev/ubi_ctrl"
+
+/* Count of MTD devices which UBI mapping is remembered for */
+#define UBI_MAX_MTD	32
+
+/* Suffix of UBI volume to boot in root= */
+#ifdef UBI_VOLUME
+#define UBI_VOLUME_SUFFIX	":" UBI_VOLUME
+#else
+#define UBI_VOLUME_SUFFIX	"_0"
+#endif
+
 /* UBI attach MTD device to mtd_id */
 int ubi_attach(const char *mtd_id);
 
 /* Find UBI device attached to mtd_id */
 int find_attached_ubi_device(const char *mtd_id);
 
+/* Get remembered UBI device of MTD (-1 - unknown) */
+int ubi_lookup(int mtd_num);
+
+/* Remember UBI device attached to MTD */
+void ubi_remember(int mtd_num, int ubi_num);
+
+/* Get MTD number from device name. Return -1 if there is no number */
+int ubi_mtd_num(const char *device);
+
+/* Format UBI volume device to mount into buf */
+char *ubi_volume_dev(char *buf, size_t size, int ubi_num);
+
 #endif //_HAVE_UTIL_H_
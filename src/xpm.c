@@ -563,6 +563,10 @@ kx_picture *xpm_parse_image(char **xpm_data, const int rows)
 	/* Store values */
 	xpm_parsed->width = width;
 	xpm_parsed->height = height;
+	xpm_parsed->pixels = NULL;
+	xpm_parsed->native = NULL;
+	xpm_parsed->runs = NULL;
+	xpm_parsed->nruns = 0;
 
 	xpm_meta.ncolors = ncolors;
 	xpm_meta.chpp = chpp;